@@ -270,6 +270,18 @@ uint32_t Axp192_GetBatteryCharge()
   return 65536 / 2 * (chargeColumbMeterData - dischargeColumbMeterData) / 3600 / Axp192_GetAdcSamplingRate();
 }
 
+int16_t Axp192_GetInternalTemperature()
+{
+  uint8_t temperatureLow;
+  uint8_t temperatureHigh;
+
+  Axp192_ReadRegister(Axp192_InternalTemperatureLow4Bit, &temperatureLow);
+  Axp192_ReadRegister(Axp192_InternalTemperatureHigh8Bit, &temperatureHigh);
+
+  /* Calculate physical value in 0.1 °C based on a resolution of 0.1 °C per digit and an offset of -144.7 °C */
+  return (int16_t)((((uint16_t)temperatureHigh) << 4) | (temperatureLow & 0x0F)) - 1447;
+}
+
 Axp192_AdcSamplingRateType Axp192_GetAdcSamplingRate()
 {
   uint8_t registerValue;
@@ -311,6 +323,12 @@ Axp192_PowerModeType Axp192_GetPowerMode()
   return (Axp192_PowerModeType)Axp192_ReadRegister1Bit(Axp192_PowerMode_ChargeStatusRegister, 1);
 }
 
+Axp192_StateType Axp192_GetVbusState()
+{
+  /* Bit 5: VBUS present */
+  return (Axp192_StateType)Axp192_ReadRegister1Bit(Axp192_PowerStatusRegister, 5);
+}
+
 Axp192_StateType Axp192_GetPwronWakeupFunctionState()
 {
   return (Axp192_StateType)Axp192_ReadRegister1Bit(Axp192_VoffShutdownVoltageSettingRegister, 3);
@@ -61,6 +61,8 @@ typedef enum
   Axp192_IrqStatusRegister3 = 0x46,
   Axp192_IrqStatusRegister4 = 0x47,
   Axp192_IrqStatusRegister5 = 0x4D,
+  Axp192_InternalTemperatureHigh8Bit = 0x5E,
+  Axp192_InternalTemperatureLow4Bit,
   Axp192_BatteryVoltageHigh8Bit = 0x78,
   Axp192_BatteryVoltageLow4Bit,
   Axp192_BatteryChargeCurrentHigh8Bit = 0x7A,
@@ -200,10 +202,12 @@ extern uint16_t Axp192_GetBatteryVoltage();
 extern uint16_t Axp192_GetBatteryChargeCurrent();
 extern uint16_t Axp192_GetBatteryDischargeCurrent();
 extern uint32_t Axp192_GetBatteryCharge();
+extern int16_t Axp192_GetInternalTemperature();
 extern Axp192_AdcSamplingRateType Axp192_GetAdcSamplingRate();
 extern Axp192_StateType Axp192_GetChargeFunctionState();
 extern Axp192_ChargeTargetVoltageType Axp192_GetChargeTargetVoltage();
 extern Axp192_PowerModeType Axp192_GetPowerMode();
+extern Axp192_StateType Axp192_GetVbusState();
 extern Axp192_StateType Axp192_GetPwronWakeupFunctionState();
 extern void Axp192_SetPwronWakeupFunctionState(Axp192_StateType state);
 extern void Axp192_Shutdown();
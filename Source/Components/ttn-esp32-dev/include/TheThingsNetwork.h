@@ -35,6 +35,20 @@ enum TTNResponseCode
   kTTNSuccessfulReceive = 2
 };
 
+/**
+ * @brief Categories of LMIC event logging
+ */
+enum TTNLogCategory
+{
+  kTTNLogRadio = 0x01,
+  kTTNLogRx = 0x02,
+  kTTNLogTx = 0x04,
+  kTTNLogMac = 0x08,
+  kTTNLogChannel = 0x10,
+  kTTNLogEvent = 0x20,
+  kTTNLogAll = 0x3f
+};
+
 /**
  * @brief Callback for recieved messages
  * 
@@ -44,6 +58,282 @@ enum TTNResponseCode
  */
 typedef void (*TTNMessageCallback)(const uint8_t* payload, size_t length, port_t port);
 
+/**
+ * @brief Statistics of received messages
+ */
+struct TTNDownlinkStats
+{
+    /** @brief Number of messages received from the network */
+    uint32_t received;
+    /** @brief Number of messages passed to the message callback */
+    uint32_t delivered;
+    /** @brief Number of messages dropped as all buffers were in use */
+    uint32_t poolExhausted;
+    /** @brief Maximum number of buffers in use at the same time */
+    uint32_t peakInUse;
+    /** @brief Number of messages received in Class C mode, outside the Class A receive windows */
+    uint32_t receivedClassC;
+    /** @brief Time from the end of the reception to the message callback (in ms, last message) */
+    uint32_t lastLatency;
+    /** @brief Maximum time from the end of the reception to the message callback (in ms) */
+    uint32_t maxLatency;
+};
+
+/**
+ * @brief Constant for indicating that the data rate of the last successful join is used
+ */
+#define TTN_JOIN_DR_LAST -1
+
+/**
+ * @brief Policy for joining the network via OTAA
+ */
+struct TTNJoinPolicy
+{
+    /** @brief Maximum time for a join (in ms), 0 for no limit */
+    uint32_t timeout;
+    /**
+     * @brief Data rate of the first join request (region specific, e.g. 5 for SF7 in EU868)
+     * 
+     * With TTN_JOIN_DR_LAST, the data rate of the last successful join is used, or
+     * the region's default if the device has not joined before.
+     */
+    int8_t startDataRate;
+    /** @brief Delay before retrying after the first failed join (in s) */
+    uint32_t minRetryDelay;
+    /** @brief Maximum delay before retrying after repeated failed joins (in s) */
+    uint32_t maxRetryDelay;
+};
+
+/**
+ * @brief Statistics of the last join
+ */
+struct TTNJoinStats
+{
+    /** @brief Number of join requests sent */
+    uint32_t attempts;
+    /** @brief Time until the join was accepted or gave up (in ms) */
+    uint32_t duration;
+    /** @brief Data rate of the last join request */
+    uint8_t dataRate;
+    /** @brief RSSI of the join accept (in dBm) */
+    int16_t rssi;
+    /** @brief SNR of the join accept (in dB) */
+    int8_t snr;
+    /** @brief Number of failed joins since the last successful join (kept during deep sleep) */
+    uint32_t failedJoins;
+};
+
+/**
+ * @brief Policy for transmitting confirmed messages
+ */
+struct TTNConfirmPolicy
+{
+    /** @brief Maximum number of transmissions of a message (including the first one) */
+    uint8_t maxAttempts;
+    /** @brief Delay before the first retransmission (in ms) */
+    uint32_t minRetryDelay;
+    /** @brief Maximum delay before a retransmission (in ms) */
+    uint32_t maxRetryDelay;
+    /** @brief Flag indicating if the data rate is lowered every second retransmission */
+    bool dataRateFallback;
+};
+
+/**
+ * @brief Statistics of the last confirmed message
+ */
+struct TTNConfirmStats
+{
+    /** @brief Flag indicating that the message has been acknowledged */
+    bool acknowledged;
+    /** @brief Number of transmissions */
+    uint8_t attempts;
+    /** @brief Data rate of the last transmission */
+    uint8_t dataRate;
+    /** @brief Time on air of all transmissions (in ms) */
+    uint32_t airtime;
+    /** @brief Time from the first transmission to the acknowledgement or giving up (in ms) */
+    uint32_t duration;
+    /** @brief RSSI of the acknowledgement (in dBm) */
+    int16_t rssi;
+    /** @brief SNR of the acknowledgement (in dB) */
+    int8_t snr;
+};
+
+/**
+ * @brief Statistics of Class B operation
+ */
+struct TTNClassBStats
+{
+    /** @brief Flag indicating that the device is synchronized with the beacons */
+    bool beaconLocked;
+    /** @brief Number of beacons received */
+    uint32_t beaconsReceived;
+    /** @brief Number of expected beacons that were missed */
+    uint32_t beaconsMissed;
+    /** @brief Number of times the beacon synchronization was lost */
+    uint32_t syncLost;
+    /** @brief Number of ping slots opened */
+    uint32_t pingSlots;
+    /** @brief Number of messages received in ping slots */
+    uint32_t pingDownlinks;
+    /** @brief Time the receiver has been on (in ms, all receive windows, estimated) */
+    uint32_t rxOnTime;
+};
+
+/**
+ * @brief Statistics of the event channel from the LMIC task to the application
+ */
+struct TTNEventStats
+{
+    /** @brief Number of events dropped as the channel was full */
+    uint32_t overflows;
+    /** @brief Maximum number of events pending at the same time */
+    uint32_t maxUsage;
+};
+
+/**
+ * @brief Synchronization statistics between the application and the LMIC task
+ */
+struct TTNSyncStats
+{
+    /** @brief Number of requests executed as commands in the LMIC task */
+    uint32_t commands;
+    /** @brief Longest time from posting a command to its completion (in µs) */
+    uint32_t maxCommandLatency;
+    /** @brief Total time from posting the commands to their completion (in µs) */
+    uint64_t totalCommandLatency;
+    /** @brief Number of times a command could not be posted as the queue was full */
+    uint32_t queueFull;
+    /** @brief Number of times the LMIC lock has been acquired */
+    uint32_t lockAcquisitions;
+    /** @brief Number of times the LMIC lock was held by another task */
+    uint32_t lockContended;
+    /** @brief Longest wait for the LMIC lock (in µs) */
+    uint32_t maxLockWait;
+    /** @brief Total wait for the LMIC lock (in µs) */
+    uint64_t totalLockWait;
+};
+
+/**
+ * @brief Histogram with fixed bucket size
+ * 
+ * Bucket i counts the values in the range [base + i * width, base + (i + 1) * width).
+ * Smaller values are counted in the first bucket, larger values in the last one.
+ */
+struct TTNHistogram
+{
+    /** @brief Lower bound of the first bucket (in µs) */
+    int32_t base;
+    /** @brief Width of each bucket (in µs) */
+    int32_t width;
+    /** @brief Number of values per bucket */
+    uint32_t buckets[16];
+    /** @brief Number of values */
+    uint32_t count;
+    /** @brief Smallest value (in µs) */
+    int32_t min;
+    /** @brief Largest value (in µs) */
+    int32_t max;
+    /** @brief Sum of all values (in µs) */
+    int64_t sum;
+};
+
+/**
+ * @brief Timing statistics of the radio
+ */
+struct TTNRadioTimingStats
+{
+    /** @brief Time from the radio interrupt to its processing in the LMIC task */
+    TTNHistogram irqLatency;
+    /** @brief Actual minus scheduled start of the RX windows */
+    TTNHistogram rxStartError;
+    /** @brief Time from the start of a received frame (estimated) to the end of the RX window */
+    TTNHistogram rxMargin;
+    /** @brief Time from the scheduled timer expiry to its processing in the LMIC task */
+    TTNHistogram timerLatency;
+};
+
+/**
+ * @brief Statistics of the SPI communication with the radio
+ */
+struct TTNRadioSpiStats
+{
+    /** @brief Number of SPI transactions */
+    uint32_t transactions;
+    /** @brief Number of bytes transferred (incl. register addresses) */
+    uint32_t bytes;
+    /** @brief Number of register writes skipped as the register already had the value */
+    uint32_t writesSkipped;
+    /** @brief Number of register reads served from the shadow copy */
+    uint32_t readsSkipped;
+};
+
+/**
+ * @brief Statistics of the LMIC job scheduler
+ * 
+ * The lateness of a timed job is the time from its scheduled time to the
+ * time it is run. Late jobs, e.g. for opening the RX windows, are a
+ * common cause of missed downlinks.
+ */
+struct TTNSchedulerStats
+{
+    /** @brief Number of immediate jobs run */
+    uint32_t immediateJobs;
+    /** @brief Number of timed jobs run */
+    uint32_t timedJobs;
+    /** @brief Number of queued jobs cancelled before they were run */
+    uint32_t cancelledJobs;
+    /** @brief Number of queued jobs replaced by a new callback before they were run */
+    uint32_t rescheduledJobs;
+    /** @brief Number of jobs currently queued */
+    uint32_t queuedJobs;
+    /** @brief Maximum number of queued jobs */
+    uint32_t maxQueuedJobs;
+    /** @brief Largest lateness of a timed job (in µs) */
+    int32_t maxLateness;
+    /** @brief Callback function of the timed job with the largest lateness (for looking up its symbol) */
+    const void* maxLatenessJob;
+    /**
+     * @brief Lateness histogram
+     * 
+     * Bucket 0 counts the jobs run on time or early, bucket i the jobs that
+     * are 16 * 2^(i-1) to 16 * 2^i µs late and the last bucket all later jobs.
+     */
+    uint32_t lateness[16];
+};
+
+/**
+ * @brief Light sleep statistics of the LMIC task
+ */
+struct TTNLightSleepStats
+{
+    /** @brief Number of times light sleep has been entered */
+    uint32_t count;
+    /** @brief Total time spent in light sleep (in ms) */
+    uint32_t time;
+    /** @brief Number of wake-ups caused by a radio interrupt */
+    uint32_t radioWakeups;
+    /** @brief Number of timer wake-ups after the scheduled LMIC job time */
+    uint32_t lateWakeups;
+    /** @brief Current wake-up time reserved before the next LMIC job (in µs, adapted to late wake-ups) */
+    uint32_t wakeupTime;
+};
+
+/**
+ * @brief State of the clock error calibration for the current temperature
+ */
+struct TTNClockCalibrationStats
+{
+    /** @brief Last reported temperature (in °C) */
+    int8_t temperature;
+    /** @brief Number of downlinks measured in the temperature band */
+    uint16_t measurements;
+    /** @brief Estimated clock drift in the temperature band (in ppm) */
+    int32_t drift;
+    /** @brief Clock error currently used for the RX windows (in ppm) */
+    uint32_t clockError;
+};
+
 /**
  * @brief TTN device
  * 
@@ -129,6 +419,22 @@ public:
      */
     bool provisionWithMAC(const char *appEui, const char *appKey);
 
+    /**
+     * @brief Sets the information needed to activate the device via ABP, without actually activating.
+     * 
+     * The provided device address, network session key and app session key are saved in
+     * non-volatile memory. Before this function is called, 'nvs_flash_init' must have been called once.
+     * 
+     * Call personalize() to activate.
+     * 
+     * @param devAddr  Device address (8 character string with hexadecimal data)
+     * @param nwkSKey  Network session key (32 character string with hexadecimal data)
+     * @param appSKey  App session key (32 character string with hexadecimal data)
+     * @return true   if the provisioning was successful
+     * @return false  if the provisioning failed
+     */
+    bool provisionABP(const char *devAddr, const char *nwkSKey, const char *appSKey);
+
     /**
      * @brief Start task that listens on configured UART for AT commands.
      * 
@@ -152,13 +458,43 @@ public:
      * The app EUI, app key and dev EUI must already have been provisioned by a call to 'provision()'.
      * Before this function is called, 'nvs_flash_init' must have been called once.
      * 
-     * The function blocks until the activation has completed or failed.
+     * The function blocks until the activation has completed, failed or the timeout
+     * of the join policy has expired (see 'setJoinPolicy()').
      * 
      * @return true   if the activation was succeful
      * @return false  if the activation failed
      */
     bool join();
 
+    /**
+     * @brief Sets the policy for joining the network.
+     * 
+     * By default, a join has no time limit and starts at the data rate of the last
+     * successful join.
+     * 
+     * @param policy  the join policy
+     */
+    void setJoinPolicy(const TTNJoinPolicy& policy);
+
+    /**
+     * @brief Gets the statistics of the last join.
+     * 
+     * @return the statistics
+     */
+    TTNJoinStats getJoinStats();
+
+    /**
+     * @brief Gets the time to wait before the next join attempt.
+     * 
+     * After a failed join, the device should sleep (preferably in deep sleep) before
+     * trying again. The delay doubles with each failed join, from the policy's minimum
+     * to its maximum delay, and includes a random part to spread the joins of many
+     * devices. It is 0 if the last join was successful.
+     * 
+     * @return delay (in s)
+     */
+    uint32_t getJoinRetryDelay();
+
    /**
      * @brief Set the device EUI, app EUI and app key and activate the device via OTAA.
      * 
@@ -174,6 +510,45 @@ public:
      */
     bool join(const char *devEui, const char *appEui, const char *appKey);
 
+    /**
+     * @brief Activate the device via ABP.
+     * 
+     * The device address and session keys must already have been provisioned by a call
+     * to 'provisionABP()'. Before this function is called, 'nvs_flash_init' must have been
+     * called once.
+     * 
+     * No messages are exchanged with the network. So the function returns immediately and
+     * messages can be transmitted right away.
+     * 
+     * As the network server rejects frame counters it has already seen, the frame counters
+     * of the ABP session are saved like the session of an OTAA device (see 'resumeAfterDeepSleep()')
+     * and continued. They only restart at 0 if the device address or the keys change. In
+     * this case, the frame counters must also be reset in the TTN console.
+     * 
+     * @return true   if the activation was succesful
+     * @return false  if the device address and session keys have not been provisioned
+     */
+    bool personalize();
+
+    /**
+     * @brief Resume the session that was active before the device entered deep sleep.
+     * 
+     * After each join and each transmission, the session (device address, session keys,
+     * frame counters, channel plan, ADR state, RX parameters and duty cycle timers) is
+     * saved in RTC memory. After waking up from deep sleep, this function restores it
+     * so the next message can be transmitted without joining again.
+     * 
+     * The session in RTC memory does not survive a power loss. Therefore, the session is
+     * also saved in non-volatile memory after a join. The uplink frame counter is only
+     * written every few uplinks (see 'make menuconfig'). When the session is restored from
+     * non-volatile memory, the frame counter is advanced accordingly so it never goes
+     * backwards. If no valid session is available, 'join()' must be called.
+     * 
+     * @return true   if the session has been restored
+     * @return false  if no valid session was available
+     */
+    bool resumeAfterDeepSleep();
+
     /**
      * @brief Transmit a message
      * 
@@ -181,6 +556,11 @@ public:
      * in the subsequent receive window (or the window expires). Additionally, the function will
      * first wait until the duty cycle allows a transmission (enforcing the duty cycle limits).
      * 
+     * If a confirmation is requested, the message is retransmitted until it has been
+     * acknowledged or the maximum number of attempts has been reached (see 'setConfirmPolicy()').
+     * The function blocks until then. Only the final result is returned. The details
+     * are available from 'getConfirmStats()'.
+     * 
      * @param payload  bytes to be transmitted
      * @param length   number of bytes to be transmitted
      * @param port     port (default to 1)
@@ -191,6 +571,29 @@ public:
      */
     TTNResponseCode transmitMessage(const uint8_t *payload, size_t length, port_t port = 1, bool confirm = false);
 
+    /**
+     * @brief Sets the policy for transmitting confirmed messages.
+     * 
+     * If no acknowledgement is received, the message is transmitted again with the same
+     * frame counter. The delay before a retransmission doubles with each attempt, from the
+     * policy's minimum to its maximum delay, and includes a random part of up to 25%.
+     * The delay is spent in the task calling 'transmitMessage()'; the duty cycle limits
+     * may delay the retransmission further.
+     * 
+     * By default, a message is transmitted up to 8 times, with delays from 1 s to 16 s
+     * and with the data rate lowered every second retransmission.
+     * 
+     * @param policy  the confirm policy
+     */
+    void setConfirmPolicy(const TTNConfirmPolicy& policy);
+
+    /**
+     * @brief Gets the statistics of the last confirmed message.
+     * 
+     * @return the statistics
+     */
+    TTNConfirmStats getConfirmStats();
+
     /**
      * @brief Set the function to be called when a message is received
      * 
@@ -199,14 +602,227 @@ public:
      * parameters. The values are only valid during the duration of the
      * callback. So they must be immediately processed or copied.
      * 
-     * Messages are received as a result of 'transmitMessage' or 'poll'. The callback is called
-     * in the task that called any of these functions and it occurs before these functions
-     * return control to the caller.
+     * Received messages are copied into a fixed pool of buffers (see 'make menuconfig')
+     * and delivered by a separate task. The callback is therefore called in that task,
+     * independently of the task calling 'transmitMessage'. If the callback is slower
+     * than messages arrive and all buffers are in use, further messages are dropped
+     * (see 'getDownlinkStats()').
      * 
      * @param callback  the callback function
      */
     void onMessage(TTNMessageCallback callback);
 
+    /**
+     * @brief Gets the statistics of received messages.
+     * 
+     * @return the statistics
+     */
+    TTNDownlinkStats getDownlinkStats();
+
+    /**
+     * @brief Gets the statistics of the event channel from the LMIC task.
+     * 
+     * The LMIC task never waits for the application. If the application does
+     * not consume the events in time, they are dropped and counted as overflows.
+     * 
+     * @return the statistics
+     */
+    TTNEventStats getEventStats();
+
+    /**
+     * @brief Gets the synchronization statistics between the application and the LMIC task.
+     * 
+     * Requests changing the LMIC state (join, transmit, reset etc.) are executed
+     * as commands in the LMIC task. The application task waits for the command
+     * to complete but never for the radio. The LMIC lock is only used for
+     * reading statistics and by the LMIC task itself. The statistics show
+     * how long the commands and the lock have kept the calling tasks waiting.
+     * 
+     * @return the statistics
+     */
+    TTNSyncStats getSyncStats();
+
+    /**
+     * @brief Outputs the recorded LMIC events.
+     * 
+     * Requires the binary trace to be selected as event logging (see 'make menuconfig').
+     * The trace is kept in RTC memory. So it is still available after deep sleep or
+     * after a crash or watchdog reset, as long as the firmware is not changed.
+     * 
+     * The trace is output as hexadecimal data on the console (UART). Save the output
+     * and decode it with 'tools/decode_trace.py'.
+     */
+    void dumpEventTrace();
+
+    /**
+     * @brief Sets the categories of LMIC events to log.
+     * 
+     * Only categories enabled in 'make menuconfig' are available. The others have
+     * been removed at compile time and cannot be enabled. By default, all
+     * available categories are logged.
+     * 
+     * @param categories  categories to log (combination of TTNLogCategory values)
+     */
+    void setEventLogFilter(uint8_t categories);
+
+    /**
+     * @brief Sets the sampling rate of a category of LMIC events.
+     * 
+     * Only every n-th event of the category is logged. This reduces the effort
+     * for frequent events such as radio interrupts.
+     * 
+     * @param category  category (a single TTNLogCategory value)
+     * @param rate      sampling rate n (1 to log all events)
+     */
+    void setEventLogSampling(TTNLogCategory category, uint8_t rate);
+
+    /**
+     * @brief Gets the timing statistics of the radio.
+     * 
+     * Requires the radio timing statistics to be enabled (see 'make menuconfig').
+     * The statistics show how precisely the RX windows are opened and how much
+     * margin is left for clock errors. They help to tune the task priorities
+     * and the clock error setting.
+     * 
+     * @return the statistics
+     */
+    TTNRadioTimingStats getRadioTimingStats();
+
+    /**
+     * @brief Resets the timing statistics of the radio.
+     */
+    void resetRadioTimingStats();
+
+    /**
+     * @brief Outputs the timing statistics of the radio on the console (UART).
+     */
+    void dumpRadioTimingStats();
+
+    /**
+     * @brief Gets the statistics of the SPI communication with the radio.
+     * 
+     * @return the statistics
+     */
+    TTNRadioSpiStats getRadioSpiStats();
+
+    /**
+     * @brief Gets the statistics of the LMIC job scheduler.
+     * 
+     * @return the statistics
+     */
+    TTNSchedulerStats getSchedulerStats();
+
+    /**
+     * @brief Resets the statistics of the LMIC job scheduler.
+     */
+    void resetSchedulerStats();
+
+    /**
+     * @brief Outputs the statistics and the queued jobs of the LMIC job scheduler on the console (UART).
+     */
+    void dumpSchedulerStats();
+
+    /**
+     * @brief Gets the light sleep statistics of the LMIC task.
+     * 
+     * Requires light sleep to be enabled (see 'make menuconfig').
+     * 
+     * @return the statistics
+     */
+    TTNLightSleepStats getLightSleepStats();
+
+    /**
+     * @brief Sets the current temperature of the device for the clock error calibration.
+     * 
+     * Requires the clock error calibration to be enabled (see 'make menuconfig').
+     * The clock drift is estimated separately per temperature band of 10 °C.
+     * Call this function regularly, e.g. before transmitting a message.
+     * 
+     * @param temperature  temperature of the device (in °C)
+     */
+    void setTemperature(int8_t temperature);
+
+    /**
+     * @brief Gets the state of the clock error calibration for the current temperature.
+     * 
+     * @return the calibration state
+     */
+    TTNClockCalibrationStats getClockCalibrationStats();
+
+    /**
+     * @brief Requests the network time with the next uplink message.
+     * 
+     * The request is sent with the next message transmitted by 'transmitMessage()'.
+     * When the network answers, the ESP32 system clock (as used by 'gettimeofday()'
+     * and 'time()') is set to the network time in UTC. The network time refers to
+     * the end of the uplink transmission and is accurate to a few milliseconds.
+     * 
+     * As the system clock continues during deep sleep, the time only needs to be
+     * requested occasionally to compensate for the drift of the RTC clock.
+     */
+    void requestNetworkTime();
+
+    /**
+     * @brief Checks if the system clock has been set to the network time.
+     * 
+     * @return true   if the system clock has been set since the last power loss
+     * @return false  otherwise
+     */
+    bool isTimeSynchronized();
+
+    /**
+     * @brief Switches the device to Class B.
+     * 
+     * The device starts scanning for a beacon (which can take up to 128 s) and
+     * then tracks the beacons. Once synchronized, it opens a receive window (ping slot)
+     * every 2^periodicity seconds, i.e. every 1 s to 128 s. Messages received in a ping
+     * slot are passed to the message callback like all other messages. The ping slot
+     * setup is sent to the network with the next uplink message.
+     * 
+     * The device must have joined. Class B must be enabled using 'make menuconfig'.
+     * After deep sleep, Class B must be started again.
+     * 
+     * @param periodicity  ping slot periodicity (0 to 7)
+     * @return true   if Class B has been started
+     * @return false  if Class B is not enabled, the device has not joined or is busy
+     */
+    bool startClassB(uint8_t periodicity);
+
+    /**
+     * @brief Switches the device back to Class A.
+     */
+    void stopClassB();
+
+    /**
+     * @brief Gets the statistics of Class B operation.
+     * 
+     * @return the statistics
+     */
+    TTNClassBStats getClassBStats();
+
+    /**
+     * @brief Enables or disables Class C.
+     * 
+     * In Class C, the receiver is kept open on the RX2 frequency and data rate whenever
+     * the device is not transmitting or receiving in the Class A receive windows. So
+     * the network can send messages at any time instead of waiting for the next uplink
+     * message. This requires much more power and is meant for devices with external power.
+     * 
+     * The setting is kept when the device joins or is reset. It cannot be combined
+     * with Class B.
+     * 
+     * @param enabled  true to enable Class C, false to return to Class A
+     */
+    void setClassC(bool enabled);
+
+    /**
+     * @brief Checks if Class C is enabled.
+     * 
+     * @return true   if Class C is enabled
+     * @return false  otherwise
+     */
+    bool isClassC();
+
     /**
      * @brief Checks if device EUI, app EUI and app key have been stored in non-volatile storage
      * or have been provided as by a call to 'join(const char*, const char*, const char*)'.
@@ -227,10 +843,22 @@ public:
      */
     void setRSSICal(int8_t rssiCal);
 
+    /**
+     * @brief Gets the number of values written to non-volatile memory since startup.
+     * 
+     * Useful for monitoring the flash wear caused by saving keys, the session and
+     * the frame counter.
+     * 
+     * @return number of NVS writes
+     */
+    uint32_t nvsWriteCount();
+
 private:
     TTNMessageCallback messageCallback;
 
     bool joinCore();
+    bool retransmitMessage(uint8_t attempt);
+    static void downlinkTask(void* param);
 };
 
 #endif
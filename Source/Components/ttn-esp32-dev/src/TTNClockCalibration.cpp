@@ -0,0 +1,129 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Calibration of the clock error used for the RX windows.
+ *******************************************************************************/
+
+#include "lmic/lmic.h"
+
+#if LMIC_ENABLE_clock_calibration
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "TTNClockCalibration.h"
+
+
+// Number of measurements before a band is considered calibrated
+#define MIN_MEASUREMENTS 4
+// Weight of a new measurement: 1 / 2^EWMA_SHIFT
+#define EWMA_SHIFT 3
+// Safety factor applied to the mean absolute deviation
+#define DEVIATION_FACTOR 4
+// Resolution of the two timestamps (16 µs ticks) relative to the shortest RX delay (1 s), in ppb
+#define TIMESTAMP_RESOLUTION 32000
+
+static const char* const TAG = "ttn_clock";
+
+static TTNClockCalibration clockCalibration;
+RTC_DATA_ATTR static TTNClockBand rtcBands[TTN_CLOCK_BAND_COUNT];
+static int8_t currentTemperature = 20;
+
+
+// Create singleton instance and set the initial clock error
+TTNClockCalibration* TTNClockCalibration::initInstance()
+{
+    clockCalibration.update();
+    return &clockCalibration;
+}
+
+// Set the temperature of the oscillator (in °C) and select the clock error of its band.
+// Must be called while holding the LMIC lock.
+void TTNClockCalibration::setTemperature(int8_t temperature)
+{
+    currentTemperature = temperature;
+    update();
+}
+
+// Add the measured offset of a downlink (in µs) received 'delay' µs after the uplink.
+// Called in the LMIC task.
+void TTNClockCalibration::addMeasurement(int32_t offset, int32_t delay)
+{
+    if (delay <= 0)
+        return;
+
+    int32_t drift = (int32_t)((int64_t)offset * 1000000000 / delay);
+    TTNClockBand& band = rtcBands[bandIndex(currentTemperature)];
+    if (band.count == 0)
+    {
+        band.drift = drift;
+        band.deviation = 0;
+    }
+    else
+    {
+        band.drift += (drift - band.drift) >> EWMA_SHIFT;
+        int32_t deviation = drift - band.drift;
+        if (deviation < 0)
+            deviation = -deviation;
+        band.deviation += (deviation - band.deviation) >> EWMA_SHIFT;
+    }
+    if (band.count < UINT16_MAX)
+        band.count++;
+
+    ESP_LOGD(TAG, "offset %d us after %d us: drift %d ppb (%d °C)", offset, delay, drift, currentTemperature);
+    update();
+}
+
+TTNClockCalibrationStats TTNClockCalibration::getStats()
+{
+    const TTNClockBand& band = rtcBands[bandIndex(currentTemperature)];
+    TTNClockCalibrationStats stats;
+    stats.temperature = currentTemperature;
+    stats.measurements = band.count;
+    stats.drift = band.drift / 1000;
+    stats.clockError = (uint32_t)LMIC.client.clockError * 1000000 / MAX_CLOCK_ERROR;
+    return stats;
+}
+
+void TTNClockCalibration::update()
+{
+    const TTNClockBand& band = rtcBands[bandIndex(currentTemperature)];
+    uint32_t ppb = band.count >= MIN_MEASUREMENTS ? clockError(band) : CONFIG_TTN_CLOCK_ERROR * 1000u;
+
+    // Round up to the LMIC unit (MAX_CLOCK_ERROR corresponds to 100%)
+    uint64_t error = ((uint64_t)ppb * MAX_CLOCK_ERROR + 999999999) / 1000000000;
+    if (error > MAX_CLOCK_ERROR - 1)
+        error = MAX_CLOCK_ERROR - 1;
+    LMIC_setClockError((u2_t)error);
+}
+
+int TTNClockCalibration::bandIndex(int8_t temperature)
+{
+    int index = (temperature - TTN_CLOCK_BAND_MIN_TEMP) / TTN_CLOCK_BAND_WIDTH;
+    if (index < 0)
+        return 0;
+    if (index >= TTN_CLOCK_BAND_COUNT)
+        return TTN_CLOCK_BAND_COUNT - 1;
+    return index;
+}
+
+// Smallest clock error (in ppb) covering the drift of the band
+uint32_t TTNClockCalibration::clockError(const TTNClockBand& band)
+{
+    int32_t drift = band.drift < 0 ? -band.drift : band.drift;
+    return (uint32_t)drift + DEVIATION_FACTOR * (uint32_t)band.deviation + TIMESTAMP_RESOLUTION;
+}
+
+
+// Called by LMIC when a valid Class A downlink has been received
+void hal_rxOffsetMeasured(ostime_t offset, ostime_t delay)
+{
+    clockCalibration.addMeasurement(osticks2us(offset), osticks2us(delay));
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Calibration of the clock error used for the RX windows.
+ *******************************************************************************/
+
+#ifndef _ttnclockcalibration_h_
+#define _ttnclockcalibration_h_
+
+#include <stdint.h>
+#include "lmic/lmic.h"
+
+#if LMIC_ENABLE_clock_calibration
+
+#include "TheThingsNetwork.h"
+
+
+// Temperature bands: 10 °C each, starting at -40 °C (lower and higher
+// temperatures are assigned to the first and last band)
+#define TTN_CLOCK_BAND_COUNT 13
+#define TTN_CLOCK_BAND_MIN_TEMP -40
+#define TTN_CLOCK_BAND_WIDTH 10
+
+
+/**
+ * @brief Running drift estimate for a temperature band.
+ *
+ * Drift values are in ppb (parts per billion) to avoid floating point
+ * arithmetic in the LMIC task.
+ */
+struct TTNClockBand
+{
+    uint16_t    count;
+    int32_t     drift;      // mean drift (exponentially weighted)
+    int32_t     deviation;  // mean absolute deviation (exponentially weighted)
+};
+
+
+/**
+ * @brief Calibrates the clock error from the timing of received downlinks.
+ *
+ * The network sends a Class A downlink exactly at the end of the uplink plus
+ * the RX delay. The measured offset of the received frame from this nominal
+ * start, divided by the delay, is the drift of the local clock (plus the
+ * constant timestamp errors, which makes the estimate conservative).
+ *
+ * As the drift of the crystal or RC oscillator depends on the temperature,
+ * an estimate is kept per temperature band. Once a band has enough
+ * measurements, the LMIC clock error is set to the smallest value covering
+ * the drift and its variation. Otherwise, the configured default is used.
+ *
+ * The estimates are kept in RTC memory and survive deep sleep.
+ *
+ * This class is not to be used directly.
+ */
+class TTNClockCalibration
+{
+public:
+    static TTNClockCalibration* initInstance();
+
+    void setTemperature(int8_t temperature);
+    void addMeasurement(int32_t offset, int32_t delay);
+    TTNClockCalibrationStats getStats();
+
+private:
+    void update();
+
+    static int bandIndex(int8_t temperature);
+    static uint32_t clockError(const TTNClockBand& band);
+};
+
+#endif
+
+#endif
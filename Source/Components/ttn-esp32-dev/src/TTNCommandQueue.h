@@ -0,0 +1,130 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Lock-free command channel from the application tasks to the LMIC task.
+ *******************************************************************************/
+
+#ifndef _ttncommandqueue_h_
+#define _ttncommandqueue_h_
+
+#include <stdint.h>
+#include <atomic>
+
+
+/**
+ * @brief Lock-free multi-producer / single-consumer queue.
+ *
+ * Each slot carries a sequence number telling whether it is free for the
+ * producer with the matching position or filled for the consumer. Producers
+ * claim a position with a compare-and-swap and never block: if the queue
+ * is full, 'post()' fails and the producer decides whether to retry.
+ *
+ * Any number of tasks may call 'post()'. Only one task may call
+ * 'tryReceive()' at the same time.
+ *
+ * @tparam T     item type (copied by value)
+ * @tparam SIZE  capacity, must be a power of 2
+ */
+template <typename T, uint32_t SIZE>
+class TTNCommandQueue
+{
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+public:
+    TTNCommandQueue()
+        : enqueuePos(0), dequeuePos(0), overflowCount(0)
+    {
+        for (uint32_t i = 0; i < SIZE; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Add an item (producer side). Never blocks.
+     *
+     * @return true if the item has been added, false if the queue was full
+     */
+    bool post(const T& item)
+    {
+        uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot& slot = slots[pos & (SIZE - 1)];
+            int32_t diff = (int32_t)(slot.sequence.load(std::memory_order_acquire) - pos);
+            if (diff == 0)
+            {
+                // slot is free: claim the position
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.item = item;
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+                // 'pos' has been updated by the failed compare-and-swap
+            }
+            else if (diff < 0)
+            {
+                // slot still holds the item of the previous round
+                overflowCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else
+            {
+                // another producer has claimed the position
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Remove the oldest item without waiting (consumer side).
+     *
+     * @return true if an item has been removed, false if the queue was empty
+     */
+    bool tryReceive(T* item)
+    {
+        Slot& slot = slots[dequeuePos & (SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+            return false;
+
+        *item = slot.item;
+        slot.sequence.store(dequeuePos + SIZE, std::memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+
+    /**
+     * @brief Check if the queue is empty (consumer side).
+     */
+    bool isEmpty() const
+    {
+        return slots[dequeuePos & (SIZE - 1)].sequence.load(std::memory_order_acquire) != dequeuePos + 1;
+    }
+
+    /**
+     * @brief Number of failed 'post()' calls because the queue was full.
+     */
+    uint32_t overflows() const
+    {
+        return overflowCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence;
+        T item;
+    };
+
+    Slot slots[SIZE];
+    std::atomic<uint32_t> enqueuePos;
+    uint32_t dequeuePos;
+    std::atomic<uint32_t> overflowCount;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Lock-free event channel from the LMIC task to the application.
+ *******************************************************************************/
+
+#ifndef _ttneventring_h_
+#define _ttneventring_h_
+
+#include <stdint.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+
+/**
+ * @brief Lock-free single-producer / single-consumer ring buffer.
+ *
+ * The producer (LMIC task) never blocks: if the ring is full, the event
+ * is dropped and counted as overflow. The consumer is woken up via a
+ * task notification, so a slow consumer cannot delay the time critical
+ * LMIC task.
+ *
+ * Only one task may call 'post()' and only one task may call 'receive()'
+ * or 'drain()' at the same time.
+ *
+ * @tparam T     event type (copied by value)
+ * @tparam SIZE  capacity, must be a power of 2
+ */
+template <typename T, uint32_t SIZE>
+class TTNEventRing
+{
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+public:
+    TTNEventRing()
+        : head(0), tail(0), consumer(nullptr), overflowCount(0), maxFill(0)
+    {
+    }
+
+    /**
+     * @brief Add an event (producer side). Never blocks.
+     *
+     * @return true if the event has been added, false if the ring was full
+     */
+    bool post(const T& event)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t fill = h - tail.load(std::memory_order_acquire);
+        if (fill >= SIZE)
+        {
+            overflowCount++;
+            return false;
+        }
+
+        buffer[h & (SIZE - 1)] = event;
+        // sequentially consistent, paired with the registration in 'receive()'
+        head.store(h + 1);
+
+        if (fill + 1 > maxFill)
+            maxFill = fill + 1;
+
+        TaskHandle_t task = consumer.load();
+        if (task != nullptr)
+            xTaskNotifyGive(task);
+        return true;
+    }
+
+    /**
+     * @brief Remove the oldest event without waiting (consumer side).
+     *
+     * @return true if an event has been removed, false if the ring was empty
+     */
+    bool tryReceive(T* event)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (head.load() == t)
+            return false;
+
+        *event = buffer[t & (SIZE - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Remove the oldest event, waiting until one is available (consumer side).
+     *
+     * The calling task registers itself to be notified by the producer
+     * while it is waiting.
+     *
+     * @param timeout  maximum time to wait (in ticks)
+     * @return true if an event has been removed, false if the timeout expired
+     */
+    bool receive(T* event, TickType_t timeout = portMAX_DELAY)
+    {
+        TimeOut_t timeOut;
+        vTaskSetTimeOutState(&timeOut);
+
+        consumer.store(xTaskGetCurrentTaskHandle());
+        bool received;
+        while (!(received = tryReceive(event)))
+        {
+            if (timeout != portMAX_DELAY && xTaskCheckForTimeOut(&timeOut, &timeout))
+                break;
+            ulTaskNotifyTake(pdTRUE, timeout);
+        }
+        consumer.store(nullptr);
+        return received;
+    }
+
+    /**
+     * @brief Discard all pending events (consumer side).
+     */
+    void drain()
+    {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /**
+     * @brief Number of events dropped because the ring was full.
+     */
+    uint32_t overflows() const
+    {
+        return overflowCount;
+    }
+
+    /**
+     * @brief Maximum number of events pending at the same time.
+     */
+    uint32_t maxUsage() const
+    {
+        return maxFill;
+    }
+
+private:
+    T buffer[SIZE];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<TaskHandle_t> consumer;
+    volatile uint32_t overflowCount;
+    volatile uint32_t maxFill;
+};
+
+#endif
@@ -10,21 +10,250 @@
  * Circular buffer for detailed logging without affecting LMIC timing.
  *******************************************************************************/
 
+#include "lmic/lmic.h"
 
 #if LMIC_ENABLE_event_logging
 
+#include <stdio.h>
 #include <string.h>
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include "lmic/lmic.h"
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include "hal/hal_esp32.h"
 #include "TTNLogging.h"
 
 
-#define NUM_RINGBUF_MSG 50
 static const char* const TAG = "lmic";
 static TTNLogging ttnLog;
 
+
+// Create singleton instance
+TTNLogging* TTNLogging::initInstance()
+{
+#if defined(CONFIG_TTN_EVENT_LOG_RADIO_SAMPLING)
+    ttnLog.setSampling(LMIC_LOG_RADIO, CONFIG_TTN_EVENT_LOG_RADIO_SAMPLING);
+#endif
+    ttnLog.init();
+    return &ttnLog;
+}
+
+
+#if defined(CONFIG_TTN_EVENT_LOGGING_TRACE)
+
+// ---------------------------------------------------------------------------
+// Binary trace in RTC memory
+
+// Version of the trace format (increment if the record or the dump changes)
+#define TRACE_VERSION 1
+#define TRACE_MAGIC (0x54524300 + TRACE_VERSION)
+// Number of distinct messages (message ID 63 is used if the table is full)
+#define TRACE_MAX_MESSAGES 63
+#define TRACE_UNKNOWN_MESSAGE 63
+
+// Record types (upper 2 bits of 'type', the lower 6 bits are the event or message ID)
+#define TRACE_TYPE_EVENT 0x00       // LMIC event (ID 0: start of trace after reset or wake-up)
+#define TRACE_TYPE_MESSAGE 0x40     // message without value
+#define TRACE_TYPE_DATUM 0x80       // message with value
+#define TRACE_TYPE_FATAL 0xc0       // failed assertion (message is the file name)
+
+/**
+ * @brief Trace record (16 bytes)
+ * 
+ * Instead of the absolute time, the time since the previous record is stored.
+ * Up to 32767 ticks (about 0.5 s), it is stored exactly. Longer times are
+ * stored in units of 1024 ticks (bit 15 set) and limited to about 9 minutes.
+ */
+struct TTNTraceRecord {
+    uint8_t     type;           // record type and event or message ID
+    uint8_t     rps;            // lower byte of rps: SF, BW, CR and CRC (IH is omitted)
+    uint16_t    delta;          // encoded time since previous record
+    uint16_t    opmode;
+    uint8_t     txrxFlags;
+    uint8_t     saveIrqFlags;
+    uint8_t     txChnl;
+    uint8_t     rxsyms;
+    uint16_t    freq;           // in units of 25 kHz
+    uint32_t    datum;          // message value, LMIC.txend for events, time for ID 0
+};
+
+static_assert(sizeof(TTNTraceRecord) == 16, "trace record must have 16 bytes");
+
+/**
+ * @brief Trace kept in RTC memory
+ * 
+ * Messages are stored as pointers to the string constants. They remain
+ * valid across resets as long as the firmware does not change.
+ */
+struct TTNTrace {
+    uint32_t        magic;
+    uint8_t         firmware[8];    // start of the ELF SHA-256 of the firmware
+    uint32_t        count;          // number of records written since the trace was cleared
+    ostime_t        lastTime;       // time of the last record (as encoded in the deltas)
+    const char*     messages[TRACE_MAX_MESSAGES];
+    TTNTraceRecord  records[CONFIG_TTN_TRACE_RECORDS];
+};
+
+RTC_NOINIT_ATTR static TTNTrace trace;
+static bool traceReady = false;
+
+static uint8_t messageId(const char* message);
+static uint16_t encodeDelta(ostime_t now);
+static void addRecord(uint8_t type, uint32_t datum);
+
+
+// Initialize the trace
+// The existing trace is continued unless it is invalid or belongs to a different firmware.
+void TTNLogging::init()
+{
+    const esp_app_desc_t* app = esp_ota_get_app_description();
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    if (trace.magic != TRACE_MAGIC || reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT
+        || memcmp(trace.firmware, app->app_elf_sha256, sizeof(trace.firmware)) != 0)
+    {
+        memset(&trace, 0, sizeof(trace));
+        memcpy(trace.firmware, app->app_elf_sha256, sizeof(trace.firmware));
+        trace.magic = TRACE_MAGIC;
+    }
+
+    // As the LMIC time restarts, a start record with the absolute time is added
+    trace.lastTime = os_getTime();
+    addRecord(TRACE_TYPE_EVENT, trace.lastTime);
+
+    traceReady = true;
+    hal_set_failure_handler(logFatal);
+}
+
+// Record a logging event
+void TTNLogging::logEvent(int event, const char* message, uint32_t datum)
+{
+    if (!traceReady)
+        return;
+
+    switch (event)
+    {
+        case -1:
+            addRecord(TRACE_TYPE_MESSAGE | messageId(message), 0);
+            break;
+
+        case -2:
+            addRecord(TRACE_TYPE_DATUM | messageId(message), datum);
+            break;
+
+        case -3:
+            addRecord(TRACE_TYPE_FATAL | messageId(message), datum);
+            break;
+
+        default:
+            addRecord(TRACE_TYPE_EVENT | (event & 0x3f), LMIC.txend);
+            break;
+    }
+}
+
+// Output the trace as hex data
+// The trace is copied first so LMIC is not blocked while the data is output.
+void TTNLogging::dumpTrace()
+{
+    TTNTrace* copy = (TTNTrace*)malloc(sizeof(TTNTrace));
+    if (copy == nullptr)
+    {
+        ESP_LOGE(TAG, "Out of memory");
+        return;
+    }
+
+    ttn_hal.enterCriticalSection();
+    memcpy(copy, &trace, sizeof(TTNTrace));
+    ttn_hal.leaveCriticalSection();
+
+    uint32_t numRecords = copy->count < CONFIG_TTN_TRACE_RECORDS ? copy->count : CONFIG_TTN_TRACE_RECORDS;
+    printf("TTN-TRACE BEGIN %d %d %d %u %u\n", TRACE_VERSION, (int)sizeof(TTNTraceRecord),
+        OSTICKS_PER_SEC, numRecords, copy->count);
+
+    for (int i = 0; i < TRACE_MAX_MESSAGES; i++)
+    {
+        if (copy->messages[i] != nullptr)
+            printf("TTN-TRACE MSG %d %s\n", i, copy->messages[i]);
+    }
+
+    for (uint32_t n = copy->count - numRecords; n != copy->count; n++)
+    {
+        const uint8_t* record = (const uint8_t*)&copy->records[n % CONFIG_TTN_TRACE_RECORDS];
+        char hex[2 * sizeof(TTNTraceRecord) + 1];
+        for (unsigned i = 0; i < sizeof(TTNTraceRecord); i++)
+            sprintf(hex + 2 * i, "%02x", record[i]);
+        printf("TTN-TRACE REC %s\n", hex);
+    }
+
+    printf("TTN-TRACE END\n");
+    free(copy);
+}
+
+// Add a record with the current LMIC state
+// Only called from the LMIC task.
+void addRecord(uint8_t type, uint32_t datum)
+{
+    TTNTraceRecord* record = &trace.records[trace.count % CONFIG_TTN_TRACE_RECORDS];
+    record->type = type;
+    record->rps = (uint8_t)LMIC.rps;
+    record->delta = encodeDelta(os_getTime());
+    record->opmode = LMIC.opmode;
+    record->txrxFlags = LMIC.txrxFlags;
+    record->saveIrqFlags = LMIC.saveIrqFlags;
+    record->txChnl = LMIC.txChnl;
+    record->rxsyms = LMIC.rxsyms;
+    record->freq = (uint16_t)(LMIC.freq / 25000);
+    record->datum = datum;
+    trace.count++;
+}
+
+// Encode the time since the previous record and advance the trace time accordingly
+uint16_t encodeDelta(ostime_t now)
+{
+    uint32_t delta = (uint32_t)(now - trace.lastTime);
+    if (delta < 0x8000)
+    {
+        trace.lastTime = now;
+        return (uint16_t)delta;
+    }
+
+    uint32_t units = delta >> 10;
+    if (units > 0x7fff)
+        units = 0x7fff;
+    trace.lastTime += units << 10;
+    return (uint16_t)(0x8000 | units);
+}
+
+// Get the ID of a message (string constant), adding it to the message table if needed
+uint8_t messageId(const char* message)
+{
+    uint32_t index = ((uintptr_t)message >> 2) % TRACE_MAX_MESSAGES;
+    for (int i = 0; i < TRACE_MAX_MESSAGES; i++)
+    {
+        if (trace.messages[index] == message)
+            return index;
+
+        if (trace.messages[index] == nullptr)
+        {
+            trace.messages[index] = message;
+            return index;
+        }
+
+        index = (index + 1) % TRACE_MAX_MESSAGES;
+    }
+
+    return TRACE_UNKNOWN_MESSAGE;
+}
+
+
+#else
+
+// ---------------------------------------------------------------------------
+// Immediate output via a ring buffer and a logging task
+
+#define NUM_RINGBUF_MSG 50
+
 /**
  * @brief Message structure used in ring buffer
  * 
@@ -66,14 +295,6 @@ static void printEvtRxStart(TTNLogMessage* log);
 static void printEvtJoinTxComplete(TTNLogMessage* log);
 static void bin2hex(const uint8_t* bin, unsigned len, char* buf, char sep = 0);
 
-
-// Create singleton instance
-TTNLogging* TTNLogging::initInstance()
-{
-    ttnLog.init();
-    return &ttnLog;
-}
-
 // Initialize logging
 void TTNLogging::init()
 {
@@ -116,28 +337,64 @@ void TTNLogging::logEvent(int event, const char* message, uint32_t datum)
     xRingbufferSend(ringBuffer, &log, sizeof(log), 0);
 }
 
+// The binary trace is not available with immediate output
+void TTNLogging::dumpTrace()
+{
+    ESP_LOGW(TAG, "No event trace available. Select the binary trace using 'make menuconfig'");
+}
+
+#endif
+
 // record a fatal event (failed assert) for later output
 void TTNLogging::logFatal(const char* file, uint16_t line)
 {
     ttnLog.logEvent(-3, file, line);
 }
 
+// Set the sampling rate of a category: only every n-th event is logged
+void TTNLogging::setSampling(uint8_t category, uint8_t rate)
+{
+    int index = __builtin_ctz(category);
+    sampleRate[index] = rate;
+    sampleCount[index] = 0;
+}
+
+// Check if an event of the given category is to be logged according to the sampling rate
+bool TTNLogging::sample(uint8_t category)
+{
+    int index = __builtin_ctz(category);
+    if (sampleRate[index] <= 1)
+        return true;
+
+    if (++sampleCount[index] < sampleRate[index])
+        return false;
+
+    sampleCount[index] = 0;
+    return true;
+}
+
+// Categories enabled at runtime (categories not compiled in are always off)
+u1_t LMICOS_logMask = LMIC_LOG_ALL;
+
 // Record an informational message for later output
 // The message must not be freed.
-extern "C" void LMICOS_logEvent(const char *pMessage)
+extern "C" void LMICOS_logEventIn(u1_t category, const char *pMessage)
 {
-    ttnLog.logEvent(-1, pMessage, 0);
-
+    if (ttnLog.sample(category))
+        ttnLog.logEvent(-1, pMessage, 0);
 }
 
 // Record an information message with an integer value for later output
 // The message must not be freed.
-extern "C" void LMICOS_logEventUint32(const char *pMessage, uint32_t datum)
+extern "C" void LMICOS_logEventUint32In(u1_t category, const char *pMessage, uint32_t datum)
 {
-    ttnLog.logEvent(-2, pMessage, datum);
+    if (ttnLog.sample(category))
+        ttnLog.logEvent(-2, pMessage, datum);
 }
 
 
+#if !defined(CONFIG_TTN_EVENT_LOGGING_TRACE)
+
 // ---------------------------------------------------------------------------
 // Log output
 
@@ -386,5 +643,7 @@ void bin2hex(const uint8_t* bin, unsigned len, char* buf, char sep)
     buf[tgt] = 0;
 }
 
+#endif
+
 
 #endif
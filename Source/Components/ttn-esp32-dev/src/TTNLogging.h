@@ -13,6 +13,8 @@
 #ifndef _ttnlogging_h_
 #define _ttnlogging_h_
 
+#include "lmic/lmic.h"
+
 
 #if LMIC_ENABLE_event_logging
 
@@ -26,13 +28,25 @@
  * Logs internal information from LMIC in an asynchrnous fashion in order
  * not to distrub the sensitive LORA timing.
  * 
- * A ring buffer and a separate logging task is ued. The LMIC core records
- * relevant values from the current LORA settings and writes them to a ring
- * buffer. The logging tasks receives the message and the values, formats
- * them and outputs them via the regular ESP-IDF logging mechanism.
+ * With immediate output, a ring buffer and a separate logging task is used.
+ * The LMIC core records relevant values from the current LORA settings and
+ * writes them to a ring buffer. The logging tasks receives the message and
+ * the values, formats them and outputs them via the regular ESP-IDF logging
+ * mechanism.
+ * 
+ * With the binary trace, the values are recorded in a compact binary format
+ * in RTC memory, where they survive deep sleep and software resets. Nothing
+ * is formatted on the device. 'dumpTrace()' outputs the records as hex data
+ * for the decoder in the 'tools' directory.
+ * 
+ * In order to activate the detailed logging, select the event logging
+ * using 'make menuconfig' (or set the macro `LMIC_ENABLE_event_logging`
+ * to 1 for immediate output).
  * 
- * In order to activate the detailed logging, set the macro
- * `LMIC_ENABLE_event_logging` to 1.
+ * The LMIC log events are grouped in categories. Categories can be excluded
+ * at compile time (see 'make menuconfig') and switched on and off at runtime
+ * (LMICOS_logMask). For frequent events, the sampling rate can be set so
+ * only every n-th event of a category is logged.
  * 
  * This class is not to be used directly.
  */
@@ -42,12 +56,23 @@ public:
 
     void init();
     void logEvent(int event, const char* message, uint32_t datum);
+    void dumpTrace();
+
+    void setSampling(uint8_t category, uint8_t rate);
+    bool sample(uint8_t category);
 
 private:
-    static void loggingTask(void* param);
     static void logFatal(const char* file, uint16_t line);
 
+    // Sampling per log category (see LMIC_LOG_xxx)
+    uint8_t sampleRate[6];
+    uint8_t sampleCount[6];
+
+#if !defined(CONFIG_TTN_EVENT_LOGGING_TRACE)
+    static void loggingTask(void* param);
+
     RingbufHandle_t ringBuffer;
+#endif
 };
 
 #endif
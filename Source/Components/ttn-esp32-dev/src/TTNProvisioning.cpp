@@ -16,13 +16,44 @@
 #include "esp_log.h"
 #include "esp_system.h"
 #include "nvs_flash.h"
+#include "mbedtls/sha256.h"
 #include "TTNProvisioning.h"
 #include "lmic/lmic.h"
-#include "hal/hal_esp32.h"
 
 #if defined(TTN_HAS_AT_COMMANDS)
+#include "hal/hal_esp32.h"
+
 const uart_port_t UART_NUM = (uart_port_t) CONFIG_TTN_PROVISION_UART_NUM;
 const int MAX_LINE_LENGTH = 128;
+
+// Binary frame: sync, command, sequence number, payload length (16 bit, little endian),
+// payload, CRC-16/CCITT of command to payload (little endian)
+const uint8_t FRAME_SYNC = 0xa5;
+const int FRAME_HEADER_LENGTH = 5;
+const int FRAME_CRC_LENGTH = 2;
+const int MAX_FRAME_PAYLOAD = 512;
+const int MAX_FRAME_LENGTH = FRAME_HEADER_LENGTH + MAX_FRAME_PAYLOAD + FRAME_CRC_LENGTH;
+// Time without data after which a partial frame is discarded (in ms)
+const int FRAME_IDLE_TIMEOUT = 200;
+const int MAX_CONFIG_ENTRIES = 16;
+
+// Commands (responses have bit 7 set)
+const uint8_t FRAME_CMD_PING = 0x01;
+const uint8_t FRAME_CMD_INFO = 0x02;
+const uint8_t FRAME_CMD_PROVISION = 0x10;
+const uint8_t FRAME_CMD_HASH = 0x11;
+const uint8_t FRAME_CMD_EXIT = 0x7f;
+const uint8_t FRAME_RESPONSE = 0x80;
+
+// Status (first byte of response payload)
+const uint8_t FRAME_STATUS_OK = 0;
+const uint8_t FRAME_STATUS_CRC_ERROR = 1;
+const uint8_t FRAME_STATUS_UNKNOWN_COMMAND = 2;
+const uint8_t FRAME_STATUS_INVALID_DATA = 3;
+const uint8_t FRAME_STATUS_STORAGE_ERROR = 4;
+
+// Flags of the provisioning command
+const uint8_t PROVISION_FLAG_DEV_EUI_FROM_MAC = 0x01;
 #endif
 
 static const char* const TAG = "ttn_prov";
@@ -30,10 +61,29 @@ static const char* const NVS_FLASH_PARTITION = "ttn";
 static const char* const NVS_FLASH_KEY_DEV_EUI = "devEui";
 static const char* const NVS_FLASH_KEY_APP_EUI = "appEui";
 static const char* const NVS_FLASH_KEY_APP_KEY = "appKey";
+static const char* const NVS_FLASH_KEY_DEV_ADDR = "devAddr";
+static const char* const NVS_FLASH_KEY_NWK_SKEY = "nwkSKey";
+static const char* const NVS_FLASH_KEY_APP_SKEY = "appSKey";
+
+#if defined(TTN_HAS_AT_COMMANDS)
+// Keys used by the library itself (including the ones of TTNSession.cpp and
+// TheThingsNetwork.cpp), which must not be overwritten by config entries
+static const char* const RESERVED_KEYS[] = {
+    NVS_FLASH_KEY_DEV_EUI, NVS_FLASH_KEY_APP_EUI, NVS_FLASH_KEY_APP_KEY,
+    NVS_FLASH_KEY_DEV_ADDR, NVS_FLASH_KEY_NWK_SKEY, NVS_FLASH_KEY_APP_SKEY,
+    "session", "fcntLimit", "joinDr"
+};
+#endif
 
 static uint8_t global_dev_eui[8];
 static uint8_t global_app_eui[8];
 static uint8_t global_app_key[16];
+static uint32_t global_dev_addr;
+static uint8_t global_nwk_skey[16];
+static uint8_t global_app_skey[16];
+
+// Number of NVS values written (flash write instrumentation)
+static uint32_t nvs_write_count = 0;
 
 
 #if defined(TTN_HAS_AT_COMMANDS)
@@ -69,9 +119,10 @@ void os_getDevKey (u1_t* buf)
 // --- Constructor
 
 TTNProvisioning::TTNProvisioning()
-    : have_keys(false)
+    : have_keys(false), have_abp_keys(false)
 #if defined(TTN_HAS_AT_COMMANDS)
-        , uart_queue(nullptr), line_buf(nullptr), line_length(0), last_line_end_char(0), quit_task(false)
+        , uart_queue(nullptr), line_buf(nullptr), line_length(0), last_line_end_char(0), quit_task(false),
+        binary_mode(false), frame_buf(nullptr), frame_length(0), resyncing(false)
 #endif
 {
 }
@@ -90,7 +141,7 @@ void TTNProvisioning::startTask()
     esp_err_t err = uart_driver_install(UART_NUM, 2048, 2048, 20, &uart_queue, 0);
     ESP_ERROR_CHECK(err);
 
-    xTaskCreate(ttn_provisioning_task_caller, "ttn_provision", 2048, this, 1, nullptr);
+    xTaskCreate(ttn_provisioning_task_caller, "ttn_provision", 4096, this, 1, nullptr);
 }
 
 void ttn_provisioning_task_caller(void* pvParameter)
@@ -110,13 +161,22 @@ void TTNProvisioning::provisioningTask()
 
     while (!quit_task)
     {
-        if (!xQueueReceive(uart_queue, &event, portMAX_DELAY))
+        // A partial frame is discarded if the rest does not arrive
+        bool partial_frame = binary_mode && frame_length > 0;
+        if (!xQueueReceive(uart_queue, &event, partial_frame ? pdMS_TO_TICKS(FRAME_IDLE_TIMEOUT) : portMAX_DELAY))
+        {
+            if (partial_frame)
+                discardPartialFrame();
             continue;
+        }
 
         switch (event.type)
         {
             case UART_DATA:
-                addLineData(event.size);
+                if (binary_mode)
+                    addFrameData(event.size);
+                else
+                    addLineData(event.size);
                 break;
 
             case UART_FIFO_OVF:
@@ -131,6 +191,7 @@ void TTNProvisioning::provisioningTask()
     }
 
     free(line_buf);
+    free(frame_buf);
     uart_driver_delete(UART_NUM);
     vTaskDelete(nullptr);
 }
@@ -175,6 +236,13 @@ top:
             if (p > 0)
                 processLine();
 
+            if (binary_mode)
+            {
+                // Frames must only be sent after the response to AT+BIN
+                line_length = 0;
+                return;
+            }
+
             memcpy(line_buf, line_buf + p + 1, line_length - p - 1);
             line_length -= p + 1;
             start_at = 0;
@@ -200,6 +268,7 @@ void TTNProvisioning::processLine()
     // AT+PROVM=hex16-hex32
     // AT+MAC?
     // AT+HWEUI?
+    // AT+BIN (switch to binary frames)
 
     if (strcmp(line_buf, "AT+PROV?") == 0)
     {
@@ -276,20 +345,292 @@ void TTNProvisioning::processLine()
     {
         quit_task = true;
     }
+    else if (strcmp(line_buf, "AT+BIN") == 0)
+    {
+        if (frame_buf == nullptr)
+            frame_buf = (uint8_t*)malloc(MAX_FRAME_LENGTH);
+        is_ok = frame_buf != nullptr;
+        binary_mode = is_ok;
+        frame_length = 0;
+        resyncing = false;
+    }
     else if (strcmp(line_buf, "AT") != 0)
     {
         is_ok = false;
     }
 
     if (reset_needed)
-    {
-        ttn_hal.enterCriticalSection();
+        resetLMIC();
+
+    uart_write_bytes(UART_NUM, is_ok ? "OK\r\n" : "ERROR\r\n", is_ok ? 4 : 7);
+}
+
+void TTNProvisioning::resetLMIC()
+{
+    ttn_hal.execute([] {
         LMIC_reset();
-        ttn_hal.leaveCriticalSection();
         LMIC.client.eventCb(LMIC.client.eventUserData, EV_RESET);
+    });
+}
+
+
+// --- Binary provisioning protocol
+
+// The binary protocol is meant for provisioning on production lines. A command
+// frame (see FRAME_xxx) is answered by a response frame with the same sequence
+// number. Several commands can be sent without waiting for the responses
+// (pipelining). They are executed in order. Frames with an invalid CRC are
+// answered with FRAME_STATUS_CRC_ERROR and should be repeated. Until the next
+// valid frame, the parser resynchronizes silently, i.e. a corrupted frame
+// causes a single error response. A frame must be sent without pauses: if no
+// data arrives for FRAME_IDLE_TIMEOUT ms, a partial frame is discarded without
+// a response (e.g. if its length field is corrupted). The client should repeat
+// requests that remain unanswered.
+//
+// The response payload starts with the status byte and can therefore be up to
+// MAX_FRAME_PAYLOAD + 1 bytes long.
+//
+// PING       payload is echoed
+// INFO       response: flags (bit 0: have keys), MAC (6), dev EUI (8), app EUI (8)
+// PROVISION  payload: flags (see PROVISION_FLAG_xxx), dev EUI (8), app EUI (8), app key (16),
+//            followed by config entries: key length (1), key, value length (2, little endian), value
+//            (the keys used by the library itself are rejected, see RESERVED_KEYS)
+//            response: SHA-256 of the values read back (see 'hashKeysAndConfig()')
+// HASH       response: SHA-256 of the stored keys
+// EXIT       switch back to AT commands
+
+void TTNProvisioning::addFrameData(int numBytes)
+{
+    while (numBytes > 0)
+    {
+        int n = numBytes;
+        if (frame_length + n > MAX_FRAME_LENGTH)
+            n = MAX_FRAME_LENGTH - frame_length;
+
+        uart_read_bytes(UART_NUM, frame_buf + frame_length, n, portMAX_DELAY);
+        frame_length += n;
+        numBytes -= n;
+
+        processFrames();
     }
+}
 
-    uart_write_bytes(UART_NUM, is_ok ? "OK\r\n" : "ERROR\r\n", is_ok ? 4 : 7);
+void TTNProvisioning::processFrames()
+{
+    int pos = 0;
+    while (binary_mode)
+    {
+        while (pos < frame_length && frame_buf[pos] != FRAME_SYNC)
+            pos++;
+
+        int available = frame_length - pos;
+        if (available < FRAME_HEADER_LENGTH)
+            break;
+
+        const uint8_t* frame = frame_buf + pos;
+        int payload_length = frame[3] | (frame[4] << 8);
+        if (payload_length > MAX_FRAME_PAYLOAD)
+        {
+            pos++; // not the start of a frame
+            continue;
+        }
+
+        int length = FRAME_HEADER_LENGTH + payload_length + FRAME_CRC_LENGTH;
+        if (available < length)
+            break;
+
+        uint16_t crc = frame[length - 2] | (frame[length - 1] << 8);
+        if (crc16(frame + 1, length - 3, 0xffff) != crc)
+        {
+            // Sync bytes within the corrupted frame can look like further
+            // corrupted frames, whose command and sequence number are garbage
+            if (!resyncing)
+                sendFrame(frame[1], frame[2], FRAME_STATUS_CRC_ERROR, nullptr, 0);
+            resyncing = true;
+            pos++;
+            continue;
+        }
+
+        resyncing = false;
+        processFrame(frame[1], frame[2], frame + FRAME_HEADER_LENGTH, payload_length);
+        pos += length;
+    }
+
+    if (!binary_mode)
+    {
+        frame_length = 0;
+        return;
+    }
+
+    memmove(frame_buf, frame_buf + pos, frame_length - pos);
+    frame_length -= pos;
+}
+
+void TTNProvisioning::discardPartialFrame()
+{
+    // Skip the sync byte of the partial frame and look for complete frames after it
+    frame_length--;
+    memmove(frame_buf, frame_buf + 1, frame_length);
+    resyncing = false;
+    processFrames();
+}
+
+void TTNProvisioning::processFrame(uint8_t cmd, uint8_t seq, const uint8_t* payload, int len)
+{
+    switch (cmd)
+    {
+        case FRAME_CMD_PING:
+            sendFrame(cmd, seq, FRAME_STATUS_OK, payload, len);
+            break;
+
+        case FRAME_CMD_INFO:
+        {
+            uint8_t info[23];
+            info[0] = have_keys ? 1 : 0;
+            esp_err_t err = esp_efuse_mac_get_default(info + 1);
+            ESP_ERROR_CHECK(err);
+            memcpy(info + 7, global_dev_eui, 8);
+            swapBytes(info + 7, 8);
+            memcpy(info + 15, global_app_eui, 8);
+            swapBytes(info + 15, 8);
+            sendFrame(cmd, seq, FRAME_STATUS_OK, info, sizeof(info));
+            break;
+        }
+
+        case FRAME_CMD_PROVISION:
+        {
+            uint8_t hash[32];
+            uint8_t status = processProvisionFrame(payload, len, hash);
+            sendFrame(cmd, seq, status, hash, status == FRAME_STATUS_OK ? sizeof(hash) : 0);
+            break;
+        }
+
+        case FRAME_CMD_HASH:
+        {
+            uint8_t hash[32];
+            bool is_ok = have_keys && hashKeysAndConfig(nullptr, 0, hash);
+            sendFrame(cmd, seq, is_ok ? FRAME_STATUS_OK : FRAME_STATUS_STORAGE_ERROR, hash, is_ok ? sizeof(hash) : 0);
+            break;
+        }
+
+        case FRAME_CMD_EXIT:
+            sendFrame(cmd, seq, FRAME_STATUS_OK, nullptr, 0);
+            binary_mode = false;
+            break;
+
+        default:
+            sendFrame(cmd, seq, FRAME_STATUS_UNKNOWN_COMMAND, nullptr, 0);
+            break;
+    }
+}
+
+uint8_t TTNProvisioning::processProvisionFrame(const uint8_t* payload, int len, uint8_t* hash)
+{
+    if (len < 33)
+        return FRAME_STATUS_INVALID_DATA;
+
+    // Parse and validate the config entries before anything is changed
+    TTNConfigEntry entries[MAX_CONFIG_ENTRIES];
+    char keys[MAX_CONFIG_ENTRIES][NVS_KEY_NAME_MAX_SIZE];
+    int count = 0;
+    int pos = 33;
+    while (pos < len)
+    {
+        if (count == MAX_CONFIG_ENTRIES)
+            return FRAME_STATUS_INVALID_DATA;
+
+        int key_length = payload[pos];
+        if (key_length == 0 || key_length >= NVS_KEY_NAME_MAX_SIZE || pos + 1 + key_length + 2 > len)
+            return FRAME_STATUS_INVALID_DATA;
+        memcpy(keys[count], payload + pos + 1, key_length);
+        keys[count][key_length] = 0;
+        if (isReservedKey(keys[count]))
+            return FRAME_STATUS_INVALID_DATA;
+        pos += 1 + key_length;
+
+        int value_length = payload[pos] | (payload[pos + 1] << 8);
+        pos += 2;
+        if (pos + value_length > len)
+            return FRAME_STATUS_INVALID_DATA;
+
+        entries[count].key = keys[count];
+        entries[count].value = payload + pos;
+        entries[count].length = value_length;
+        count++;
+        pos += value_length;
+    }
+
+    uint8_t dev_eui[8];
+    if ((payload[0] & PROVISION_FLAG_DEV_EUI_FROM_MAC) != 0)
+    {
+        uint8_t mac[6];
+        esp_err_t err = esp_efuse_mac_get_default(mac);
+        ESP_ERROR_CHECK(err);
+
+        dev_eui[7] = mac[0];
+        dev_eui[6] = mac[1];
+        dev_eui[5] = mac[2];
+        dev_eui[4] = 0xff;
+        dev_eui[3] = 0xfe;
+        dev_eui[2] = mac[3];
+        dev_eui[1] = mac[4];
+        dev_eui[0] = mac[5];
+    }
+    else
+    {
+        memcpy(dev_eui, payload + 1, 8);
+        swapBytes(dev_eui, 8);
+    }
+
+    uint8_t app_eui[8];
+    memcpy(app_eui, payload + 9, 8);
+    swapBytes(app_eui, 8);
+    const uint8_t* app_key = payload + 17;
+
+    // The keys in use are only replaced once they have been saved
+    if (!saveKeysAndConfig(dev_eui, app_eui, app_key, entries, count, hash))
+        return FRAME_STATUS_STORAGE_ERROR;
+
+    memcpy(global_dev_eui, dev_eui, sizeof(global_dev_eui));
+    memcpy(global_app_eui, app_eui, sizeof(global_app_eui));
+    memcpy(global_app_key, app_key, sizeof(global_app_key));
+    have_keys = !isAllZeros(global_dev_eui, sizeof(global_dev_eui))
+        && !isAllZeros(global_app_eui, sizeof(global_app_eui))
+        && !isAllZeros(global_app_key, sizeof(global_app_key));
+
+    resetLMIC();
+    return FRAME_STATUS_OK;
+}
+
+bool TTNProvisioning::isReservedKey(const char* key)
+{
+    for (const char* reserved : RESERVED_KEYS)
+    {
+        if (strcmp(key, reserved) == 0)
+            return true;
+    }
+    return false;
+}
+
+void TTNProvisioning::sendFrame(uint8_t cmd, uint8_t seq, uint8_t status, const uint8_t* payload, int len)
+{
+    uint8_t header[FRAME_HEADER_LENGTH + 1];
+    header[0] = FRAME_SYNC;
+    header[1] = cmd | FRAME_RESPONSE;
+    header[2] = seq;
+    header[3] = (len + 1) & 0xff;
+    header[4] = (len + 1) >> 8;
+    header[5] = status;
+
+    // The CRC covers the header (without sync byte) and the payload
+    uint16_t crc = crc16(header + 1, sizeof(header) - 1, 0xffff);
+    crc = crc16(payload, len, crc);
+
+    uint8_t trailer[FRAME_CRC_LENGTH] = { (uint8_t)(crc & 0xff), (uint8_t)(crc >> 8) };
+    uart_write_bytes(UART_NUM, (const char*)header, sizeof(header));
+    if (len > 0)
+        uart_write_bytes(UART_NUM, (const char*)payload, len);
+    uart_write_bytes(UART_NUM, (const char*)trailer, sizeof(trailer));
 }
 
 #endif
@@ -395,6 +736,58 @@ bool TTNProvisioning::decode(bool incl_dev_eui, const char *dev_eui, const char
 }
 
 
+// --- ABP key handling
+
+bool TTNProvisioning::haveABPKeys()
+{
+    return have_abp_keys;
+}
+
+bool TTNProvisioning::decodeABPKeys(const char *dev_addr, const char *nwk_skey, const char *app_skey)
+{
+    uint8_t buf_dev_addr[4];
+    uint8_t buf_nwk_skey[16];
+    uint8_t buf_app_skey[16];
+
+    if (strlen(dev_addr) != 8 || !hexStrToBin(dev_addr, buf_dev_addr, 4))
+    {
+        ESP_LOGW(TAG, "Invalid device address: %s", dev_addr);
+        return false;
+    }
+
+    if (strlen(nwk_skey) != 32 || !hexStrToBin(nwk_skey, buf_nwk_skey, 16))
+    {
+        ESP_LOGW(TAG, "Invalid network session key: %s", nwk_skey);
+        return false;
+    }
+
+    if (strlen(app_skey) != 32 || !hexStrToBin(app_skey, buf_app_skey, 16))
+    {
+        ESP_LOGW(TAG, "Invalid application session key: %s", app_skey);
+        return false;
+    }
+
+    // The device address is displayed as a big-endian number
+    global_dev_addr = ((uint32_t)buf_dev_addr[0] << 24) | ((uint32_t)buf_dev_addr[1] << 16)
+        | ((uint32_t)buf_dev_addr[2] << 8) | buf_dev_addr[3];
+    memcpy(global_nwk_skey, buf_nwk_skey, sizeof(global_nwk_skey));
+    memcpy(global_app_skey, buf_app_skey, sizeof(global_app_skey));
+
+    have_abp_keys = global_dev_addr != 0
+        && !isAllZeros(global_nwk_skey, sizeof(global_nwk_skey))
+        && !isAllZeros(global_app_skey, sizeof(global_app_skey));
+
+    return true;
+}
+
+void TTNProvisioning::getABPKeys(uint32_t* dev_addr, uint8_t* nwk_skey, uint8_t* app_skey)
+{
+    *dev_addr = global_dev_addr;
+    memcpy(nwk_skey, global_nwk_skey, sizeof(global_nwk_skey));
+    memcpy(app_skey, global_app_skey, sizeof(global_app_skey));
+}
+
+
 // --- Non-volatile storage
 
 bool TTNProvisioning::saveKeys()
@@ -432,6 +825,106 @@ done:
     return result;
 }
 
+// Saves the keys and the config entries in a single NVS transaction
+// and computes the hash of the values read back
+bool TTNProvisioning::saveKeysAndConfig(const uint8_t* dev_eui, const uint8_t* app_eui, const uint8_t* app_key,
+    const TTNConfigEntry* entries, int count, uint8_t* hash)
+{
+    bool result = false;
+
+    nvs_handle handle = 0;
+    esp_err_t res = nvs_open(NVS_FLASH_PARTITION, NVS_READWRITE, &handle);
+    if (res == ESP_ERR_NVS_NOT_INITIALIZED)
+    {
+        ESP_LOGW(TAG, "NVS storage is not initialized. Call 'nvs_flash_init()' first.");
+        goto done;
+    }
+    ESP_ERROR_CHECK(res);
+    if (res != ESP_OK)
+        goto done;
+
+    if (!writeNvsValue(handle, NVS_FLASH_KEY_DEV_EUI, dev_eui, sizeof(global_dev_eui)))
+        goto done;
+        
+    if (!writeNvsValue(handle, NVS_FLASH_KEY_APP_EUI, app_eui, sizeof(global_app_eui)))
+        goto done;
+        
+    if (!writeNvsValue(handle, NVS_FLASH_KEY_APP_KEY, app_key, sizeof(global_app_key)))
+        goto done;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!writeNvsValue(handle, entries[i].key, entries[i].value, entries[i].length))
+            goto done;
+    }
+
+    res = nvs_commit(handle);
+    ESP_ERROR_CHECK(res);
+    
+    result = true;
+    ESP_LOGI(TAG, "Dev and app EUI, app key and %d config values saved in NVS storage", count);
+
+done:
+    nvs_close(handle);
+    return result && hashKeysAndConfig(entries, count, hash);
+}
+
+// Computes the SHA-256 hash of the keys and config values read back from NVS:
+// dev EUI, app EUI (both most-significant byte first), app key, and for each config
+// entry: key length (1 byte), key, value length (2 bytes, little endian), value
+bool TTNProvisioning::hashKeysAndConfig(const TTNConfigEntry* entries, int count, uint8_t* hash)
+{
+    uint8_t buf_dev_eui[8];
+    uint8_t buf_app_eui[8];
+    uint8_t buf_app_key[16];
+    uint8_t* value = nullptr;
+    bool result = false;
+
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts_ret(&ctx, 0);
+
+    nvs_handle handle = 0;
+    esp_err_t res = nvs_open(NVS_FLASH_PARTITION, NVS_READONLY, &handle);
+    if (res != ESP_OK)
+        goto done;
+
+    if (!readNvsValue(handle, NVS_FLASH_KEY_DEV_EUI, buf_dev_eui, sizeof(buf_dev_eui), false)
+            || !readNvsValue(handle, NVS_FLASH_KEY_APP_EUI, buf_app_eui, sizeof(buf_app_eui), false)
+            || !readNvsValue(handle, NVS_FLASH_KEY_APP_KEY, buf_app_key, sizeof(buf_app_key), false))
+        goto done;
+
+    swapBytes(buf_dev_eui, sizeof(buf_dev_eui));
+    swapBytes(buf_app_eui, sizeof(buf_app_eui));
+    mbedtls_sha256_update_ret(&ctx, buf_dev_eui, sizeof(buf_dev_eui));
+    mbedtls_sha256_update_ret(&ctx, buf_app_eui, sizeof(buf_app_eui));
+    mbedtls_sha256_update_ret(&ctx, buf_app_key, sizeof(buf_app_key));
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t length = entries[i].length;
+        value = (uint8_t*)realloc(value, length > 0 ? length : 1);
+        if (value == nullptr || !readNvsValue(handle, entries[i].key, value, length, false))
+            goto done;
+
+        uint8_t key_length = strlen(entries[i].key);
+        uint8_t value_length[2] = { (uint8_t)(length & 0xff), (uint8_t)(length >> 8) };
+        mbedtls_sha256_update_ret(&ctx, &key_length, 1);
+        mbedtls_sha256_update_ret(&ctx, (const uint8_t*)entries[i].key, key_length);
+        mbedtls_sha256_update_ret(&ctx, value_length, 2);
+        mbedtls_sha256_update_ret(&ctx, value, length);
+    }
+
+    mbedtls_sha256_finish_ret(&ctx, hash);
+    result = true;
+
+done:
+    free(value);
+    nvs_close(handle);
+    mbedtls_sha256_free(&ctx);
+    return result;
+}
+
 bool TTNProvisioning::restoreKeys(bool silent)
 {
     uint8_t buf_dev_eui[8];
@@ -482,6 +975,148 @@ done:
     return true;
 }
 
+bool TTNProvisioning::saveABPKeys()
+{
+    bool result = false;
+
+    nvs_handle handle = 0;
+    esp_err_t res = nvs_open(NVS_FLASH_PARTITION, NVS_READWRITE, &handle);
+    if (res == ESP_ERR_NVS_NOT_INITIALIZED)
+    {
+        ESP_LOGW(TAG, "NVS storage is not initialized. Call 'nvs_flash_init()' first.");
+        goto done;
+    }
+    ESP_ERROR_CHECK(res);
+    if (res != ESP_OK)
+        goto done;
+
+    if (!writeNvsValue(handle, NVS_FLASH_KEY_DEV_ADDR, (const uint8_t*)&global_dev_addr, sizeof(global_dev_addr)))
+        goto done;
+
+    if (!writeNvsValue(handle, NVS_FLASH_KEY_NWK_SKEY, global_nwk_skey, sizeof(global_nwk_skey)))
+        goto done;
+
+    if (!writeNvsValue(handle, NVS_FLASH_KEY_APP_SKEY, global_app_skey, sizeof(global_app_skey)))
+        goto done;
+
+    res = nvs_commit(handle);
+    ESP_ERROR_CHECK(res);
+
+    result = true;
+    ESP_LOGI(TAG, "Device address and session keys saved in NVS storage");
+
+done:
+    nvs_close(handle);
+    return result;
+}
+
+bool TTNProvisioning::restoreABPKeys(bool silent)
+{
+    uint32_t buf_dev_addr;
+    uint8_t buf_nwk_skey[16];
+    uint8_t buf_app_skey[16];
+
+    nvs_handle handle = 0;
+    esp_err_t res = nvs_open(NVS_FLASH_PARTITION, NVS_READONLY, &handle);
+    if (res == ESP_ERR_NVS_NOT_FOUND)
+        return false; // partition does not exist yet
+    if (res == ESP_ERR_NVS_NOT_INITIALIZED)
+    {
+        ESP_LOGW(TAG, "NVS storage is not initialized. Call 'nvs_flash_init()' first.");
+        goto done;
+    }
+    ESP_ERROR_CHECK(res);
+    if (res != ESP_OK)
+        goto done;
+
+    if (!readNvsValue(handle, NVS_FLASH_KEY_DEV_ADDR, (uint8_t*)&buf_dev_addr, sizeof(global_dev_addr), silent))
+        goto done;
+
+    if (!readNvsValue(handle, NVS_FLASH_KEY_NWK_SKEY, buf_nwk_skey, sizeof(global_nwk_skey), silent))
+        goto done;
+
+    if (!readNvsValue(handle, NVS_FLASH_KEY_APP_SKEY, buf_app_skey, sizeof(global_app_skey), silent))
+        goto done;
+
+    global_dev_addr = buf_dev_addr;
+    memcpy(global_nwk_skey, buf_nwk_skey, sizeof(global_nwk_skey));
+    memcpy(global_app_skey, buf_app_skey, sizeof(global_app_skey));
+
+    have_abp_keys = global_dev_addr != 0
+        && !isAllZeros(global_nwk_skey, sizeof(global_nwk_skey))
+        && !isAllZeros(global_app_skey, sizeof(global_app_skey));
+
+    if (have_abp_keys)
+    {
+       ESP_LOGI(TAG, "Device address and session keys have been restored from NVS storage");
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Device address and session keys are invalid (zeroes only)");
+    }
+
+done:
+    nvs_close(handle);
+    return have_abp_keys;
+}
+
+bool TTNProvisioning::saveData(const char* key, const void* data, size_t len)
+{
+    bool result = false;
+
+    nvs_handle handle = 0;
+    esp_err_t res = nvs_open(NVS_FLASH_PARTITION, NVS_READWRITE, &handle);
+    if (res == ESP_ERR_NVS_NOT_INITIALIZED)
+    {
+        ESP_LOGW(TAG, "NVS storage is not initialized. Call 'nvs_flash_init()' first.");
+        goto done;
+    }
+    ESP_ERROR_CHECK(res);
+    if (res != ESP_OK)
+        goto done;
+
+    if (!writeNvsValue(handle, key, (const uint8_t*)data, len))
+        goto done;
+
+    res = nvs_commit(handle);
+    ESP_ERROR_CHECK(res);
+
+    result = true;
+
+done:
+    nvs_close(handle);
+    return result;
+}
+
+bool TTNProvisioning::restoreData(const char* key, void* data, size_t len)
+{
+    bool result = false;
+
+    nvs_handle handle = 0;
+    esp_err_t res = nvs_open(NVS_FLASH_PARTITION, NVS_READONLY, &handle);
+    if (res == ESP_ERR_NVS_NOT_FOUND)
+        return false; // partition does not exist yet
+    if (res == ESP_ERR_NVS_NOT_INITIALIZED)
+    {
+        ESP_LOGW(TAG, "NVS storage is not initialized. Call 'nvs_flash_init()' first.");
+        goto done;
+    }
+    ESP_ERROR_CHECK(res);
+    if (res != ESP_OK)
+        goto done;
+
+    result = readNvsValue(handle, key, (uint8_t*)data, len, true);
+
+done:
+    nvs_close(handle);
+    return result;
+}
+
+uint32_t TTNProvisioning::nvsWriteCount()
+{
+    return nvs_write_count;
+}
+
 bool TTNProvisioning::readNvsValue(nvs_handle handle, const char* key, uint8_t* data, size_t expected_length, bool silent)
 {
     size_t size = expected_length;
@@ -510,11 +1145,12 @@ bool TTNProvisioning::readNvsValue(nvs_handle handle, const char* key, uint8_t*
 bool TTNProvisioning::writeNvsValue(nvs_handle handle, const char* key, const uint8_t* data, size_t len)
 {
     uint8_t buf[16];
-    if (readNvsValue(handle, key, buf, len, true) && memcmp(buf, data, len) == 0)
+    if (len <= sizeof(buf) && readNvsValue(handle, key, buf, len, true) && memcmp(buf, data, len) == 0)
         return true; // unchanged
     
     esp_err_t res = nvs_set_blob(handle, key, data, len);
     ESP_ERROR_CHECK(res);
+    nvs_write_count++;
 
     return res == ESP_OK;
 }
@@ -595,4 +1231,16 @@ bool TTNProvisioning::isAllZeros(const uint8_t* buf, int len)
         if (buf[i] != 0)
             return false;
     return true;
+}
+
+// CRC-16/CCITT (polynomial 0x1021, start value 0xffff)
+uint16_t TTNProvisioning::crc16(const uint8_t* buf, int len, uint16_t crc)
+{
+    for (int i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)buf[i] << 8;
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 0x8000) != 0 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
 }
\ No newline at end of file
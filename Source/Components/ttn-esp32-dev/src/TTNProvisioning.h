@@ -17,6 +17,17 @@
 #include "nvs_flash.h"
 
 
+/**
+ * @brief Application configuration value saved together with the keys
+ */
+struct TTNConfigEntry
+{
+    const char* key;
+    const uint8_t* value;
+    size_t length;
+};
+
+
 class TTNProvisioning
 {
 public:
@@ -26,8 +37,20 @@ public:
     bool decodeKeys(const char *dev_eui, const char *app_eui, const char *app_key);
     bool fromMAC(const char *app_eui, const char *app_key);
     bool saveKeys();
+    bool saveKeysAndConfig(const uint8_t* dev_eui, const uint8_t* app_eui, const uint8_t* app_key,
+        const TTNConfigEntry* entries, int count, uint8_t* hash);
     bool restoreKeys(bool silent);
 
+    bool haveABPKeys();
+    bool decodeABPKeys(const char *dev_addr, const char *nwk_skey, const char *app_skey);
+    bool saveABPKeys();
+    bool restoreABPKeys(bool silent);
+    void getABPKeys(uint32_t* dev_addr, uint8_t* nwk_skey, uint8_t* app_skey);
+
+    bool saveData(const char* key, const void* data, size_t len);
+    bool restoreData(const char* key, void* data, size_t len);
+    static uint32_t nvsWriteCount();
+
 #if defined(TTN_HAS_AT_COMMANDS)
     void startTask();
 #endif
@@ -36,12 +59,22 @@ private:
     bool decode(bool incl_dev_eui, const char *dev_eui, const char *app_eui, const char *app_key);
     bool readNvsValue(nvs_handle handle, const char* key, uint8_t* data, size_t expected_length, bool silent);
     bool writeNvsValue(nvs_handle handle, const char* key, const uint8_t* data, size_t len);
+    bool hashKeysAndConfig(const TTNConfigEntry* entries, int count, uint8_t* hash);
 
 #if defined(TTN_HAS_AT_COMMANDS)
     void provisioningTask();
     void addLineData(int numBytes);
     void detectLineEnd(int start_at);
     void processLine();
+
+    void addFrameData(int numBytes);
+    void processFrames();
+    void discardPartialFrame();
+    void processFrame(uint8_t cmd, uint8_t seq, const uint8_t* payload, int len);
+    uint8_t processProvisionFrame(const uint8_t* payload, int len, uint8_t* hash);
+    void sendFrame(uint8_t cmd, uint8_t seq, uint8_t status, const uint8_t* payload, int len);
+    void resetLMIC();
+    static bool isReservedKey(const char* key);
 #endif
 
 #if defined(TTN_CONFIG_UART)
@@ -55,9 +88,11 @@ private:
     static char valToHexDigit(int val);
     static void swapBytes(uint8_t* buf, int len);
     static bool isAllZeros(const uint8_t* buf, int len);
+    static uint16_t crc16(const uint8_t* buf, int len, uint16_t crc);
 
 private:
     bool have_keys = false;
+    bool have_abp_keys = false;
 
 #if defined(TTN_HAS_AT_COMMANDS)
     QueueHandle_t uart_queue;
@@ -65,6 +100,10 @@ private:
     int line_length;
     uint8_t last_line_end_char;
     bool quit_task;
+    bool binary_mode;
+    uint8_t* frame_buf;
+    int frame_length;
+    bool resyncing;
 
     friend void ttn_provisioning_task_caller(void* pvParameter);
 #endif
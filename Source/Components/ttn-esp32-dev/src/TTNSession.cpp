@@ -0,0 +1,337 @@
+/*******************************************************************************
+ * 
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ * 
+ * Copyright (c) 2019 ContextQuickie
+ * 
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ * 
+ * Persistence of the LoRaWAN session in RTC memory across deep sleep.
+ *******************************************************************************/
+
+#include <stddef.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "lmic/lmic.h"
+#include "TTNSession.h"
+#include "TTNProvisioning.h"
+
+
+// Upper 16 bits: magic number, lower 16 bits: layout version.
+// Increment the layout version whenever TTNSessionData changes.
+#define TTN_SESSION_VERSION 0x5e550001
+
+// Network ID of The Things Network (used for ABP)
+#define TTN_NETID 0x13
+
+static const char* const TAG = "ttn_session";
+static const char* const NVS_FLASH_KEY_SESSION = "session";
+static const char* const NVS_FLASH_KEY_FCNT_LIMIT = "fcntLimit";
+
+RTC_DATA_ATTR static TTNSessionData rtcSession;
+// Uplink frame counter limit saved in NVS (0 if unknown)
+RTC_DATA_ATTR static uint32_t rtcFcntLimit;
+
+
+// Take a snapshot of the current session.
+// Must be called while the LMIC is idle, e.g. from an LMIC callback.
+void TTNSession::save()
+{
+    if (LMIC.devaddr == 0)
+        return; // no session
+
+    TTNSessionData data;
+    memset(&data, 0, sizeof(data));
+    ostime_t now = os_getTime();
+
+    data.version = TTN_SESSION_VERSION;
+    data.netid = LMIC.netid;
+    data.devaddr = LMIC.devaddr;
+    data.seqnoUp = LMIC.seqnoUp;
+    data.seqnoDn = LMIC.seqnoDn;
+    memcpy(data.nwkKey, LMIC.nwkKey, sizeof(data.nwkKey));
+    memcpy(data.artKey, LMIC.artKey, sizeof(data.artKey));
+
+#if CFG_LMIC_EU_like
+    memcpy(data.bands, LMIC.bands, sizeof(data.bands));
+    for (int i = 0; i < MAX_BANDS; i++)
+        data.bands[i].avail = remainingTicks(LMIC.bands[i].avail, now);
+    memcpy(data.channelFreq, LMIC.channelFreq, sizeof(data.channelFreq));
+#if !defined(DISABLE_MCMD_DlChannelReq)
+    memcpy(data.channelDlFreq, LMIC.channelDlFreq, sizeof(data.channelDlFreq));
+#endif
+    memcpy(data.channelDrMap, LMIC.channelDrMap, sizeof(data.channelDrMap));
+    data.channelMap = LMIC.channelMap;
+#elif CFG_LMIC_US_like
+    memcpy(data.xchFreq, LMIC.xchFreq, sizeof(data.xchFreq));
+    memcpy(data.xchDrMap, LMIC.xchDrMap, sizeof(data.xchDrMap));
+    memcpy(data.channelMap, LMIC.channelMap, sizeof(data.channelMap));
+    data.activeChannels125khz = LMIC.activeChannels125khz;
+    data.activeChannels500khz = LMIC.activeChannels500khz;
+#endif
+
+    data.adrAckReq = LMIC.adrAckReq;
+    data.datarate = LMIC.datarate;
+    data.adrTxPow = LMIC.adrTxPow;
+    data.txpow = LMIC.txpow;
+    data.adrEnabled = LMIC.adrEnabled;
+    data.upRepeat = LMIC.upRepeat;
+#if LMIC_ENABLE_TxParamSetupReq
+    data.txParam = LMIC.txParam;
+#endif
+
+    data.dn2Freq = LMIC.dn2Freq;
+    data.dn2Dr = LMIC.dn2Dr;
+    data.rx1DrOffset = LMIC.rx1DrOffset;
+    data.rxDelay = LMIC.rxDelay;
+
+    data.globalDutyRate = LMIC.globalDutyRate;
+    data.globalDutyAvail = remainingTicks(LMIC.globalDutyAvail, now);
+
+    data.savedAt = wallClockTime();
+    data.checksum = calculateChecksum(&data);
+
+    rtcSession = data;
+}
+
+// Restore the session saved before deep sleep.
+// The LMIC must have been reset before. On success, the next uplink
+// can be sent immediately without joining.
+bool TTNSession::restore()
+{
+    if (!isValid())
+        return false;
+
+    const TTNSessionData& data = rtcSession;
+
+    // Time spent in deep sleep is deducted from the duty cycle timers.
+    // If the wall clock went backwards, no time is assumed to have passed.
+    int64_t elapsedUs = wallClockTime() - data.savedAt;
+    if (elapsedUs < 0)
+        elapsedUs = 0;
+    int64_t elapsed = elapsedUs / US_PER_OSTICK;
+    ostime_t now = os_getTime();
+
+    // Puts the MAC into the joined state (and resets the counters)
+    LMIC_setSession(data.netid, data.devaddr, (xref2u1_t)data.nwkKey, (xref2u1_t)data.artKey);
+    LMIC.initBandplanAfterReset = 1;
+
+    LMIC.seqnoUp = data.seqnoUp;
+    LMIC.seqnoDn = data.seqnoDn;
+
+#if CFG_LMIC_EU_like
+    memcpy(LMIC.bands, data.bands, sizeof(LMIC.bands));
+    for (int i = 0; i < MAX_BANDS; i++)
+        LMIC.bands[i].avail = now + (elapsed < data.bands[i].avail ? data.bands[i].avail - (ostime_t)elapsed : 0);
+    memcpy(LMIC.channelFreq, data.channelFreq, sizeof(LMIC.channelFreq));
+#if !defined(DISABLE_MCMD_DlChannelReq)
+    memcpy(LMIC.channelDlFreq, data.channelDlFreq, sizeof(LMIC.channelDlFreq));
+#endif
+    memcpy(LMIC.channelDrMap, data.channelDrMap, sizeof(LMIC.channelDrMap));
+    LMIC.channelMap = data.channelMap;
+#elif CFG_LMIC_US_like
+    memcpy(LMIC.xchFreq, data.xchFreq, sizeof(LMIC.xchFreq));
+    memcpy(LMIC.xchDrMap, data.xchDrMap, sizeof(LMIC.xchDrMap));
+    memcpy(LMIC.channelMap, data.channelMap, sizeof(LMIC.channelMap));
+    LMIC.activeChannels125khz = data.activeChannels125khz;
+    LMIC.activeChannels500khz = data.activeChannels500khz;
+#endif
+
+    LMIC.adrAckReq = data.adrAckReq;
+    LMIC.datarate = data.datarate;
+    LMIC.adrTxPow = data.adrTxPow;
+    LMIC.txpow = data.txpow;
+    LMIC.adrEnabled = data.adrEnabled;
+    LMIC.upRepeat = data.upRepeat;
+#if LMIC_ENABLE_TxParamSetupReq
+    LMIC.txParam = data.txParam;
+#endif
+
+    LMIC.dn2Freq = data.dn2Freq;
+    LMIC.dn2Dr = data.dn2Dr;
+    LMIC.rx1DrOffset = data.rx1DrOffset;
+    LMIC.rxDelay = data.rxDelay;
+
+    LMIC.globalDutyRate = data.globalDutyRate;
+    LMIC.globalDutyAvail = now + (elapsed < data.globalDutyAvail ? data.globalDutyAvail - (ostime_t)elapsed : 0);
+
+    ESP_LOGI(TAG, "Session restored: devaddr=%08x, FCntUp=%u, FCntDn=%u", data.devaddr, data.seqnoUp, data.seqnoDn);
+    return true;
+}
+
+// Discard the saved session, e.g. after a new join or a reset.
+void TTNSession::invalidate()
+{
+    memset(&rtcSession, 0, sizeof(rtcSession));
+    rtcFcntLimit = 0;
+}
+
+bool TTNSession::isValid()
+{
+    if (rtcSession.version != TTN_SESSION_VERSION)
+        return false;
+
+    if (rtcSession.checksum != calculateChecksum(&rtcSession))
+    {
+        ESP_LOGW(TAG, "Saved session is corrupt");
+        return false;
+    }
+
+    return rtcSession.devaddr != 0;
+}
+
+// Copy the saved session for writing it to NVS.
+// Must be called in the LMIC task, which updates the session after each uplink.
+bool TTNSession::snapshot(TTNSessionData* data)
+{
+    if (!isValid())
+        return false;
+
+    *data = rtcSession;
+    return true;
+}
+
+// Save the session (a snapshot, see 'snapshot()') in NVS. Called after a join.
+void TTNSession::persistSession(TTNProvisioning& provisioning, const TTNSessionData& data)
+{
+    // The limit is saved first: a limit from a previous session only
+    // advances the counter, it never makes it go backwards.
+    if (!saveFrameCounterLimit(provisioning, data.seqnoUp + CONFIG_TTN_FCNT_NVS_STRIDE))
+        return;
+
+    if (!provisioning.saveData(NVS_FLASH_KEY_SESSION, &data, sizeof(data)))
+        ESP_LOGW(TAG, "Failed to save session in NVS");
+}
+
+// Advance the frame counter limit in NVS if the counter of the snapshot
+// gets close to it. Called after each uplink. Writing at half the stride
+// leaves room for uplinks initiated by the MAC layer itself.
+void TTNSession::persistFrameCounter(TTNProvisioning& provisioning, const TTNSessionData& data)
+{
+    uint32_t seqnoUp = data.seqnoUp;
+    if (rtcFcntLimit > seqnoUp + CONFIG_TTN_FCNT_NVS_STRIDE / 2
+            && rtcFcntLimit <= seqnoUp + CONFIG_TTN_FCNT_NVS_STRIDE)
+        return;
+
+    saveFrameCounterLimit(provisioning, seqnoUp + CONFIG_TTN_FCNT_NVS_STRIDE);
+}
+
+// Restore the session saved in NVS, e.g. after a power loss.
+// The uplink frame counter continues at the saved limit.
+bool TTNSession::restoreFromNvs(TTNProvisioning& provisioning)
+{
+    TTNSessionData data;
+    if (!loadFromNvs(provisioning, &data))
+        return false;
+
+    return resumeFromNvs(provisioning, &data);
+}
+
+// Activate an ABP session (the keys are not exchanged via a join).
+// If the session with these keys is already known (in RTC memory or NVS),
+// it is continued. Otherwise, a new session with frame counters of 0 is
+// started, and saved in NVS immediately.
+bool TTNSession::personalize(TTNProvisioning& provisioning, devaddr_t devaddr, const u1_t* nwkKey, const u1_t* artKey)
+{
+    if (isValid() && isSessionFor(rtcSession, devaddr, nwkKey, artKey))
+        return restore();
+
+    TTNSessionData data;
+    if (loadFromNvs(provisioning, &data) && isSessionFor(data, devaddr, nwkKey, artKey))
+        return resumeFromNvs(provisioning, &data);
+
+    LMIC_setSession(TTN_NETID, devaddr, (xref2u1_t)nwkKey, (xref2u1_t)artKey);
+    LMIC.initBandplanAfterReset = 1;
+    LMIC.seqnoUp = 0;
+    LMIC.seqnoDn = 0;
+
+#if defined(CFG_eu868)
+    // Additional channels and RX2 data rate of the TTN frequency plan.
+    // With OTAA, they are provided in the join accept. The band (duty cycle)
+    // is derived from the frequency.
+    LMIC_setupChannel(3, 867100000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC_setupChannel(4, 867300000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC_setupChannel(5, 867500000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC_setupChannel(6, 867700000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC_setupChannel(7, 867900000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC.dn2Dr = DR_SF9;
+#endif
+
+    save();
+    persistSession(provisioning, rtcSession);
+
+    ESP_LOGI(TAG, "New ABP session started: devaddr=%08x", devaddr);
+    return true;
+}
+
+// Read and verify the session saved in NVS, including the frame counter limit
+bool TTNSession::loadFromNvs(TTNProvisioning& provisioning, TTNSessionData* data)
+{
+    if (!provisioning.restoreData(NVS_FLASH_KEY_SESSION, data, sizeof(*data)))
+        return false;
+
+    if (data->version != TTN_SESSION_VERSION || data->checksum != calculateChecksum(data) || data->devaddr == 0)
+    {
+        ESP_LOGW(TAG, "Session saved in NVS is invalid");
+        return false;
+    }
+
+    uint32_t limit = 0;
+    if (provisioning.restoreData(NVS_FLASH_KEY_FCNT_LIMIT, &limit, sizeof(limit)) && limit > data->seqnoUp)
+        data->seqnoUp = limit;
+
+    return true;
+}
+
+bool TTNSession::resumeFromNvs(TTNProvisioning& provisioning, TTNSessionData* data)
+{
+    // Reserve the next range before the first uplink uses the restored counter
+    if (!saveFrameCounterLimit(provisioning, data->seqnoUp + CONFIG_TTN_FCNT_NVS_STRIDE))
+        return false;
+
+    data->checksum = calculateChecksum(data);
+    rtcSession = *data;
+
+    return restore();
+}
+
+bool TTNSession::saveFrameCounterLimit(TTNProvisioning& provisioning, uint32_t limit)
+{
+    if (!provisioning.saveData(NVS_FLASH_KEY_FCNT_LIMIT, &limit, sizeof(limit)))
+    {
+        ESP_LOGW(TAG, "Failed to save frame counter limit in NVS");
+        return false;
+    }
+
+    rtcFcntLimit = limit;
+    ESP_LOGD(TAG, "Frame counter limit %u saved (%u NVS writes)", limit, TTNProvisioning::nvsWriteCount());
+    return true;
+}
+
+bool TTNSession::isSessionFor(const TTNSessionData& data, devaddr_t devaddr, const u1_t* nwkKey, const u1_t* artKey)
+{
+    return data.devaddr == devaddr
+        && memcmp(data.nwkKey, nwkKey, sizeof(data.nwkKey)) == 0
+        && memcmp(data.artKey, artKey, sizeof(data.artKey)) == 0;
+}
+
+uint16_t TTNSession::calculateChecksum(const TTNSessionData* data)
+{
+    return os_crc16((xref2cu1_t)data, offsetof(TTNSessionData, checksum));
+}
+
+ostime_t TTNSession::remainingTicks(ostime_t avail, ostime_t now)
+{
+    ostime_t remaining = avail - now;
+    return remaining > 0 ? remaining : 0;
+}
+
+// Wall clock time in µs. Unlike the LMIC time, it continues during deep sleep.
+int64_t TTNSession::wallClockTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
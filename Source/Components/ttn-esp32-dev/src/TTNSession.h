@@ -0,0 +1,133 @@
+/*******************************************************************************
+ * 
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ * 
+ * Copyright (c) 2019 ContextQuickie
+ * 
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ * 
+ * Persistence of the LoRaWAN session in RTC memory across deep sleep.
+ *******************************************************************************/
+
+#ifndef _ttnsession_h_
+#define _ttnsession_h_
+
+#include <stdint.h>
+#include "lmic/lmic.h"
+
+class TTNProvisioning;
+
+
+/**
+ * @brief Snapshot of the LMIC session state kept in RTC memory.
+ * 
+ * Only the data required to continue the session without a new join is
+ * stored. Times (duty cycle availability) are stored relative to the
+ * moment the snapshot was taken, as the LMIC time base restarts after
+ * deep sleep.
+ */
+struct TTNSessionData
+{
+    uint32_t    version;
+
+    // Session
+    u4_t        netid;
+    devaddr_t   devaddr;
+    u4_t        seqnoUp;
+    u4_t        seqnoDn;
+    u1_t        nwkKey[16];
+    u1_t        artKey[16];
+
+    // Channel plan
+#if CFG_LMIC_EU_like
+    band_t      bands[MAX_BANDS];
+    u4_t        channelFreq[MAX_CHANNELS];
+#if !defined(DISABLE_MCMD_DlChannelReq)
+    u4_t        channelDlFreq[MAX_CHANNELS];
+#endif
+    u2_t        channelDrMap[MAX_CHANNELS];
+    u2_t        channelMap;
+#elif CFG_LMIC_US_like
+    u4_t        xchFreq[MAX_XCHANNELS];
+    u2_t        xchDrMap[MAX_XCHANNELS];
+    u2_t        channelMap[(72+MAX_XCHANNELS+15)/16];
+    u2_t        activeChannels125khz;
+    u2_t        activeChannels500khz;
+#endif
+
+    // ADR state
+    s2_t        adrAckReq;
+    u1_t        datarate;
+    s1_t        adrTxPow;
+    s1_t        txpow;
+    u1_t        adrEnabled;
+    u1_t        upRepeat;
+#if LMIC_ENABLE_TxParamSetupReq
+    u1_t        txParam;
+#endif
+
+    // RX parameters
+    u4_t        dn2Freq;
+    u1_t        dn2Dr;
+    u1_t        rx1DrOffset;
+    u1_t        rxDelay;
+
+    // Duty cycle (remaining ticks at the time of the snapshot)
+    u1_t        globalDutyRate;
+    ostime_t    globalDutyAvail;
+
+    // Wall clock time of the snapshot (in µs)
+    int64_t     savedAt;
+
+    uint16_t    checksum;
+};
+
+
+/**
+ * @brief Saves and restores the LoRaWAN session.
+ * 
+ * The session is kept in RTC memory and therefore survives deep sleep
+ * but not a power loss. The stored data is protected by a version number
+ * and a checksum.
+ * 
+ * To survive a power loss, the session is additionally saved in NVS after
+ * a join. As writing the frame counter to flash after each uplink would
+ * wear out the flash, an upper limit for the uplink frame counter is saved
+ * instead. It is advanced in steps of CONFIG_TTN_FCNT_NVS_STRIDE. When the
+ * session is restored from NVS, the counter continues at the saved limit,
+ * so it never goes backwards.
+ * 
+ * ABP sessions are handled the same way. They are only created from scratch
+ * if no saved session with the same device address and keys exists.
+ * 
+ * This class is not to be used directly.
+ */
+class TTNSession
+{
+public:
+    void save();
+    bool restore();
+    void invalidate();
+    bool isValid();
+
+    bool snapshot(TTNSessionData* data);
+
+    void persistSession(TTNProvisioning& provisioning, const TTNSessionData& data);
+    void persistFrameCounter(TTNProvisioning& provisioning, const TTNSessionData& data);
+    bool restoreFromNvs(TTNProvisioning& provisioning);
+    bool personalize(TTNProvisioning& provisioning, devaddr_t devaddr, const u1_t* nwkKey, const u1_t* artKey);
+
+private:
+    bool loadFromNvs(TTNProvisioning& provisioning, TTNSessionData* data);
+    bool resumeFromNvs(TTNProvisioning& provisioning, TTNSessionData* data);
+    bool saveFrameCounterLimit(TTNProvisioning& provisioning, uint32_t limit);
+
+    static bool isSessionFor(const TTNSessionData& data, devaddr_t devaddr, const u1_t* nwkKey, const u1_t* artKey);
+
+    static uint16_t calculateChecksum(const TTNSessionData* data);
+    static ostime_t remainingTicks(ostime_t avail, ostime_t now);
+    static int64_t wallClockTime();
+};
+
+#endif
@@ -10,14 +10,20 @@
  * High-level API for ttn-esp32.
  *******************************************************************************/
 
+#include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "hal/hal_esp32.h"
 #include "lmic/lmic.h"
 #include "TheThingsNetwork.h"
 #include "TTNProvisioning.h"
 #include "TTNLogging.h"
+#include "TTNSession.h"
+#include "TTNEventRing.h"
+#include "TTNClockCalibration.h"
 
 
 /**
@@ -37,8 +43,8 @@ enum TTNEvent {
     eEvtNone,
     eEvtJoinCompleted,
     eEvtJoinFailed,
-    eEvtMessageReceived,
     eEvtTransmissionCompleted,
+    eEvtTransmissionUnacknowledged,
     eEvtTransmissionFailed
 };
 
@@ -49,26 +55,74 @@ struct TTNLmicEvent {
     TTNLmicEvent(TTNEvent ev = eEvtNone): event(ev) { }
 
     TTNEvent event;
-    uint8_t port;
-    const uint8_t* message;
-    size_t messageSize;
 };
 
+/**
+ * @brief Downlink message copied from the LMIC frame buffer
+ * 
+ * The LMIC frame buffer is overwritten by the next radio operation.
+ * Therefore, received messages are copied into a slot of a fixed pool
+ * and handed over to the downlink task.
+ */
+struct TTNDownlink {
+    port_t port;
+    uint8_t length;
+    ostime_t rxTime;
+    uint8_t payload[MAX_LEN_PAYLOAD];
+};
+
+static_assert(kTTNLogRadio == LMIC_LOG_RADIO && kTTNLogRx == LMIC_LOG_RX && kTTNLogTx == LMIC_LOG_TX
+    && kTTNLogMac == LMIC_LOG_MAC && kTTNLogChannel == LMIC_LOG_CHANNEL && kTTNLogEvent == LMIC_LOG_EVENT,
+    "log categories must match LMIC");
+
 static const char *TAG = "ttn";
 
 static TheThingsNetwork* ttnInstance;
-static QueueHandle_t lmicEventQueue = nullptr;
+static TTNEventRing<TTNLmicEvent, 8> lmicEvents;
+static TTNDownlink downlinkPool[CONFIG_TTN_DOWNLINK_POOL_SIZE];
+static QueueHandle_t freeDownlinkQueue = nullptr;
+static QueueHandle_t downlinkQueue = nullptr;
+static TTNDownlinkStats downlinkStats;
 static TTNWaitingReason waitingReason = eWaitingNone;
 static TTNProvisioning provisioning;
+static TTNSession session;
+static TTNJoinPolicy joinPolicy = { 0, TTN_JOIN_DR_LAST, 60, 3600 };
+static TTNJoinStats joinStats;
+static TTNConfirmPolicy confirmPolicy = { 8, 1000, 16000, true };
+static TTNConfirmStats confirmStats;
+static TTNClassBStats classBStats;
+static uint64_t rxOnTimeUs;
+static int64_t beaconScanStart; // 0 if not scanning for a beacon
+static bool classCEnabled = false;
+// Kept during deep sleep for the retry backoff and the start data rate of the next join
+RTC_DATA_ATTR static uint32_t rtcFailedJoins = 0;
+RTC_DATA_ATTR static int8_t rtcJoinDataRate = TTN_JOIN_DR_LAST;
+static const char* const NVS_FLASH_KEY_JOIN_DR = "joinDr";
+// Set if the system clock has been set to the network time (kept during deep sleep)
+RTC_DATA_ATTR static bool rtcTimeSynchronized = false;
+
+// Seconds between the Unix epoch (1970-01-01) and the GPS epoch (1980-01-06)
+#define GPS_EPOCH_OFFSET 315964800
+// Leap seconds between GPS time and UTC (since 2017-01-01)
+#define GPS_UTC_LEAP_SECONDS 18
 #if LMIC_ENABLE_event_logging
 static TTNLogging* logging;
 #endif
+#if LMIC_ENABLE_clock_calibration
+static TTNClockCalibration* clockCalibration;
+#endif
 
-RTC_DATA_ATTR static struct lmic_t TheThingsNetwork_Backup;
 static void eventCallback(void* userData, ev_t event);
 static void messageReceivedCallback(void *userData, uint8_t port, const uint8_t *message, size_t messageSize);
 static void messageTransmittedCallback(void *userData, int success);
-static void TheThingsNetwork_CopyLmicData(struct lmic_t* source, struct lmic_t* destination);
+static void networkTimeCallback(void *userData, int success);
+static void accountRxWindow();
+static void endBeaconScan();
+static uint32_t backoffDelay(uint32_t minDelay, uint32_t maxDelay, uint32_t count);
+static bool sessionSnapshot(TTNSessionData* data);
+#if defined(CONFIG_TTN_RADIO_TIMING)
+static void printHistogram(const char* title, const TTNHistogram* histogram);
+#endif
 
 TheThingsNetwork::TheThingsNetwork()
     : messageCallback(nullptr)
@@ -102,21 +156,36 @@ void TheThingsNetwork::configurePins(spi_host_device_t spi_host, uint8_t nss, ui
     os_init_ex(nullptr);
     reset();
 
-    lmicEventQueue = xQueueCreate(4, sizeof(TTNLmicEvent));
-    ASSERT(lmicEventQueue != nullptr);
+#if LMIC_ENABLE_clock_calibration
+    clockCalibration = TTNClockCalibration::initInstance();
+#endif
+
+    // Both downlink queues can hold all pool slots, so sending to them never fails
+    freeDownlinkQueue = xQueueCreate(CONFIG_TTN_DOWNLINK_POOL_SIZE, sizeof(TTNDownlink*));
+    ASSERT(freeDownlinkQueue != nullptr);
+    downlinkQueue = xQueueCreate(CONFIG_TTN_DOWNLINK_POOL_SIZE, sizeof(TTNDownlink*));
+    ASSERT(downlinkQueue != nullptr);
+    for (int i = 0; i < CONFIG_TTN_DOWNLINK_POOL_SIZE; i++)
+    {
+        TTNDownlink* slot = &downlinkPool[i];
+        xQueueSend(freeDownlinkQueue, &slot, 0);
+    }
+    xTaskCreate(downlinkTask, "ttn_downlink", 1024 * 3, this, CONFIG_TTN_DOWNLINK_TASK_PRIO, nullptr);
+
     ttn_hal.startLMICTask();
 }
 
 void TheThingsNetwork::reset()
 {
-    ttn_hal.enterCriticalSection();
-    LMIC_reset();
-    waitingReason = eWaitingNone;
-    if (lmicEventQueue != nullptr)
-    {
-        xQueueReset(lmicEventQueue);
-    }
-    ttn_hal.leaveCriticalSection();
+    ttn_hal.execute([] {
+        LMIC_reset();
+        LMIC.classC = classCEnabled;
+        waitingReason = eWaitingNone;
+        classBStats.beaconLocked = false;
+        beaconScanStart = 0;
+    });
+    // No more events are posted as nothing is waiting
+    lmicEvents.drain();
 }
 
 bool TheThingsNetwork::provision(const char *devEui, const char *appEui, const char *appKey)
@@ -135,6 +204,14 @@ bool TheThingsNetwork::provisionWithMAC(const char *appEui, const char *appKey)
     return provisioning.saveKeys();
 }
 
+bool TheThingsNetwork::provisionABP(const char *devAddr, const char *nwkSKey, const char *appSKey)
+{
+    if (!provisioning.decodeABPKeys(devAddr, nwkSKey, appSKey))
+        return false;
+
+    return provisioning.saveABPKeys();
+}
+
 
 void TheThingsNetwork::startProvisioningTask()
 {
@@ -186,6 +263,46 @@ bool TheThingsNetwork::join()
     return joinCore();
 }
 
+bool TheThingsNetwork::personalize()
+{
+    if (!provisioning.haveABPKeys() && !provisioning.restoreABPKeys(false))
+    {
+        ESP_LOGW(TAG, "Device address and/or session keys have not been provided");
+        return false;
+    }
+
+    uint32_t devAddr;
+    uint8_t nwkSKey[16];
+    uint8_t appSKey[16];
+    provisioning.getABPKeys(&devAddr, nwkSKey, appSKey);
+
+    bool result;
+    ttn_hal.execute([&] {
+        result = session.personalize(provisioning, devAddr, nwkSKey, appSKey);
+    });
+
+    return result;
+}
+
+bool TheThingsNetwork::resumeAfterDeepSleep()
+{
+    // The keys are needed if the network requires a new join later
+    if (!provisioning.haveKeys())
+        provisioning.restoreKeys(true);
+
+    bool restored;
+    ttn_hal.execute([&] {
+        restored = session.restore();
+        if (!restored)
+            restored = session.restoreFromNvs(provisioning);
+    });
+
+    if (!restored)
+        ESP_LOGI(TAG, "No valid session to resume");
+
+    return restored;
+}
+
 bool TheThingsNetwork::joinCore()
 {
     if (!provisioning.haveKeys())
@@ -194,49 +311,107 @@ bool TheThingsNetwork::joinCore()
         return false;
     }
 
-    ttn_hal.enterCriticalSection();
-    waitingReason = eWaitingForJoin;
-    LMIC_startJoining();
-    ttn_hal.wakeUp();
-    ttn_hal.leaveCriticalSection();
+    int8_t dataRate = joinPolicy.startDataRate;
+    if (dataRate == TTN_JOIN_DR_LAST)
+    {
+        if (rtcJoinDataRate == TTN_JOIN_DR_LAST)
+            provisioning.restoreData(NVS_FLASH_KEY_JOIN_DR, &rtcJoinDataRate, sizeof(rtcJoinDataRate));
+        dataRate = rtcJoinDataRate;
+    }
+
+    memset(&joinStats, 0, sizeof(joinStats));
+    int64_t startTime = esp_timer_get_time();
+
+    ttn_hal.execute([&] {
+        session.invalidate();
+        waitingReason = eWaitingForJoin;
+        LMIC_startJoining();
+        // Overrides the data rate set up for the first join request
+        if (dataRate >= 0)
+            LMIC.datarate = dataRate;
+    });
 
     TTNLmicEvent event;
-    xQueueReceive(lmicEventQueue, &event, portMAX_DELAY);
-    return event.event == eEvtJoinCompleted;
+    TickType_t timeout = joinPolicy.timeout != 0 ? pdMS_TO_TICKS(joinPolicy.timeout) : portMAX_DELAY;
+    if (!lmicEvents.receive(&event, timeout))
+    {
+        ESP_LOGW(TAG, "Join timed out after %u join requests", joinStats.attempts);
+        reset(); // stops joining
+        session.invalidate();
+        event.event = eEvtJoinFailed;
+    }
+
+    joinStats.duration = (uint32_t)((esp_timer_get_time() - startTime) / 1000);
+
+    if (event.event != eEvtJoinCompleted)
+    {
+        rtcFailedJoins++;
+        joinStats.failedJoins = rtcFailedJoins;
+        return false;
+    }
+
+    rtcFailedJoins = 0;
+    rtcJoinDataRate = joinStats.dataRate;
+    provisioning.saveData(NVS_FLASH_KEY_JOIN_DR, &rtcJoinDataRate, sizeof(rtcJoinDataRate));
+    ESP_LOGI(TAG, "Joined after %u ms and %u join requests (DR%u, RSSI %d dBm, SNR %d dB)",
+        joinStats.duration, joinStats.attempts, joinStats.dataRate, joinStats.rssi, joinStats.snr);
+
+    TTNSessionData sessionData;
+    if (sessionSnapshot(&sessionData))
+        session.persistSession(provisioning, sessionData);
+    return true;
 }
 
 TTNResponseCode TheThingsNetwork::transmitMessage(const uint8_t *payload, size_t length, port_t port, bool confirm)
 {
-    ttn_hal.enterCriticalSection();
-    if (waitingReason != eWaitingNone || (LMIC.opmode & OP_TXRXPEND) != 0)
-    {
-        ttn_hal.leaveCriticalSection();
-        return kTTNErrorTransmissionFailed;
-    }
+    int64_t startTime = esp_timer_get_time();
+    bool busy;
+    ttn_hal.execute([&] {
+        busy = waitingReason != eWaitingNone || (LMIC.opmode & OP_TXRXPEND) != 0;
+        if (busy)
+            return;
 
-    waitingReason = eWaitingForTransmission;
-    LMIC.client.txMessageCb = messageTransmittedCallback;
-    LMIC.client.txMessageUserData = nullptr;
-    LMIC_setTxData2(port, (xref2u1_t)payload, length, confirm);
-    ttn_hal.wakeUp();
-    ttn_hal.leaveCriticalSection();
+        if (confirm)
+            memset(&confirmStats, 0, sizeof(confirmStats));
+
+        waitingReason = eWaitingForTransmission;
+        LMIC.client.txMessageCb = messageTransmittedCallback;
+        LMIC.client.txMessageUserData = nullptr;
+        // Retransmissions of confirmed messages are scheduled here, not by LMIC
+        LMIC.txConfAttempts = 1;
+        LMIC_setTxData2(port, (xref2u1_t)payload, length, confirm);
+    });
+    if (busy)
+        return kTTNErrorTransmissionFailed;
 
+    uint8_t attempt = 1;
     while (true)
     {
         TTNLmicEvent result;
-        xQueueReceive(lmicEventQueue, &result, portMAX_DELAY);
+        lmicEvents.receive(&result);
+        TTNSessionData sessionData;
+        if (sessionSnapshot(&sessionData))
+            session.persistFrameCounter(provisioning, sessionData);
 
         switch (result.event)
         {
-            case eEvtMessageReceived:
-                if (messageCallback != nullptr)
-                    messageCallback(result.message, result.messageSize, result.port);
-                break;
-
             case eEvtTransmissionCompleted:
-                TheThingsNetwork_CopyLmicData(&LMIC, &TheThingsNetwork_Backup);
+                if (confirm)
+                {
+                    confirmStats.acknowledged = true;
+                    confirmStats.duration = (uint32_t)((esp_timer_get_time() - startTime) / 1000);
+                    ESP_LOGI(TAG, "Message acknowledged after %u transmissions (DR%u, RSSI %d dBm, SNR %d dB)",
+                        confirmStats.attempts, confirmStats.dataRate, confirmStats.rssi, confirmStats.snr);
+                }
                 return kTTNSuccessfulTransmission;
 
+            case eEvtTransmissionUnacknowledged:
+                if (attempt < confirmPolicy.maxAttempts && retransmitMessage(++attempt))
+                    continue;
+                confirmStats.duration = (uint32_t)((esp_timer_get_time() - startTime) / 1000);
+                ESP_LOGW(TAG, "Message not acknowledged after %u transmissions", confirmStats.attempts);
+                return kTTNErrorTransmissionFailed;
+
             case eEvtTransmissionFailed:
                 return kTTNErrorTransmissionFailed;
 
@@ -246,11 +421,397 @@ TTNResponseCode TheThingsNetwork::transmitMessage(const uint8_t *payload, size_t
     }
 }
 
+bool TheThingsNetwork::retransmitMessage(uint8_t attempt)
+{
+    uint32_t delay = backoffDelay(confirmPolicy.minRetryDelay, confirmPolicy.maxRetryDelay, attempt - 1);
+    ESP_LOGI(TAG, "No acknowledgement, retransmitting in %u ms", delay);
+    vTaskDelay(pdMS_TO_TICKS(delay));
+
+    lmic_tx_error_t err;
+    ttn_hal.execute([&] {
+        waitingReason = eWaitingForTransmission;
+        LMIC.client.txMessageCb = messageTransmittedCallback;
+        LMIC.client.txMessageUserData = nullptr;
+        // Lower the data rate before the 3rd, 5th, 7th etc. transmission
+        if (confirmPolicy.dataRateFallback && (attempt & 1) != 0)
+            LMIC_setDrTxpow(decDR(LMIC.datarate), KEEP_TXPOW);
+        err = LMIC_retransmitTxData(attempt);
+        if (err != 0)
+        {
+            // The transmission has not been started
+            LMIC.client.txMessageCb = nullptr;
+            waitingReason = eWaitingNone;
+        }
+    });
+
+    if (err != 0)
+    {
+        lmicEvents.drain();
+        ESP_LOGW(TAG, "Retransmission failed (error %d)", err);
+    }
+    return err == 0;
+}
+
 void TheThingsNetwork::onMessage(TTNMessageCallback callback)
 {
     messageCallback = callback;
 }
 
+void TheThingsNetwork::setJoinPolicy(const TTNJoinPolicy& policy)
+{
+    joinPolicy = policy;
+}
+
+TTNJoinStats TheThingsNetwork::getJoinStats()
+{
+    return joinStats;
+}
+
+uint32_t TheThingsNetwork::getJoinRetryDelay()
+{
+    if (rtcFailedJoins == 0)
+        return 0;
+
+    return backoffDelay(joinPolicy.minRetryDelay, joinPolicy.maxRetryDelay, rtcFailedJoins);
+}
+
+void TheThingsNetwork::setConfirmPolicy(const TTNConfirmPolicy& policy)
+{
+    confirmPolicy = policy;
+}
+
+TTNConfirmStats TheThingsNetwork::getConfirmStats()
+{
+    return confirmStats;
+}
+
+TTNDownlinkStats TheThingsNetwork::getDownlinkStats()
+{
+    ttn_hal.enterCriticalSection();
+    TTNDownlinkStats stats = downlinkStats;
+    ttn_hal.leaveCriticalSection();
+    return stats;
+}
+
+TTNEventStats TheThingsNetwork::getEventStats()
+{
+    TTNEventStats stats;
+    stats.overflows = lmicEvents.overflows();
+    stats.maxUsage = lmicEvents.maxUsage();
+    return stats;
+}
+
+TTNSyncStats TheThingsNetwork::getSyncStats()
+{
+    ttn_hal.enterCriticalSection();
+    TTNSyncStats stats = ttn_hal.syncStats;
+    ttn_hal.leaveCriticalSection();
+    return stats;
+}
+
+// Task delivering received messages to the message callback
+void TheThingsNetwork::downlinkTask(void* param)
+{
+    TheThingsNetwork* ttn = (TheThingsNetwork*)param;
+    uint32_t reportedPoolExhausted = 0;
+
+    while (true)
+    {
+        TTNDownlink* downlink;
+        if (!xQueueReceive(downlinkQueue, &downlink, portMAX_DELAY))
+            continue;
+
+        uint32_t latency = osticks2ms(os_getTime() - downlink->rxTime);
+        ttn_hal.enterCriticalSection();
+        downlinkStats.lastLatency = latency;
+        if (latency > downlinkStats.maxLatency)
+            downlinkStats.maxLatency = latency;
+        ttn_hal.leaveCriticalSection();
+
+        TTNMessageCallback callback = ttn->messageCallback;
+        if (callback != nullptr)
+            callback(downlink->payload, downlink->length, downlink->port);
+
+        ttn_hal.enterCriticalSection();
+        downlinkStats.delivered++;
+        uint32_t poolExhausted = downlinkStats.poolExhausted;
+        ttn_hal.leaveCriticalSection();
+        xQueueSend(freeDownlinkQueue, &downlink, 0);
+
+        // Messages dropped in the meantime are reported here, not in the LMIC task.
+        // The pool is only exhausted while this task is busy with messages.
+        if (poolExhausted != reportedPoolExhausted)
+        {
+            ESP_LOGW(TAG, "Downlink pool exhausted, %u message(s) dropped", poolExhausted - reportedPoolExhausted);
+            reportedPoolExhausted = poolExhausted;
+        }
+    }
+}
+
+void TheThingsNetwork::dumpEventTrace()
+{
+#if LMIC_ENABLE_event_logging
+    logging->dumpTrace();
+#else
+    ESP_LOGW(TAG, "LMIC event logging is disabled. Enable it using 'make menuconfig'");
+#endif
+}
+
+void TheThingsNetwork::setEventLogFilter(uint8_t categories)
+{
+#if LMIC_ENABLE_event_logging
+    LMICOS_logMask = categories;
+#endif
+}
+
+void TheThingsNetwork::setEventLogSampling(TTNLogCategory category, uint8_t rate)
+{
+#if LMIC_ENABLE_event_logging
+    logging->setSampling(category, rate);
+#endif
+}
+
+TTNRadioTimingStats TheThingsNetwork::getRadioTimingStats()
+{
+#if defined(CONFIG_TTN_RADIO_TIMING)
+    ttn_hal.enterCriticalSection();
+    TTNRadioTimingStats stats = ttn_hal.timingStats;
+    ttn_hal.leaveCriticalSection();
+    return stats;
+#else
+    ESP_LOGW(TAG, "Radio timing statistics are disabled. Enable them using 'make menuconfig'");
+    TTNRadioTimingStats stats = { };
+    return stats;
+#endif
+}
+
+void TheThingsNetwork::resetRadioTimingStats()
+{
+#if defined(CONFIG_TTN_RADIO_TIMING)
+    ttn_hal.execute([] {
+        ttn_hal.resetTimingStats();
+    });
+#endif
+}
+
+void TheThingsNetwork::dumpRadioTimingStats()
+{
+#if defined(CONFIG_TTN_RADIO_TIMING)
+    TTNRadioTimingStats stats = getRadioTimingStats();
+    printHistogram("IRQ latency", &stats.irqLatency);
+    printHistogram("RX start error", &stats.rxStartError);
+    printHistogram("RX margin", &stats.rxMargin);
+    printHistogram("Timer latency", &stats.timerLatency);
+#else
+    ESP_LOGW(TAG, "Radio timing statistics are disabled. Enable them using 'make menuconfig'");
+#endif
+}
+
+TTNRadioSpiStats TheThingsNetwork::getRadioSpiStats()
+{
+    oslmic_radio_spi_stats_t spiStats;
+    ttn_hal.enterCriticalSection();
+    radio_getSpiStats(&spiStats);
+    ttn_hal.leaveCriticalSection();
+
+    TTNRadioSpiStats stats;
+    stats.transactions = spiStats.transactions;
+    stats.bytes = spiStats.bytes;
+    stats.writesSkipped = spiStats.writesSkipped;
+    stats.readsSkipped = spiStats.readsSkipped;
+    return stats;
+}
+
+TTNSchedulerStats TheThingsNetwork::getSchedulerStats()
+{
+    oslmic_scheduler_stats_t schedulerStats;
+    ttn_hal.enterCriticalSection();
+    os_getSchedulerStats(&schedulerStats);
+    ttn_hal.leaveCriticalSection();
+
+    TTNSchedulerStats stats;
+    stats.immediateJobs = schedulerStats.runnableJobs;
+    stats.timedJobs = schedulerStats.timedJobs;
+    stats.cancelledJobs = schedulerStats.cancelled;
+    stats.rescheduledJobs = schedulerStats.rescheduled;
+    stats.queuedJobs = schedulerStats.queued;
+    stats.maxQueuedJobs = schedulerStats.maxQueued;
+    stats.maxLateness = osticks2us(schedulerStats.maxLateness);
+    stats.maxLatenessJob = (const void*)schedulerStats.maxLatenessFunc;
+    static_assert(sizeof(stats.lateness) == sizeof(schedulerStats.lateness), "lateness histogram size mismatch");
+    memcpy(stats.lateness, schedulerStats.lateness, sizeof(stats.lateness));
+    return stats;
+}
+
+void TheThingsNetwork::resetSchedulerStats()
+{
+    ttn_hal.execute([] {
+        os_resetSchedulerStats();
+    });
+}
+
+void TheThingsNetwork::dumpSchedulerStats()
+{
+    TTNSchedulerStats stats = getSchedulerStats();
+    printf("Scheduler: %u immediate jobs, %u timed jobs, %u cancelled, %u rescheduled, %u queued (max %u)\n",
+        stats.immediateJobs, stats.timedJobs, stats.cancelledJobs, stats.rescheduledJobs,
+        stats.queuedJobs, stats.maxQueuedJobs);
+    if (stats.timedJobs != 0)
+        printf("Job lateness (us): max=%d (job %p)\n", stats.maxLateness, stats.maxLatenessJob);
+
+    const int numBuckets = sizeof(stats.lateness) / sizeof(stats.lateness[0]);
+    for (int i = 0; i < numBuckets; i++)
+    {
+        if (stats.lateness[i] == 0)
+            continue;
+        if (i == 0)
+            printf("  on time: %u\n", stats.lateness[i]);
+        else if (i == numBuckets - 1)
+            printf("  >= %d: %u\n", (int)osticks2us(1 << (i - 1)), stats.lateness[i]);
+        else
+            printf("  %d - %d: %u\n", (int)osticks2us(1 << (i - 1)), (int)osticks2us(1 << i), stats.lateness[i]);
+    }
+
+    oslmic_job_info_t jobs[8];
+    ttn_hal.enterCriticalSection();
+    int numJobs = os_queryJobs(jobs, sizeof(jobs) / sizeof(jobs[0]));
+    ostime_t now = os_getTime();
+    ttn_hal.leaveCriticalSection();
+    for (int i = 0; i < numJobs; i++)
+    {
+        if (jobs[i].deadline == 0)
+            printf("  job %p: immediate\n", (const void*)jobs[i].func);
+        else
+            printf("  job %p: due in %d us\n", (const void*)jobs[i].func, (int)osticks2us(jobs[i].deadline - now));
+    }
+}
+
+TTNLightSleepStats TheThingsNetwork::getLightSleepStats()
+{
+#if defined(CONFIG_TTN_LIGHT_SLEEP)
+    ttn_hal.enterCriticalSection();
+    TTNLightSleepStats stats = ttn_hal.lightSleepStats;
+    ttn_hal.leaveCriticalSection();
+    return stats;
+#else
+    ESP_LOGW(TAG, "Light sleep is disabled. Enable it using 'make menuconfig'");
+    TTNLightSleepStats stats = { };
+    return stats;
+#endif
+}
+
+void TheThingsNetwork::setTemperature(int8_t temperature)
+{
+#if LMIC_ENABLE_clock_calibration
+    ttn_hal.execute([&] {
+        clockCalibration->setTemperature(temperature);
+    });
+#endif
+}
+
+TTNClockCalibrationStats TheThingsNetwork::getClockCalibrationStats()
+{
+#if LMIC_ENABLE_clock_calibration
+    ttn_hal.enterCriticalSection();
+    TTNClockCalibrationStats stats = clockCalibration->getStats();
+    ttn_hal.leaveCriticalSection();
+    return stats;
+#else
+    ESP_LOGW(TAG, "Clock error calibration is disabled. Enable it using 'make menuconfig'");
+    TTNClockCalibrationStats stats = { };
+    return stats;
+#endif
+}
+
+void TheThingsNetwork::requestNetworkTime()
+{
+    ttn_hal.execute([] {
+        LMIC_requestNetworkTime(networkTimeCallback, nullptr);
+    });
+}
+
+bool TheThingsNetwork::isTimeSynchronized()
+{
+    return rtcTimeSynchronized;
+}
+
+bool TheThingsNetwork::startClassB(uint8_t periodicity)
+{
+#if !defined(DISABLE_PING)
+    bool started;
+    ttn_hal.execute([&] {
+        started = LMIC.devaddr != 0 && waitingReason == eWaitingNone
+            && (LMIC.opmode & (OP_JOINING | OP_TXRXPEND)) == 0;
+        if (!started)
+            return;
+
+        // Implicitly starts the beacon scan
+        LMIC_setPingable(periodicity);
+        if ((LMIC.opmode & OP_SCAN) != 0 && beaconScanStart == 0)
+            beaconScanStart = esp_timer_get_time();
+    });
+
+    if (!started)
+        ESP_LOGW(TAG, "Class B requires a joined device that is not busy");
+    return started;
+#else
+    ESP_LOGE(TAG, "Class B is disabled. Change the configuration using 'make menuconfig'");
+    return false;
+#endif
+}
+
+void TheThingsNetwork::stopClassB()
+{
+#if !defined(DISABLE_PING)
+    ttn_hal.execute([] {
+        endBeaconScan();
+        classBStats.beaconLocked = false;
+        if ((LMIC.opmode & (OP_SCAN | OP_TRACK | OP_PINGABLE | OP_PINGINI)) == 0)
+            return; // Class B is not active
+
+        // Cancel a beacon scan or a scheduled beacon or ping slot reception.
+        // Otherwise the job belongs to a join, an uplink or Class C and is kept.
+        if ((LMIC.opmode & (OP_SCAN | OP_TRACK | OP_PINGINI)) != 0
+                && (LMIC.opmode & (OP_JOINING | OP_REJOIN | OP_TXRXPEND | OP_TXDATA | OP_POLL)) == 0)
+        {
+            os_radio(RADIO_RST);
+            os_clearCallback(&LMIC.osjob);
+        }
+        LMIC_stopPingable();
+        // Runs the MAC engine, which restarts Class C reception if enabled
+        LMIC_disableTracking();
+    });
+#endif
+}
+
+void TheThingsNetwork::setClassC(bool enabled)
+{
+    ttn_hal.execute([&] {
+        classCEnabled = enabled;
+        if (LMIC.devaddr != 0)
+        {
+            LMIC_setClassC(enabled);
+        }
+        else
+        {
+            // Takes effect after the join
+            LMIC.classC = enabled;
+        }
+    });
+}
+
+bool TheThingsNetwork::isClassC()
+{
+    return classCEnabled;
+}
+
+TTNClassBStats TheThingsNetwork::getClassBStats()
+{
+    TTNClassBStats stats = classBStats;
+    stats.rxOnTime = (uint32_t)(rxOnTimeUs / 1000);
+    return stats;
+}
+
 
 bool TheThingsNetwork::isProvisioned()
 {
@@ -267,6 +828,11 @@ void TheThingsNetwork::setRSSICal(int8_t rssiCal)
     ttn_hal.rssiCal = rssiCal;
 }
 
+uint32_t TheThingsNetwork::nvsWriteCount()
+{
+    return TTNProvisioning::nvsWriteCount();
+}
+
 
 // --- Callbacks ---
 
@@ -279,18 +845,55 @@ const char *eventNames[] = { LMIC_EVENT_NAME_TABLE__INIT };
 void eventCallback(void* userData, ev_t event)
 {
 #if LMIC_ENABLE_event_logging
-    logging->logEvent(event, eventNames[event], 0);
+    if (LMICOS_logEnabled(LMIC_LOG_EVENT) && logging->sample(LMIC_LOG_EVENT))
+        logging->logEvent(event, eventNames[event], 0);
 #elif CONFIG_LOG_DEFAULT_LEVEL >= 3
     ESP_LOGI(TAG, "event %s", eventNames[event]);
 #endif
 
+    if (event == EV_RXSTART)
+        accountRxWindow();
+
+#if !defined(DISABLE_BEACONS)
+    switch (event)
+    {
+        case EV_BEACON_FOUND:
+            endBeaconScan();
+            classBStats.beaconLocked = true;
+            classBStats.beaconsReceived++;
+            break;
+        case EV_BEACON_TRACKED:
+            classBStats.beaconsReceived++;
+            break;
+        case EV_BEACON_MISSED:
+            classBStats.beaconsMissed++;
+            break;
+        case EV_SCAN_TIMEOUT:
+            endBeaconScan();
+            break;
+        case EV_LOST_TSYNC:
+            classBStats.beaconLocked = false;
+            classBStats.syncLost++;
+            break;
+        default:
+            break;
+    }
+#endif
+
     TTNEvent ttnEvent = eEvtNone;
 
     if (waitingReason == eWaitingForJoin)
     {
-        if (event == EV_JOINED)
+        if (event == EV_TXSTART)
         {
-            TheThingsNetwork_CopyLmicData(&TheThingsNetwork_Backup, &LMIC);
+            joinStats.attempts++;
+            joinStats.dataRate = LMIC.dndr;
+        }
+        else if (event == EV_JOINED)
+        {
+            joinStats.rssi = LMIC.rssi - RSSI_OFF;
+            joinStats.snr = LMIC.snr / SNR_SCALEUP;
+            session.save();
             ttnEvent = eEvtJoinCompleted;
         }
         else if (event == EV_REJOIN_FAILED || event == EV_RESET)
@@ -298,36 +901,181 @@ void eventCallback(void* userData, ev_t event)
             ttnEvent = eEvtJoinFailed;
         }
     }
+    else if (waitingReason == eWaitingForTransmission && event == EV_TXSTART && LMIC.pendTxConf)
+    {
+        confirmStats.attempts++;
+        confirmStats.dataRate = LMIC.dndr;
+        confirmStats.airtime += osticks2ms(calcAirTime(LMIC.rps, LMIC.dataLen));
+    }
 
     if (ttnEvent == eEvtNone)
         return;
 
     TTNLmicEvent result(ttnEvent);
     waitingReason = eWaitingNone;
-    xQueueSend(lmicEventQueue, &result, pdMS_TO_TICKS(100));
+    if (!lmicEvents.post(result))
+        ESP_LOGW(TAG, "LMIC event dropped");
 }
 
 // Called by LMIC when a message has been received
+// The message is copied into a free slot of the downlink pool. This never blocks the LMIC task.
 void messageReceivedCallback(void *userData, uint8_t port, const uint8_t *message, size_t nMessage)
 {
-    TTNLmicEvent result(eEvtMessageReceived);
-    result.port = port;
-    result.message = message;
-    result.messageSize = nMessage;
-    xQueueSend(lmicEventQueue, &result, pdMS_TO_TICKS(100));
+    if ((LMIC.txrxFlags & TXRX_PING) != 0)
+        classBStats.pingDownlinks++;
+
+    TTNDownlink* downlink;
+    bool haveBuffer = xQueueReceive(freeDownlinkQueue, &downlink, 0);
+    if (haveBuffer)
+    {
+        downlink->port = port;
+        downlink->length = nMessage;
+        downlink->rxTime = LMIC.rxtime;
+        memcpy(downlink->payload, message, nMessage);
+        xQueueSend(downlinkQueue, &downlink, 0);
+    }
+
+    // The drop is only counted here and reported by the downlink task
+    ttn_hal.enterCriticalSection();
+    downlinkStats.received++;
+    if (LMIC.classCRxOn)
+        downlinkStats.receivedClassC++;
+    if (!haveBuffer)
+        downlinkStats.poolExhausted++;
+    uint32_t inUse = CONFIG_TTN_DOWNLINK_POOL_SIZE - uxQueueMessagesWaiting(freeDownlinkQueue);
+    if (inUse > downlinkStats.peakInUse)
+        downlinkStats.peakInUse = inUse;
+    ttn_hal.leaveCriticalSection();
 }
 
 // Called by LMIC when a message has been transmitted (or the transmission failed)
 void messageTransmittedCallback(void *userData, int success)
 {
+    // The frame counter has been used, even if the transmission failed
+    session.save();
+
+    TTNEvent ttnEvent = eEvtTransmissionCompleted;
+    if (!success)
+    {
+        // Unacknowledged confirmed messages can be retransmitted, messages that are too long cannot
+        bool nack = (LMIC.txrxFlags & (TXRX_NACK | TXRX_LENERR)) == TXRX_NACK;
+        ttnEvent = nack ? eEvtTransmissionUnacknowledged : eEvtTransmissionFailed;
+    }
+    else if (LMIC.pendTxConf)
+    {
+        confirmStats.rssi = LMIC.rssi - RSSI_OFF;
+        confirmStats.snr = LMIC.snr / SNR_SCALEUP;
+    }
+
     waitingReason = eWaitingNone;
-    TTNLmicEvent result(success ? eEvtTransmissionCompleted : eEvtTransmissionFailed);
-    xQueueSend(lmicEventQueue, &result, pdMS_TO_TICKS(100));
+    TTNLmicEvent result(ttnEvent);
+    if (!lmicEvents.post(result))
+        ESP_LOGW(TAG, "LMIC event dropped");
+}
+
+// Exponential backoff: the delay doubles with each count, starting at the
+// minimum delay, limited to the maximum delay, with up to 25% random jitter
+uint32_t backoffDelay(uint32_t minDelay, uint32_t maxDelay, uint32_t count)
+{
+    uint32_t delay = minDelay;
+    for (uint32_t i = 1; i < count && delay < maxDelay; i++)
+        delay *= 2;
+    if (delay > maxDelay)
+        delay = maxDelay;
+    return delay + esp_random() % (delay / 4 + 1);
+}
+
+// Copy of the session for writing it to NVS, taken in the LMIC task
+// as it updates the session after each uplink (including MAC-only uplinks)
+bool sessionSnapshot(TTNSessionData* data)
+{
+    bool valid;
+    ttn_hal.execute([&] {
+        valid = session.snapshot(data);
+    });
+    return valid;
+}
+
+// Accounts for a receive window about to be opened.
+// In single receive mode, the receiver is on for the number of symbols
+// specified by LMIC.rxsyms unless a preamble is detected.
+void accountRxWindow()
+{
+#if !defined(DISABLE_PING)
+    if ((LMIC.opmode & (OP_PINGINI | OP_TXRXPEND)) == OP_PINGINI && LMIC.rxtime == LMIC.ping.rxtime)
+        classBStats.pingSlots++;
+#endif
+
+    sf_t sf = getSf(LMIC.rps);
+    if (sf == FSK)
+        return;
+
+    // Symbol time is 2^SF / bandwidth
+    uint32_t symbolTimeUs = (1000u << (sf + 6)) / (125u << getBw(LMIC.rps));
+    rxOnTimeUs += LMIC.rxsyms * symbolTimeUs;
+}
+
+// Accounts for the continuous reception while scanning for a beacon
+void endBeaconScan()
+{
+    if (beaconScanStart == 0)
+        return;
+
+    rxOnTimeUs += esp_timer_get_time() - beaconScanStart;
+    beaconScanStart = 0;
+}
+
+
+// Called by LMIC when the answer to a network time request has been processed
+// (or the request failed). Sets the system clock to the network time.
+void networkTimeCallback(void *userData, int success)
+{
+    lmic_time_reference_t ref;
+    if (!success || !LMIC_getNetworkTimeReference(&ref))
+    {
+        ESP_LOGW(TAG, "Network time request failed");
+        return;
+    }
+
+    // The reference relates the network time (GPS seconds) to the local time (LMIC ticks)
+    int64_t now = (int64_t)(ref.tNetwork + GPS_EPOCH_OFFSET - GPS_UTC_LEAP_SECONDS) * 1000000
+        + osticks2us(os_getTime() - ref.tLocal);
+
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    int64_t correction = now - ((int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+
+    tv.tv_sec = now / 1000000;
+    tv.tv_usec = now % 1000000;
+    settimeofday(&tv, nullptr);
+    rtcTimeSynchronized = true;
+
+    ESP_LOGI(TAG, "System clock set to network time (corrected by %lld ms)", (long long)(correction / 1000));
 }
 
-static void TheThingsNetwork_CopyLmicData(struct lmic_t* source, struct lmic_t* destination)
+#if defined(CONFIG_TTN_RADIO_TIMING)
+
+void printHistogram(const char* title, const TTNHistogram* histogram)
 {
-  destination->seqnoDn = source->seqnoDn;
-  destination->seqnoUp = source->seqnoUp;
+    if (histogram->count == 0)
+    {
+        printf("%s: no values\n", title);
+        return;
+    }
+
+    printf("%s (us): count=%u, min=%d, mean=%d, max=%d\n", title, histogram->count,
+        histogram->min, (int)(histogram->sum / histogram->count), histogram->max);
+    const int numBuckets = sizeof(histogram->buckets) / sizeof(histogram->buckets[0]);
+    for (int i = 0; i < numBuckets; i++)
+    {
+        int32_t low = histogram->base + i * histogram->width;
+        if (i == 0)
+            printf("          < %6d: %u\n", low + histogram->width, histogram->buckets[i]);
+        else if (i == numBuckets - 1)
+            printf("         >= %6d: %u\n", low, histogram->buckets[i]);
+        else
+            printf("  %6d .. %6d: %u\n", low, low + histogram->width - 1, histogram->buckets[i]);
+    }
 }
 
+#endif
@@ -217,21 +217,33 @@ static CONST_TABLE(u4_t, AES_E4)[256] = {
                                    a ^= ((u4_t)TABLE_GET_U1(AES_S, u1(r2>> 8))<< 8); \
                                    a ^=  (u4_t)TABLE_GET_U1(AES_S, u1(r3)    )
 
-// global area for passing parameters (aux, key) and for storing round keys
+// global area for passing parameters (aux, key)
 u4_t AESAUX[16/sizeof(u4_t)];
-u4_t AESKEY[11*16/sizeof(u4_t)];
+u4_t AESKEY[16/sizeof(u4_t)];
+
+// Round keys of the most recently used keys. LMIC switches between the
+// network and the application session key for every frame and uses the
+// device key while joining, so a single entry would be replaced all the time.
+#define AES_KEYCACHE_SIZE 3
+
+static struct {
+    u4_t key[4];            // key as passed in AESKEY
+    u4_t roundkeys[44];
+} aeskeycache[AES_KEYCACHE_SIZE];
+static u1_t aeskeycacheUsed;    // number of valid entries
+static u1_t aeskeycacheNext;    // entry to be replaced next
 
 // generate 1+10 roundkeys for encryption with 128-bit key
-// read 128-bit key from AESKEY in MSBF, generate roundkey words in place
-static void aesroundkeys () {
+// read 128-bit key in MSBF, generate roundkey words in rk
+static void aesroundkeys (const u4_t* key, u4_t* rk) {
     int i;
     u4_t b;
 
     for( i=0; i<4; i++) {
-        AESKEY[i] = swapmsbf(AESKEY[i]);
+        rk[i] = swapmsbf(key[i]);
     }
 
-    b = AESKEY[3];
+    b = rk[3];
     for( ; i<44; i++ ) {
         if( i%4==0 ) {
             // b = SubWord(RotWord(b)) xor Rcon[i/4]
@@ -241,13 +253,31 @@ static void aesroundkeys () {
                 ((u4_t)TABLE_GET_U1(AES_S,    b >> 24 )      ) ^
                  TABLE_GET_U4(AES_RCON, (i-4)/4);
         }
-        AESKEY[i] = b ^= AESKEY[i-4];
+        rk[i] = b ^= rk[i-4];
     }
 }
 
+// return the roundkeys for the key in AESKEY, generate them if not cached
+static u4_t* aesgetroundkeys () {
+    u1_t i;
+
+    for( i=0; i<aeskeycacheUsed; i++ ) {
+        if( memcmp(aeskeycache[i].key, AESKEY, 16) == 0 )
+            return aeskeycache[i].roundkeys;
+    }
+
+    i = aeskeycacheNext;
+    aeskeycacheNext = (i + 1) % AES_KEYCACHE_SIZE;
+    if( aeskeycacheUsed < AES_KEYCACHE_SIZE )
+        aeskeycacheUsed++;
+    memcpy(aeskeycache[i].key, AESKEY, 16);
+    aesroundkeys(aeskeycache[i].key, aeskeycache[i].roundkeys);
+    return aeskeycache[i].roundkeys;
+}
+
 u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
 
-        aesroundkeys();
+        u4_t* rk = aesgetroundkeys();
 
         if( mode & AES_MICNOAUX ) {
             AESAUX[0] = AESAUX[1] = AESAUX[2] = AESAUX[3] = 0;
@@ -293,7 +323,7 @@ u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len) {
             }
 
             // perform AES encryption on block in a0-a3
-            ki = AESKEY;
+            ki = rk;
             ke = ki + 8*4;
             a0 ^= ki[0];
             a1 ^= ki[1];
@@ -15,14 +15,42 @@
 
 #if defined(USE_MBEDTLS_AES)
 
-void lmic_aes_encrypt(u1_t *data, u1_t *key)
+// Contexts of the most recently used keys, so the key is not set up again
+// for every block. LMIC switches between the network and the application
+// session key for every frame and uses the device key while joining.
+#define AES_CONTEXT_CACHE_SIZE 3
+
+static struct
 {
+    u1_t key[16];
     mbedtls_aes_context ctx;
-    mbedtls_aes_init(&ctx);
-    mbedtls_aes_setkey_enc(&ctx, key, 128);
-    mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, data, data);
-    mbedtls_aes_free(&ctx);
+} contextCache[AES_CONTEXT_CACHE_SIZE];
+static int contextCacheUsed;
+static int contextCacheNext;
+
+static mbedtls_aes_context* getContext(const u1_t *key)
+{
+    for (int i = 0; i < contextCacheUsed; i++)
+    {
+        if (memcmp(contextCache[i].key, key, 16) == 0)
+            return &contextCache[i].ctx;
+    }
+
+    int i = contextCacheNext;
+    contextCacheNext = (i + 1) % AES_CONTEXT_CACHE_SIZE;
+    if (contextCacheUsed < AES_CONTEXT_CACHE_SIZE)
+    {
+        mbedtls_aes_init(&contextCache[i].ctx);
+        contextCacheUsed++;
+    }
+    memcpy(contextCache[i].key, key, 16);
+    mbedtls_aes_setkey_enc(&contextCache[i].ctx, key, 128);
+    return &contextCache[i].ctx;
 }
 
+void lmic_aes_encrypt(u1_t *data, u1_t *key)
+{
+    mbedtls_aes_crypt_ecb(getContext(key), MBEDTLS_AES_ENCRYPT, data, data);
+}
 
 #endif
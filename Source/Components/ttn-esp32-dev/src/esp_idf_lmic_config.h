@@ -53,8 +53,16 @@
 #define US_PER_OSTICK 16
 #define OSTICKS_PER_SEC (1000000 / US_PER_OSTICK)
 
-//#define USE_ORIGINAL_AES
+// Time reserved for setting up the radio before an RX window
+#define RX_RAMPUP (us2osticks(CONFIG_TTN_RX_RAMPUP))
+
+// Maximum error of the RX window start (covered by additional preamble symbols)
+#define LMICbandplan_RX_ERROR_ABS_osticks (us2osticks(CONFIG_TTN_RX_ERROR))
+
+// The host build (tools/host) uses the original AES implementation
+#if !defined(USE_ORIGINAL_AES)
 #define USE_MBEDTLS_AES
+#endif
 
 #if LMIC_DEBUG_LEVEL > 0 || LMIC_X_DEBUG_LEVEL > 0
 #include <stdio.h>
@@ -62,6 +70,54 @@
 
 #define LMIC_ENABLE_onEvent 0
 
-#define DISABLE_PING
+#define LMIC_ENABLE_DeviceTimeReq 1
 
+#if defined(CONFIG_TTN_EVENT_LOGGING_LIVE) || defined(CONFIG_TTN_EVENT_LOGGING_TRACE)
+#define LMIC_ENABLE_event_logging 1
+
+// Log categories included at compile time (see LMIC_LOG_xxx in oslmic.h)
+#if defined(CONFIG_TTN_EVENT_LOG_RADIO)
+#define TTN_LOG_RADIO 0x01
+#else
+#define TTN_LOG_RADIO 0
+#endif
+#if defined(CONFIG_TTN_EVENT_LOG_RX)
+#define TTN_LOG_RX 0x02
+#else
+#define TTN_LOG_RX 0
+#endif
+#if defined(CONFIG_TTN_EVENT_LOG_TX)
+#define TTN_LOG_TX 0x04
+#else
+#define TTN_LOG_TX 0
+#endif
+#if defined(CONFIG_TTN_EVENT_LOG_MAC)
+#define TTN_LOG_MAC 0x08
+#else
+#define TTN_LOG_MAC 0
+#endif
+#if defined(CONFIG_TTN_EVENT_LOG_CHANNEL)
+#define TTN_LOG_CHANNEL 0x10
+#else
+#define TTN_LOG_CHANNEL 0
+#endif
+#if defined(CONFIG_TTN_EVENT_LOG_EVENTS)
+#define TTN_LOG_EVENT 0x20
+#else
+#define TTN_LOG_EVENT 0
+#endif
+#define LMIC_LOG_CATEGORIES (TTN_LOG_RADIO | TTN_LOG_RX | TTN_LOG_TX | TTN_LOG_MAC | TTN_LOG_CHANNEL | TTN_LOG_EVENT)
+#endif
+
+#if defined(CONFIG_TTN_RADIO_TIMING)
+#define LMIC_ENABLE_radio_timing 1
+#endif
+
+#if defined(CONFIG_TTN_CLOCK_CALIBRATION)
+#define LMIC_ENABLE_clock_calibration 1
+#endif
+
+#if !defined(CONFIG_TTN_CLASS_B)
+#define DISABLE_PING
 #define DISABLE_BEACONS
+#endif
@@ -10,6 +10,7 @@
  * Hardware abstraction layer to run LMIC on a ESP32 using ESP-IDF.
  *******************************************************************************/
 
+#include <string.h>
 #include "../lmic/lmic.h"
 #include "../hal/hal_esp32.h"
 
@@ -19,6 +20,10 @@
 #include "driver/spi_master.h"
 #include "driver/timer.h"
 #include "esp_log.h"
+#include "esp_sleep.h"
+#if defined(CONFIG_TTN_TIMER_HW)
+#include "soc/timer_group_struct.h"
+#endif
 
 #define LMIC_UNUSED_PIN 0xff
 
@@ -26,13 +31,23 @@
 #define NOTIFY_BIT_TIMER 2
 #define NOTIFY_BIT_WAKEUP 4
 
+#if defined(CONFIG_TTN_TIMER_HW)
+#define TIMER_GROUP ((timer_group_t)CONFIG_TTN_TIMER_GROUP)
+#define TIMER_INDEX ((timer_idx_t)CONFIG_TTN_TIMER_INDEX)
+#endif
+
 
 static const char* const TAG = "ttn_hal";
 
+#if defined(CONFIG_TTN_LIGHT_SLEEP)
+// Upper limit of the automatically increased light sleep wake-up time (in µs)
+static const uint32_t LIGHT_SLEEP_MAX_WAKEUP = 4 * CONFIG_TTN_LIGHT_SLEEP_WAKEUP;
+#endif
+
 HAL_ESP32 ttn_hal;
 
 TaskHandle_t HAL_ESP32::lmicTask = nullptr;
-uint32_t HAL_ESP32::dioInterruptTime = 0;
+int64_t HAL_ESP32::dioInterruptTime = 0;
 uint8_t HAL_ESP32::dioNum = 0;
 
 
@@ -42,6 +57,14 @@ uint8_t HAL_ESP32::dioNum = 0;
 HAL_ESP32::HAL_ESP32()
     : rssiCal(10), nextAlarm(0)
 {    
+    memset(&syncStats, 0, sizeof(syncStats));
+#if defined(CONFIG_TTN_RADIO_TIMING)
+    resetTimingStats();
+#endif
+#if defined(CONFIG_TTN_LIGHT_SLEEP)
+    memset(&lightSleepStats, 0, sizeof(lightSleepStats));
+    lightSleepStats.wakeupTime = CONFIG_TTN_LIGHT_SLEEP_WAKEUP;
+#endif
 }
 
 // -----------------------------------------------------------------------------
@@ -64,7 +87,7 @@ void HAL_ESP32::configurePins(spi_host_device_t spi_host, uint8_t nss, uint8_t r
 
 void IRAM_ATTR HAL_ESP32::dioIrqHandler(void *arg)
 {
-    dioInterruptTime = hal_ticks();
+    dioInterruptTime = esp_timer_get_time();
     dioNum = (u1_t)(long)arg;
     BaseType_t higherPrioTaskWoken = pdFALSE;
     xTaskNotifyFromISR(lmicTask, NOTIFY_BIT_DIO, eSetBits, &higherPrioTaskWoken);
@@ -182,13 +205,24 @@ void hal_spi_write(u1_t cmd, const u1_t *buf, size_t len)
     ttn_hal.spiWrite(cmd, buf, len);
 }
 
+// The transactions are short (register access and the FIFO with up to 255 bytes).
+// Polling avoids the interrupt and the task switches of a queued transaction.
+// Up to 4 bytes are transferred directly from and to the transaction (no DMA).
 void HAL_ESP32::spiWrite(uint8_t cmd, const uint8_t *buf, size_t len)
 {
     memset(&spiTransaction, 0, sizeof(spiTransaction));
     spiTransaction.addr = cmd;
     spiTransaction.length = 8 * len;
-    spiTransaction.tx_buffer = buf;
-    esp_err_t err = spi_device_transmit(spiHandle, &spiTransaction);
+    if (len <= sizeof(spiTransaction.tx_data))
+    {
+        spiTransaction.flags = SPI_TRANS_USE_TXDATA;
+        memcpy(spiTransaction.tx_data, buf, len);
+    }
+    else
+    {
+        spiTransaction.tx_buffer = buf;
+    }
+    esp_err_t err = spi_device_polling_transmit(spiHandle, &spiTransaction);
     ESP_ERROR_CHECK(err);
 }
 
@@ -199,14 +233,23 @@ void hal_spi_read(u1_t cmd, u1_t *buf, size_t len)
 
 void HAL_ESP32::spiRead(uint8_t cmd, uint8_t *buf, size_t len)
 {
-    memset(buf, 0, len);
     memset(&spiTransaction, 0, sizeof(spiTransaction));
     spiTransaction.addr = cmd;
     spiTransaction.length = 8 * len;
     spiTransaction.rxlength = 8 * len;
+    if (len <= sizeof(spiTransaction.rx_data))
+    {
+        spiTransaction.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+        esp_err_t err = spi_device_polling_transmit(spiHandle, &spiTransaction);
+        ESP_ERROR_CHECK(err);
+        memcpy(buf, spiTransaction.rx_data, len);
+        return;
+    }
+
+    memset(buf, 0, len);
     spiTransaction.tx_buffer = buf;
     spiTransaction.rx_buffer = buf;
-    esp_err_t err = spi_device_transmit(spiHandle, &spiTransaction);
+    esp_err_t err = spi_device_polling_transmit(spiHandle, &spiTransaction);
     ESP_ERROR_CHECK(err);
 }
 
@@ -251,6 +294,55 @@ int64_t HAL_ESP32::osTimeToEspTime(int64_t espNow, uint32_t osTime)
     return espTime;
 }
 
+#if defined(CONFIG_TTN_TIMER_HW)
+
+// The hardware timer counts microseconds. It is restarted at 0 for each alarm.
+// Its interrupt handler notifies the LMIC task directly.
+// The timer is clocked by the APB clock. With power management enabled, the
+// APB clock can be lowered. So it is locked at 80 MHz while the timer is armed.
+
+void HAL_ESP32::timerInit()
+{
+    timer_config_t timerConfig;
+    memset(&timerConfig, 0, sizeof(timerConfig));
+    timerConfig.alarm_en = TIMER_ALARM_DIS;
+    timerConfig.counter_en = TIMER_PAUSE;
+    timerConfig.intr_type = TIMER_INTR_LEVEL;
+    timerConfig.counter_dir = TIMER_COUNT_UP;
+    timerConfig.auto_reload = TIMER_AUTORELOAD_DIS;
+    timerConfig.divider = 80; // 80 MHz APB clock -> 1 µs
+    esp_err_t err = timer_init(TIMER_GROUP, TIMER_INDEX, &timerConfig);
+    ESP_ERROR_CHECK(err);
+
+    timer_enable_intr(TIMER_GROUP, TIMER_INDEX);
+    err = timer_isr_register(TIMER_GROUP, TIMER_INDEX, hwTimerIsr, nullptr, ESP_INTR_FLAG_IRAM, nullptr);
+    ESP_ERROR_CHECK(err);
+
+#if defined(CONFIG_PM_ENABLE)
+    err = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "ttn_timer", &apbFreqLock);
+    ESP_ERROR_CHECK(err);
+    apbFreqLocked = false;
+#endif
+
+    ESP_LOGI(TAG, "Timer initialized (hardware timer %d/%d)", TIMER_GROUP, TIMER_INDEX);
+}
+
+void IRAM_ATTR HAL_ESP32::hwTimerIsr(void *arg)
+{
+    // the alarm is disabled by the hardware when it triggers
+    if (TIMER_GROUP == TIMER_GROUP_0)
+        TIMERG0.int_clr_timers.val = BIT(TIMER_INDEX);
+    else
+        TIMERG1.int_clr_timers.val = BIT(TIMER_INDEX);
+
+    BaseType_t higherPrioTaskWoken = pdFALSE;
+    xTaskNotifyFromISR(lmicTask, NOTIFY_BIT_TIMER, eSetBits, &higherPrioTaskWoken);
+    if (higherPrioTaskWoken)
+        portYIELD_FROM_ISR();
+}
+
+#else
+
 void HAL_ESP32::timerInit()
 {
     esp_timer_create_args_t timerConfig = {
@@ -265,6 +357,13 @@ void HAL_ESP32::timerInit()
     ESP_LOGI(TAG, "Timer initialized");
 }
 
+void HAL_ESP32::timerCallback(void *arg)
+{
+    xTaskNotify(lmicTask, NOTIFY_BIT_TIMER, eSetBits);
+}
+
+#endif
+
 void HAL_ESP32::setNextAlarm(int64_t time)
 {
     nextAlarm = time;
@@ -277,17 +376,38 @@ void HAL_ESP32::armTimer(int64_t espNow)
     int64_t timeout = nextAlarm - esp_timer_get_time();
     if (timeout < 0)
         timeout = 10;
+#if defined(CONFIG_TTN_TIMER_HW)
+#if defined(CONFIG_PM_ENABLE)
+    if (!apbFreqLocked)
+    {
+        esp_pm_lock_acquire(apbFreqLock);
+        apbFreqLocked = true;
+    }
+#endif
+    timer_pause(TIMER_GROUP, TIMER_INDEX);
+    timer_set_counter_value(TIMER_GROUP, TIMER_INDEX, 0);
+    timer_set_alarm_value(TIMER_GROUP, TIMER_INDEX, timeout);
+    timer_set_alarm(TIMER_GROUP, TIMER_INDEX, TIMER_ALARM_EN);
+    timer_start(TIMER_GROUP, TIMER_INDEX);
+#else
     esp_timer_start_once(timer, timeout);
+#endif
 }
 
 void HAL_ESP32::disarmTimer()
 {
+#if defined(CONFIG_TTN_TIMER_HW)
+    timer_pause(TIMER_GROUP, TIMER_INDEX);
+#if defined(CONFIG_PM_ENABLE)
+    if (apbFreqLocked)
+    {
+        esp_pm_lock_release(apbFreqLock);
+        apbFreqLocked = false;
+    }
+#endif
+#else
     esp_timer_stop(timer);
-}
-
-void HAL_ESP32::timerCallback(void *arg)
-{
-    xTaskNotify(lmicTask, NOTIFY_BIT_TIMER, eSetBits);
+#endif
 }
 
 // Wait for the next external event. Either:
@@ -303,30 +423,46 @@ bool HAL_ESP32::wait(WaitKind waitKind)
         if (bits == 0)
             return false;
 
-        if ((bits & NOTIFY_BIT_WAKEUP) != 0)
+        // Several bits can be set at the same time. None of them must be lost.
+        bool done = false;
+
+        if ((bits & NOTIFY_BIT_DIO) != 0)
         {
+            enterCriticalSection();
+#if defined(CONFIG_TTN_RADIO_TIMING)
+            addToHistogram(&timingStats.irqLatency, (int32_t)(esp_timer_get_time() - dioInterruptTime));
+#endif
+            // LMIC tick unit: 16µs
+            radio_irq_handler_v2(dioNum, (u4_t)(dioInterruptTime >> 4));
+#if defined(CONFIG_TTN_RADIO_TIMING)
+            rxWindowPending = false;
+#endif
+            leaveCriticalSection();
             if (waitKind != WAIT_FOR_TIMER)
-            {
-                disarmTimer();
-                return true;
-            }
+                done = true;
         }
-        else if ((bits & NOTIFY_BIT_TIMER) != 0)
+
+        if ((bits & NOTIFY_BIT_TIMER) != 0)
         {
             disarmTimer();
+#if defined(CONFIG_TTN_RADIO_TIMING)
+            if (nextAlarm != 0)
+                addToHistogram(&timingStats.timerLatency, (int32_t)(esp_timer_get_time() - nextAlarm));
+#endif
             setNextAlarm(0);
             if (waitKind != CHECK_IO)
-                return true;
+                done = true;
         }
-        else // IO interrupt
+
+        // While waiting for the timer, a wake-up is detected by the pending commands
+        if ((bits & NOTIFY_BIT_WAKEUP) != 0 && waitKind != WAIT_FOR_TIMER)
+            done = true;
+
+        if (done)
         {
             if (waitKind != WAIT_FOR_TIMER)
                 disarmTimer();
-            enterCriticalSection();
-            radio_irq_handler_v2(dioNum, dioInterruptTime);
-            leaveCriticalSection();
-            if (waitKind != WAIT_FOR_TIMER)
-                return true;
+            return true;
         }
     }
 }
@@ -393,13 +529,103 @@ void hal_sleep()
 
 void HAL_ESP32::sleep()
 {
-    if (wait(CHECK_IO))
+    if (wait(CHECK_IO) || !commandQueue.isEmpty())
         return;
 
+#if defined(CONFIG_TTN_LIGHT_SLEEP)
+    lightSleep();
+#endif
     armTimer(esp_timer_get_time());
     wait(WAIT_FOR_ANY_EVENT);
 }
 
+#if defined(CONFIG_TTN_LIGHT_SLEEP)
+
+// Enter light sleep until shortly before the next LMIC job.
+// Light sleep suspends all tasks. So it is only used while LMIC waits
+// for the RX windows of an uplink, i.e. for a few seconds at most.
+// The timer is armed after the wake-up and expires at the exact time.
+void HAL_ESP32::lightSleep()
+{
+    if (nextAlarm == 0 || (LMIC.opmode & OP_TXRXPEND) == 0)
+        return;
+
+    int64_t sleepStart = esp_timer_get_time();
+    int64_t sleepTime = nextAlarm - sleepStart - lightSleepStats.wakeupTime;
+    if (sleepTime < CONFIG_TTN_LIGHT_SLEEP_THRESHOLD * 1000)
+        return;
+
+    // A pending radio interrupt would end the sleep immediately
+    if (gpio_get_level(pinDIO0) != 0 || gpio_get_level(pinDIO1) != 0)
+        return;
+
+    // The DIO pins are switched to level triggered wake-up sources during the
+    // sleep. Their interrupts are disabled so the handler cannot run for the
+    // high level; a DIO event during the sleep is reported below instead.
+    gpio_intr_disable(pinDIO0);
+    gpio_intr_disable(pinDIO1);
+    esp_sleep_enable_timer_wakeup(sleepTime);
+    gpio_wakeup_enable(pinDIO0, GPIO_INTR_HIGH_LEVEL);
+    gpio_wakeup_enable(pinDIO1, GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+
+    esp_light_sleep_start();
+
+    int64_t wakeupTime = esp_timer_get_time();
+    bool radioWakeup = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO;
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+    gpio_wakeup_disable(pinDIO0);
+    gpio_wakeup_disable(pinDIO1);
+    gpio_set_intr_type(pinDIO0, GPIO_INTR_POSEDGE);
+    gpio_set_intr_type(pinDIO1, GPIO_INTR_POSEDGE);
+
+    lightSleepStats.count++;
+    lightSleepStats.time += (uint32_t)((wakeupTime - sleepStart) / 1000);
+
+    // A DIO line that has gone high while the interrupts were disabled
+    // (during the sleep or after a timer wake-up) is reported here, once.
+    // For a radio wake-up, the wake-up time is subtracted to estimate the
+    // time of the edge.
+    bool dio0 = gpio_get_level(pinDIO0) != 0;
+    if (radioWakeup || dio0 || gpio_get_level(pinDIO1) != 0)
+    {
+        if (radioWakeup)
+        {
+            lightSleepStats.radioWakeups++;
+            dioInterruptTime = wakeupTime - lightSleepStats.wakeupTime;
+        }
+        else
+        {
+            dioInterruptTime = esp_timer_get_time();
+        }
+        dioNum = dio0 ? 0 : 1;
+        xTaskNotify(lmicTask, NOTIFY_BIT_DIO, eSetBits);
+    }
+
+    gpio_intr_enable(pinDIO0);
+    gpio_intr_enable(pinDIO1);
+
+    if (radioWakeup)
+        return;
+
+    if (wakeupTime > nextAlarm)
+    {
+        // Too late: reserve more time for the next wake-up. A single long
+        // delay (e.g. by a flash operation) must not disable light sleep.
+        lightSleepStats.lateWakeups++;
+        uint32_t increased = lightSleepStats.wakeupTime + (uint32_t)(wakeupTime - nextAlarm);
+        lightSleepStats.wakeupTime = increased < LIGHT_SLEEP_MAX_WAKEUP ? increased : LIGHT_SLEEP_MAX_WAKEUP;
+    }
+    else if (lightSleepStats.wakeupTime > CONFIG_TTN_LIGHT_SLEEP_WAKEUP)
+    {
+        // In time: return slowly to the configured wake-up time
+        lightSleepStats.wakeupTime -= (lightSleepStats.wakeupTime - CONFIG_TTN_LIGHT_SLEEP_WAKEUP + 7) / 8;
+    }
+}
+
+#endif
+
 
 // -----------------------------------------------------------------------------
 // IRQ
@@ -425,9 +651,25 @@ void HAL_ESP32::initCriticalSection()
     mutex = xSemaphoreCreateRecursiveMutex();
 }
 
+// The statistics are updated while holding the lock.
 void HAL_ESP32::enterCriticalSection()
 {
-    xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+    int64_t waitStart = 0;
+    if (xSemaphoreTakeRecursive(mutex, 0) != pdTRUE)
+    {
+        waitStart = esp_timer_get_time();
+        xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+    }
+
+    syncStats.lockAcquisitions++;
+    if (waitStart != 0)
+    {
+        uint32_t waitTime = (uint32_t)(esp_timer_get_time() - waitStart);
+        syncStats.lockContended++;
+        syncStats.totalLockWait += waitTime;
+        if (waitTime > syncStats.maxLockWait)
+            syncStats.maxLockWait = waitTime;
+    }
 }
 
 void HAL_ESP32::leaveCriticalSection()
@@ -435,6 +677,141 @@ void HAL_ESP32::leaveCriticalSection()
     xSemaphoreGiveRecursive(mutex);
 }
 
+// Execute a function in the LMIC task and wait for its completion.
+// The LMIC task only runs it when no job is due, i.e. never while it is
+// busy with the radio. The calling task waits on a binary semaphore on its
+// stack; its task notification is reserved for the event ring ('TTNEventRing').
+void HAL_ESP32::execute(void (*func)(void* arg), void* arg)
+{
+    // Before the LMIC task has been started, 'lmicTask' is the application task
+    TaskHandle_t currentTask = xTaskGetCurrentTaskHandle();
+    if (lmicTask == nullptr || currentTask == lmicTask)
+    {
+        enterCriticalSection();
+        func(arg);
+        leaveCriticalSection();
+        return;
+    }
+
+    StaticSemaphore_t doneBuffer;
+    SemaphoreHandle_t done = xSemaphoreCreateBinaryStatic(&doneBuffer);
+    TTNCommand command = { func, arg, done, esp_timer_get_time() };
+    while (!commandQueue.post(command))
+        vTaskDelay(1);
+    wakeUp();
+
+    xSemaphoreTake(done, portMAX_DELAY);
+    vSemaphoreDelete(done);
+}
+
+u1_t hal_processCommands()
+{
+    return ttn_hal.processCommands();
+}
+
+// Run the pending commands (called by the LMIC task when no job is due)
+bool HAL_ESP32::processCommands()
+{
+    TTNCommand command;
+    bool processed = false;
+    while (commandQueue.tryReceive(&command))
+    {
+        processed = true;
+        // The lock keeps the state consistent for the snapshots of the statistics
+        enterCriticalSection();
+        command.func(command.arg);
+        uint32_t latency = (uint32_t)(esp_timer_get_time() - command.postedAt);
+        syncStats.commands++;
+        syncStats.totalCommandLatency += latency;
+        if (latency > syncStats.maxCommandLatency)
+            syncStats.maxCommandLatency = latency;
+        syncStats.queueFull = commandQueue.overflows();
+        leaveCriticalSection();
+
+        xSemaphoreGive(command.done);
+    }
+    return processed;
+}
+
+// -----------------------------------------------------------------------------
+// Radio timing statistics
+
+#if defined(CONFIG_TTN_RADIO_TIMING)
+
+void hal_rxWindowOpened(ostime_t scheduled, ostime_t opened)
+{
+    ttn_hal.rxWindowOpened(scheduled, opened);
+}
+
+void HAL_ESP32::rxWindowOpened(uint32_t scheduled, uint32_t opened)
+{
+    addToHistogram(&timingStats.rxStartError, (int32_t)(opened - scheduled) * US_PER_OSTICK);
+
+    // The RX timeout is specified in symbols (LoRa only)
+    rps_t rps = LMIC.rps;
+    rxWindowPending = getSf(rps) != FSK;
+    if (!rxWindowPending)
+        return;
+
+    // symbol time: 2^SF / BW
+    int32_t symbolTime = (1 << (getSf(rps) + 6)) * 1000 / (125 << getBw(rps));
+    rxWindowStart = opened;
+    rxWindowLength = LMIC.rxsyms * symbolTime;
+}
+
+void hal_rxFrameReceived(ostime_t frameEnd)
+{
+    ttn_hal.rxFrameReceived(frameEnd);
+}
+
+void HAL_ESP32::rxFrameReceived(uint32_t frameEnd)
+{
+    // Ignore continuous reception (Class C) and FSK
+    if (!rxWindowPending)
+        return;
+
+    // The frame starts with the preamble, which must be detected before the RX timeout
+    uint32_t frameStart = frameEnd - calcAirTime(LMIC.rps, LMIC.dataLen);
+    int32_t offset = (int32_t)(frameStart - rxWindowStart) * US_PER_OSTICK;
+    addToHistogram(&timingStats.rxMargin, rxWindowLength - offset);
+}
+
+void HAL_ESP32::resetTimingStats()
+{
+    memset(&timingStats, 0, sizeof(timingStats));
+    timingStats.irqLatency.base = 0;
+    timingStats.irqLatency.width = 50;
+    timingStats.rxStartError.base = -128;
+    timingStats.rxStartError.width = 32;
+    timingStats.rxMargin.base = 0;
+    timingStats.rxMargin.width = 2000;
+    timingStats.timerLatency.base = 0;
+    timingStats.timerLatency.width = 25;
+    rxWindowPending = false;
+}
+
+void HAL_ESP32::addToHistogram(TTNHistogram* histogram, int32_t value)
+{
+    const int32_t numBuckets = sizeof(histogram->buckets) / sizeof(histogram->buckets[0]);
+    int32_t index = 0;
+    if (value >= histogram->base)
+    {
+        index = (value - histogram->base) / histogram->width;
+        if (index >= numBuckets)
+            index = numBuckets - 1;
+    }
+    histogram->buckets[index]++;
+
+    if (histogram->count == 0 || value < histogram->min)
+        histogram->min = value;
+    if (histogram->count == 0 || value > histogram->max)
+        histogram->max = value;
+    histogram->count++;
+    histogram->sum += value;
+}
+
+#endif
+
 // -----------------------------------------------------------------------------
 
 void HAL_ESP32::lmicBackgroundTask(void* pvParameter) {
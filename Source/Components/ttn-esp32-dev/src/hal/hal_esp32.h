@@ -21,6 +21,11 @@
 #include <driver/gpio.h>
 #include <driver/spi_master.h>
 #include <esp_timer.h>
+#if defined(CONFIG_TTN_TIMER_HW) && defined(CONFIG_PM_ENABLE)
+#include <esp_pm.h>
+#endif
+#include "TheThingsNetwork.h"
+#include "../TTNCommandQueue.h"
 
 
 enum WaitKind {
@@ -29,6 +34,16 @@ enum WaitKind {
     WAIT_FOR_TIMER
 };
 
+/**
+ * @brief Request executed in the LMIC task on behalf of an application task
+ */
+struct TTNCommand
+{
+    void (*func)(void* arg);
+    void* arg;
+    SemaphoreHandle_t done;
+    int64_t postedAt;
+};
 
 
 class HAL_ESP32
@@ -45,6 +60,18 @@ public:
     void enterCriticalSection();
     void leaveCriticalSection();
 
+    void execute(void (*func)(void* arg), void* arg);
+    bool processCommands();
+
+    // Executes a function object (e.g. a lambda) in the LMIC task
+    template <typename F>
+    void execute(const F& func)
+    {
+        execute([](void* arg) { (*(const F*)arg)(); }, (void*)&func);
+    }
+
+    TTNSyncStats syncStats;
+
     void spiWrite(uint8_t cmd, const uint8_t *buf, size_t len);
     void spiRead(uint8_t cmd, uint8_t *buf, size_t len);
     uint8_t checkTimer(uint32_t osTime);
@@ -60,10 +87,26 @@ public:
     gpio_num_t pinDIO1;
     int8_t rssiCal;
 
+#if defined(CONFIG_TTN_RADIO_TIMING)
+    void rxWindowOpened(uint32_t scheduled, uint32_t opened);
+    void rxFrameReceived(uint32_t frameEnd);
+    void resetTimingStats();
+
+    TTNRadioTimingStats timingStats;
+#endif
+
+#if defined(CONFIG_TTN_LIGHT_SLEEP)
+    TTNLightSleepStats lightSleepStats;
+#endif
+
 private:
     static void lmicBackgroundTask(void* pvParameter);
     static void dioIrqHandler(void* arg);
+#if defined(CONFIG_TTN_TIMER_HW)
+    static void hwTimerIsr(void *arg);
+#else
     static void timerCallback(void *arg);
+#endif
     static int64_t osTimeToEspTime(int64_t espNow, uint32_t osTime);
 
     void ioInit();
@@ -74,16 +117,35 @@ private:
     void armTimer(int64_t espNow);
     void disarmTimer();
     bool wait(WaitKind waitKind);
+#if defined(CONFIG_TTN_LIGHT_SLEEP)
+    void lightSleep();
+#endif
 
     static TaskHandle_t lmicTask;
-    static uint32_t dioInterruptTime;
+    static int64_t dioInterruptTime;
     static uint8_t dioNum;
 
     spi_device_handle_t spiHandle;
     spi_transaction_t spiTransaction;
     SemaphoreHandle_t mutex;
+    TTNCommandQueue<TTNCommand, 8> commandQueue;
+#if !defined(CONFIG_TTN_TIMER_HW)
     esp_timer_handle_t timer;
+#endif
+#if defined(CONFIG_TTN_TIMER_HW) && defined(CONFIG_PM_ENABLE)
+    // keeps the APB clock at 80 MHz while the hardware timer is armed
+    esp_pm_lock_handle_t apbFreqLock;
+    bool apbFreqLocked;
+#endif
     int64_t nextAlarm;
+
+#if defined(CONFIG_TTN_RADIO_TIMING)
+    static void addToHistogram(TTNHistogram* histogram, int32_t value);
+
+    bool rxWindowPending;
+    uint32_t rxWindowStart;
+    int32_t rxWindowLength;
+#endif
 };
 
 extern HAL_ESP32 ttn_hal;
@@ -199,6 +199,20 @@
 # define LMIC_ENABLE_event_logging 0        /* PARAM */
 #endif
 
+// LMIC_ENABLE_radio_timing
+// Report the start of receive windows and received frames to the HAL
+// (hal_rxWindowOpened(), hal_rxFrameReceived()) for timing statistics.
+#if !defined(LMIC_ENABLE_radio_timing)
+# define LMIC_ENABLE_radio_timing 0         /* PARAM */
+#endif
+
+// LMIC_ENABLE_clock_calibration
+// Report the offset of received Class A downlinks from their nominal start
+// to the HAL (hal_rxOffsetMeasured()) for calibrating the clock error.
+#if !defined(LMIC_ENABLE_clock_calibration)
+# define LMIC_ENABLE_clock_calibration 0    /* PARAM */
+#endif
+
 // LMIC_LORAWAN_SPEC_VERSION
 #if !defined(LMIC_LORAWAN_SPEC_VERSION)
 # define LMIC_LORAWAN_SPEC_VERSION	LMIC_LORAWAN_SPEC_VERSION_1_0_3
@@ -104,6 +104,13 @@ uint8_t hal_getIrqLevel (void);
  */
 void hal_sleep (void);
 
+/*
+ * run the requests posted by the application tasks.
+ * called by the run loop when no job is due, instead of going to sleep.
+ * return 1 if requests have been run, 0 if there were none.
+ */
+u1_t hal_processCommands (void);
+
 /*
  * return 32-bit system time in ticks.
  */
@@ -168,6 +175,31 @@ uint8_t hal_getTxPowerPolicy(
 	u4_t freq
 	);
 
+#if LMIC_ENABLE_radio_timing
+/*
+ * report that a single receive window has been opened (timing statistics).
+ *   - scheduled is the time the window was scheduled for (LMIC.rxtime)
+ *   - opened is the time the receiver was actually started
+ */
+void hal_rxWindowOpened(ostime_t scheduled, ostime_t opened);
+
+/*
+ * report that a frame has been received (timing statistics).
+ *   - frameEnd is the corrected end time of the frame
+ *   - the frame length and radio parameters are taken from LMIC
+ */
+void hal_rxFrameReceived(ostime_t frameEnd);
+#endif
+
+#if LMIC_ENABLE_clock_calibration
+/*
+ * report the start of a valid Class A downlink (clock error calibration).
+ *   - offset is the actual minus the nominal start of the frame
+ *   - delay is the nominal time from the end of the uplink to the frame
+ */
+void hal_rxOffsetMeasured(ostime_t offset, ostime_t delay);
+#endif
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -438,6 +438,8 @@ void LMIC_setPingable (u1_t intvExp) {
     // Change setting
     LMIC.ping.intvExp = (intvExp & 0x7);
     LMIC.opmode |= OP_PINGABLE;
+    // Tell the network server about the ping slot setup
+    LMIC.pingSlotInfoReq = 1;
     // App may call LMIC_enableTracking() explicitely before
     // Otherwise tracking is implicitly enabled here
     if( (LMIC.opmode & (OP_TRACK|OP_SCAN)) == 0  &&  LMIC.bcninfoTries == 0 )
@@ -577,6 +579,7 @@ static void resetJoinParams(void) {
     LMIC.rx1DrOffset = 0;
     LMIC.dn2Dr       = DR_DNW2;
     LMIC.dn2Freq     = FREQ_DNW2;
+    radio_prepareChannel(LMIC.dn2Freq, DR_RANGE_MAP(LMIC.dn2Dr, LMIC.dn2Dr));
 #if LMIC_ENABLE_TxParamSetupReq
     LMIC.txParam     = 0xFF;
 #endif
@@ -747,7 +750,7 @@ applyAdrRequests(
             u1_t chpage = p4 & MCMD_LinkADRReq_Redundancy_ChMaskCntl_MASK;     // channel page
 
             map_ok = LMICbandplan_mapChannels(chpage, chmap);
-            LMICOS_logEventUint32("applyAdrRequests: mapChannels", (chpage << 16)|(chmap << 0));
+            LMICOS_logEventUint32(LMIC_LOG_MAC, "applyAdrRequests: mapChannels", (chpage << 16)|(chmap << 0));
         }
     }
 
@@ -760,7 +763,7 @@ applyAdrRequests(
 
     if (adrAns == (MCMD_LinkADRAns_PowerACK | MCMD_LinkADRAns_DataRateACK | MCMD_LinkADRAns_ChannelACK) && ! LMICbandplan_isDataRateFeasible(dr)) {
         adrAns &= ~MCMD_LinkADRAns_DataRateACK;
-        LMICOS_logEventUint32("applyAdrRequests: final DR not feasible", dr);
+        LMICOS_logEventUint32(LMIC_LOG_MAC, "applyAdrRequests: final DR not feasible", dr);
     }
 
     if (adrAns != (MCMD_LinkADRAns_PowerACK | MCMD_LinkADRAns_DataRateACK | MCMD_LinkADRAns_ChannelACK)) {
@@ -789,7 +792,7 @@ applyAdrRequests(
             changes = 1;
         }
 
-        LMICOS_logEventUint32("applyAdrRequests: setDrTxPow", (adrAns << 16)|(dr << 8)|(p1 << 0));
+        LMICOS_logEventUint32(LMIC_LOG_MAC, "applyAdrRequests: setDrTxPow", (adrAns << 16)|(dr << 8)|(p1 << 0));
 
         // handle power changes here, too.
         changes |= setDrTxpow(DRCHG_NWKCMD, dr, pow2dBm(p1));
@@ -808,7 +811,7 @@ scan_mac_cmds_link_adr(
     bit_t *presponse_fit
     )
     {
-    LMICOS_logEventUint32("scan_mac_cmds_link_adr", olen);
+    LMICOS_logEventUint32(LMIC_LOG_MAC, "scan_mac_cmds_link_adr", olen);
 
     if (olen == 0)
         return 0;
@@ -836,7 +839,7 @@ scan_mac_cmds_link_adr(
 
         if( !LMICbandplan_canMapChannels(chpage, chmap) ) {
             adrAns &= ~MCMD_LinkADRAns_ChannelACK;
-            LMICOS_logEventUint32("scan_mac_cmds_link_adr: failed canMapChannels", (chpage << UINT32_C(16))|(chmap << UINT32_C(0)));
+            LMICOS_logEventUint32(LMIC_LOG_MAC, "scan_mac_cmds_link_adr: failed canMapChannels", (chpage << UINT32_C(16))|(chmap << UINT32_C(0)));
         }
 
         if( !validDR(dr) ) {
@@ -941,6 +944,7 @@ scan_mac_cmds(
                 LMIC.rx1DrOffset = rx1DrOffset;
                 DO_DEVDB(LMIC.dn2Dr,dn2Dr);
                 DO_DEVDB(LMIC.dn2Freq,dn2Freq);
+                radio_prepareChannel(LMIC.dn2Freq, DR_RANGE_MAP(LMIC.dn2Dr, LMIC.dn2Dr));
             }
 
             /* put the first copy of the message */
@@ -993,7 +997,7 @@ scan_mac_cmds(
 
             if( ans == (MCMD_NewChannelAns_DataRateACK|MCMD_NewChannelAns_ChannelACK)) {
                 if ( ! LMIC_setupChannel(chidx, freq, DR_RANGE_MAP(MinDR, MaxDR), -1) ) {
-                    LMICOS_logEventUint32("NewChannelReq: setupChannel failed", (MaxDR << 24u) | (MinDR << 16u) | (raw_f_not_zero << 8) | (chidx << 0));
+                    LMICOS_logEventUint32(LMIC_LOG_MAC, "NewChannelReq: setupChannel failed", (MaxDR << 24u) | (MinDR << 16u) | (raw_f_not_zero << 8) | (chidx << 0));
                     ans &= ~MCMD_NewChannelAns_ChannelACK;
                 }
             }
@@ -1158,6 +1162,17 @@ static void setAdrAckCount (s2_t count) {
     }
 }
 
+#if LMIC_ENABLE_clock_calibration
+// Report the start of a received Class A downlink (RX1, RX2) relative to the
+// time the network sent it. LMIC.rxtime is the corrected end of the frame.
+static void reportRxOffset (u1_t dlen) {
+    if( (LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2)) == 0 || LMIC.classCRxOn )
+        return;
+    ostime_t const frameStart = LMIC.rxtime - calcAirTime(LMIC.rps, dlen);
+    hal_rxOffsetMeasured(frameStart - LMIC.rxNominal, LMIC.rxNominal - LMIC.txend);
+}
+#endif
+
 static bit_t decodeFrame (void) {
     xref2u1_t d = LMIC.frame;
     u1_t hdr    = d[0];
@@ -1167,7 +1182,7 @@ static bit_t decodeFrame (void) {
     const char *window = (LMIC.txrxFlags & TXRX_DNW1) ? "RX1" : ((LMIC.txrxFlags & TXRX_DNW2) ? "RX2" : "Other");
 #endif
     if (dlen > 0)
-        LMICOS_logEventUint32("decodeFrame", (dlen << 8) | (hdr << 0));
+        LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame", (dlen << 8) | (hdr << 0));
 
     if( dlen < OFF_DAT_OPTS+4 ||
         (hdr & HDR_MAJOR) != HDR_MAJOR_V1 ||
@@ -1195,7 +1210,7 @@ static bit_t decodeFrame (void) {
     int  pend  = dlen-4;  // MIC
 
     if( addr != LMIC.devaddr ) {
-        LMICOS_logEventUint32("decodeFrame: wrong address", addr);
+        LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: wrong address", addr);
 
         EV(specCond, WARN, (e_.reason = EV::specCond_t::ALIEN_ADDRESS,
                             e_.eui    = MAIN::CDEV->getEui(),
@@ -1204,7 +1219,7 @@ static bit_t decodeFrame (void) {
         goto norx;
     }
     if( poff > pend ) {
-        LMICOS_logEventUint32("decodeFrame: corrupted frame", (dlen << 16) | (fct << 8) | (poff - pend));
+        LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: corrupted frame", (dlen << 16) | (fct << 8) | (poff - pend));
         EV(specCond, ERR, (e_.reason = EV::specCond_t::CORRUPTED_FRAME,
                            e_.eui    = MAIN::CDEV->getEui(),
                            e_.info   = 0x1000000 + (poff-pend) + (fct<<8) + (dlen<<16)));
@@ -1231,7 +1246,7 @@ static bit_t decodeFrame (void) {
     }
 
     if( !aes_verifyMic(LMIC.nwkKey, LMIC.devaddr, seqno, /*dn*/1, d, pend) ) {
-        LMICOS_logEventUint32("decodeFrame: bad MIC", os_rlsbf4(&d[pend]));
+        LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: bad MIC", os_rlsbf4(&d[pend]));
         EV(spe3Cond, ERR, (e_.reason = EV::spe3Cond_t::CORRUPTED_MIC,
                            e_.eui1   = MAIN::CDEV->getEui(),
                            e_.info1  = Base::lsbf4(&d[pend]),
@@ -1239,13 +1254,16 @@ static bit_t decodeFrame (void) {
                            e_.info3  = LMIC.devaddr));
         goto norx;
     }
+#if LMIC_ENABLE_clock_calibration
+    reportRxOffset(dlen);
+#endif
     if( seqno < LMIC.seqnoDn ) {
         if( (s4_t)seqno > (s4_t)LMIC.seqnoDn ) {
             EV(specCond, INFO, (e_.reason = EV::specCond_t::DNSEQNO_ROLL_OVER,
                                 e_.eui    = MAIN::CDEV->getEui(),
                                 e_.info   = LMIC.seqnoDn,
                                 e_.info2  = seqno));
-            LMICOS_logEventUint32("decodeFrame: rollover discarded", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
+            LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: rollover discarded", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
             goto norx;
         }
         if( seqno != LMIC.seqnoDn-1 || !LMIC.lastDnConf || ftype != HDR_FTYPE_DCDN ) {
@@ -1253,19 +1271,19 @@ static bit_t decodeFrame (void) {
                                 e_.eui    = MAIN::CDEV->getEui(),
                                 e_.info   = LMIC.seqnoDn,
                                 e_.info2  = seqno));
-            LMICOS_logEventUint32("decodeFrame: Retransmit confimed discarded", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
+            LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: Retransmit confimed discarded", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
             goto norx;
         }
         // Replay of previous sequence number allowed only if
         // previous frame and repeated both requested confirmation
         // but set a flag, so we don't actually process the message.
-        LMICOS_logEventUint32("decodeFrame: Retransmit confimed accepted", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
+        LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: Retransmit confimed accepted", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
         replayConf = 1;
         LMIC.dnConf = FCT_ACK;
     }
     else {
         if( seqnoDiff > LMICbandplan_MAX_FCNT_GAP) {
-            LMICOS_logEventUint32("decodeFrame: gap too big", (seqnoDiff << 16) | (seqno & 0xFFFFu));
+            LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: gap too big", (seqnoDiff << 16) | (seqno & 0xFFFFu));
             goto norx;
         }
         if( seqno > LMIC.seqnoDn ) {
@@ -1279,7 +1297,7 @@ static bit_t decodeFrame (void) {
         // DN frame requested confirmation - provide ACK once with next UP frame
         LMIC.dnConf = LMIC.lastDnConf = (ftype == HDR_FTYPE_DCDN ? FCT_ACK : 0);
         if (LMIC.dnConf)
-            LMICOS_logEventUint32("decodeFrame: Confirmed downlink", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
+            LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: Confirmed downlink", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
     }
 
     if (port == 0 && olen != 0 && pend > poff) {
@@ -1364,7 +1382,7 @@ static bit_t decodeFrame (void) {
                             e_.info   = Base::lsbf4(&d[pend]),
                             e_.info2  = seqno));
         // discard the data
-        LMICOS_logEventUint32("decodeFrame: discarding replay", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
+        LMICOS_logEventUint32(LMIC_LOG_RX, "decodeFrame: discarding replay", (seqno << 16) | (LMIC.lastDnConf << 8) | (ftype << 0));
         goto norx;
     }
 
@@ -1469,6 +1487,7 @@ static void schedRx12 (ostime_t delay, osjobcb_t func, u1_t dr) {
     // Semtech reference code.
     //
     // This also sets LMIC.rxsyms.
+    LMIC.rxNominal = LMIC.txend + delay;
     LMIC.rxtime = LMIC.txend + LMICcore_adjustForDrift(delay + LMICcore_RxWindowOffset(hsym, LMICbandplan_MINRX_SYMS_LoRa_ClassA), hsym);
 
     LMIC_X_DEBUG_PRINTF("%"LMIC_PRId_ostime_t": sched Rx12 %"LMIC_PRId_ostime_t"\n", os_getTime(), LMIC.rxtime - RX_RAMPUP);
@@ -1552,6 +1571,9 @@ static bit_t processJoinAccept (void) {
                            e_.info   = mic));
         return processJoinAccept_badframe();
     }
+#if LMIC_ENABLE_clock_calibration
+    reportRxOffset(dlen);
+#endif
 
     u4_t addr = os_rlsbf4(LMIC.frame+OFF_JA_DEVADDR);
     LMIC.devaddr = addr;
@@ -1852,6 +1874,15 @@ static bit_t buildDataFrame (void) {
         LMIC.txDeviceTimeReqState = lmic_RequestTimeState_rx;
     }
 #endif // LMIC_ENABLE_DeviceTimeReq
+#if !defined(DISABLE_PING)
+    if ( LMIC.pingSlotInfoReq ) {
+        LMIC.frame[end+0] = MCMD_PingSlotInfoReq;
+        // LoRaWAN 1.0.3: 7-3:RFU, 2-0:periodicity (the data rate is set by PingSlotChannelReq)
+        LMIC.frame[end+1] = LMIC.ping.intvExp & 0x7;
+        end += 2;
+        LMIC.pingSlotInfoReq = 0;
+    }
+#endif // !DISABLE_PING
 #if !defined(DISABLE_BEACONS) && defined(ENABLE_MCMD_BeaconTimingAns)
     if ( LMIC.bcninfoTries > 0 ) {
         LMIC.frame[end+0] = MCMD_BeaconInfoReq;
@@ -1859,7 +1890,7 @@ static bit_t buildDataFrame (void) {
     }
 #endif
     if (end > OFF_DAT_OPTS + 16) {
-        LMICOS_logEventUint32("piggyback mac opts too long", end);
+        LMICOS_logEventUint32(LMIC_LOG_TX, "piggyback mac opts too long", end);
         return 0;
     }
 
@@ -1882,7 +1913,7 @@ static bit_t buildDataFrame (void) {
     u1_t maxFlen = LMICbandplan_maxFrameLen(LMIC.datarate);
 
     if (flen > maxFlen) {
-        LMICOS_logEventUint32("frame too long for this bandplan", (dlen << 16) | (flen << 8) | maxFlen);
+        LMICOS_logEventUint32(LMIC_LOG_TX, "frame too long for this bandplan", (dlen << 16) | (flen << 8) | maxFlen);
         return 0;
     }
 
@@ -1896,7 +1927,7 @@ static bit_t buildDataFrame (void) {
         LMIC.seqnoUp += 1;
         DO_DEVDB(LMIC.seqnoUp,seqnoUp);
     } else {
-        LMICOS_logEventUint32("retransmit", (LMIC.frame[OFF_DAT_FCT] << 24u) | (LMIC.txCnt << 16u) | (LMIC.upRepeatCount << 8u) | (LMIC.upRepeat<<0u));
+        LMICOS_logEventUint32(LMIC_LOG_TX, "retransmit", (LMIC.frame[OFF_DAT_FCT] << 24u) | (LMIC.txCnt << 16u) | (LMIC.upRepeatCount << 8u) | (LMIC.upRepeat<<0u));
         EV(devCond, INFO, (e_.reason = EV::devCond_t::RE_TX,
                            e_.eui    = MAIN::CDEV->getEui(),
                            e_.info   = LMIC.seqnoUp-1,
@@ -2152,6 +2183,61 @@ static void processPingRx (xref2osjob_t osjob) {
 }
 #endif // !DISABLE_PING
 
+
+// ================================================================================
+// Class C: between class A transactions, the receiver is kept open on the
+// RX2 frequency and data rate.
+// ================================================================================
+
+static void processClassCRx (xref2osjob_t osjob) {
+    LMIC_API_PARAMETER(osjob);
+
+    // LMIC.classCRxOn is still set while the event is reported, so the
+    // client can tell Class C downlinks from Class A downlinks.
+    if( LMIC.dataLen != 0 ) {
+        initTxrxFlags(__func__, TXRX_DNW2);
+        if( decodeFrame() ) {
+            reportEventNoUpdate(EV_RXCOMPLETE);
+        }
+    }
+    LMIC.classCRxOn = 0;
+    // Reopen the receiver (or transmit if requested meanwhile)
+    engineUpdate();
+}
+
+static void startClassCRx (void) {
+    if( !LMIC.classC || LMIC.classCRxOn || LMIC.devaddr == 0 )
+        return;
+    LMIC.freq = LMIC.dn2Freq;
+    LMIC.rps = setNocrc(dndr2rps(LMIC.dn2Dr), 1);
+    LMIC.dataLen = 0;
+    LMIC.osjob.func = FUNC_ADDR(processClassCRx);
+    LMIC.classCRxOn = 1;
+    os_radio(RADIO_RXON);
+}
+
+static void stopClassCRx (void) {
+    if( !LMIC.classCRxOn )
+        return;
+    os_radio(RADIO_RST);
+    // A frame may have been received, with its job not run yet. It is
+    // processed now, as the caller reuses LMIC.frame and LMIC.osjob.
+    if( LMIC.dataLen != 0 ) {
+        os_clearCallback(&LMIC.osjob);
+        initTxrxFlags(__func__, TXRX_DNW2);
+        if( decodeFrame() ) {
+            reportEventNoUpdate(EV_RXCOMPLETE);
+        }
+        LMIC.dataLen = 0;
+    }
+    LMIC.classCRxOn = 0;
+}
+
+void LMIC_setClassC (bit_t enabled) {
+    LMIC.classC = enabled;
+    engineUpdate();
+}
+
 // process downlink data at close of RX window.  Return zero if another RX window
 // should be scheduled, non-zero to prevent scheduling of RX2 (if relevant).
 // Confusingly, the caller actualyl does some of the calculation, so the answer from
@@ -2216,7 +2302,7 @@ static bit_t processDnData (void) {
 // nothing was received this window.
 static bit_t processDnData_norx(void) {
     if( LMIC.txCnt != 0 ) {
-        if( LMIC.txCnt < TXCONF_ATTEMPTS ) {
+        if( LMIC.txCnt < (LMIC.txConfAttempts != 0 ? LMIC.txConfAttempts : TXCONF_ATTEMPTS) ) {
             // Per [1.0.3] section 18.4, it is recommended that the device adjust datarate down.
             // The spec is not clear about what should happen in case the data size is too large
             // for the new frame len, but it seems that we should leave theframe len at the new
@@ -2243,7 +2329,7 @@ static bit_t processDnData_norx(void) {
         initTxrxFlags(__func__, TXRX_NACK | TXRX_NOPORT);
     } else if (LMIC.upRepeatCount != 0) {
         if (LMIC.upRepeatCount < LMIC.upRepeat) {
-            LMICOS_logEventUint32("processDnData: repeat", (LMIC.upRepeat<<8u) | (LMIC.upRepeatCount<<0u));
+            LMICOS_logEventUint32(LMIC_LOG_TX, "processDnData: repeat", (LMIC.upRepeat<<8u) | (LMIC.upRepeatCount<<0u));
             LMIC.upRepeatCount += 1;
             txDelay(os_getTime() + ms2osticks(LMICbandplan_TX_RECOVERY_ms), 0);
             LMIC.opmode &= ~OP_TXRXPEND;
@@ -2271,7 +2357,7 @@ static bit_t processDnData_txcomplete(void) {
     // if there's pending mac data that's not piggyback, launch it now.
     if (LMIC.pendMacLen != 0) {
         if (LMIC.pendMacPiggyback) {
-            LMICOS_logEvent("piggyback mac message");
+            LMICOS_logEvent(LMIC_LOG_MAC, "piggyback mac message");
             LMIC.opmode |= OP_POLL;     // send back the mac answers even if there's no data.
         } else {
             // Every mac command on port 0 requires an uplink, if there's data.
@@ -2284,7 +2370,7 @@ static bit_t processDnData_txcomplete(void) {
             LMIC.pendTxLen  = LMIC.pendMacLen;
             LMIC.pendMacLen = 0; // discard mac data!
             LMIC.opmode |= OP_TXDATA;
-            LMICOS_logEvent("port0 mac message");
+            LMICOS_logEvent(LMIC_LOG_MAC, "port0 mac message");
         }
     }
 
@@ -2334,7 +2420,7 @@ static bit_t processDnData_txcomplete(void) {
         // one channel that supports the new datarate. If not, stay
         // at current datarate (which finalizes things).
         if (! LMICbandplan_isDataRateFeasible(newDr)) {
-            LMICOS_logEventUint32("LINK_CHECK_DEAD, new DR not feasible", (newDr << 8) | LMIC.datarate);
+            LMICOS_logEventUint32(LMIC_LOG_MAC, "LINK_CHECK_DEAD, new DR not feasible", (newDr << 8) | LMIC.datarate);
             newDr = LMIC.datarate;
         }
         if( newDr == (dr_t)LMIC.datarate) {
@@ -2470,6 +2556,9 @@ static void engineUpdate_inner (void) {
 #if LMIC_DEBUG_LEVEL > 0
     LMIC_DEBUG_PRINTF("%"LMIC_PRId_ostime_t": engineUpdate, opmode=0x%x\n", os_getTime(), LMIC.opmode);
 #endif
+    // Continuous Class C reception is restarted below if the MAC is idle
+    stopClassCRx();
+
     // Check for ongoing state: scan or TX/RX transaction
     if( (LMIC.opmode & (OP_SCAN|OP_TXRXPEND|OP_SHUTDOWN)) != 0 )
         return;
@@ -2599,8 +2688,10 @@ static void engineUpdate_inner (void) {
             txbeg += 1;  // TX delayed by one tick (insignificant amount of time)
     } else {
         // No TX pending - no scheduled RX
-        if( (LMIC.opmode & OP_TRACK) == 0 )
+        if( (LMIC.opmode & OP_TRACK) == 0 ) {
+            startClassCRx();
             return;
+        }
     }
 
 #if !defined(DISABLE_BEACONS)
@@ -2647,6 +2738,11 @@ static void engineUpdate_inner (void) {
                        e_.info   = osticks2ms(txbeg-now),
                        e_.info2  = LMIC.seqnoUp-1));
     LMIC_X_DEBUG_PRINTF("%"LMIC_PRId_ostime_t": next engine update in %"LMIC_PRId_ostime_t"\n", now, txbeg-TX_RAMPUP);
+    // In Class C, keep receiving while the uplink waits (e.g. for the duty
+    // cycle). A frame received meanwhile runs the engine update early, which
+    // processes the frame in stopClassCRx() and schedules the uplink again.
+    if( (LMIC.opmode & OP_TRACK) == 0 )
+        startClassCRx();
     os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
 }
 
@@ -2819,7 +2915,7 @@ void LMIC_setTxData (void) {
 }
 
 void LMIC_setTxData_strict (void) {
-    LMICOS_logEventUint32(__func__, (LMIC.pendTxPort << 24u) | (LMIC.pendTxConf << 16u) | (LMIC.pendTxLen << 0u));
+    LMICOS_logEventUint32(LMIC_LOG_TX, __func__, (LMIC.pendTxPort << 24u) | (LMIC.pendTxConf << 16u) | (LMIC.pendTxLen << 0u));
     LMIC.opmode |= OP_TXDATA;
     if( (LMIC.opmode & OP_JOINING) == 0 ) {
         LMIC.txCnt = 0;             // reset the confirmed uplink FSM
@@ -2829,6 +2925,27 @@ void LMIC_setTxData_strict (void) {
 }
 
 
+// send the last confirmed frame again, with the same frame counter.
+// txCnt is the number of this transmission (2 for the first retransmission).
+// Used if the retries are not scheduled by LMIC (see LMIC.txConfAttempts).
+lmic_tx_error_t LMIC_retransmitTxData (u1_t txCnt) {
+    if ( isTxPathBusy() ) {
+        return LMIC_ERROR_TX_BUSY;
+    }
+    if ( ! LMIC.pendTxConf || txCnt < 2 || LMIC.seqnoUp == 0 ) {
+        return LMIC_ERROR_TX_FAILED;
+    }
+    LMICOS_logEventUint32(LMIC_LOG_TX, __func__, (LMIC.pendTxPort << 24u) | (txCnt << 16u) | (LMIC.pendTxLen << 0u));
+    LMIC.opmode |= OP_TXDATA;
+    LMIC.txCnt = txCnt;
+    LMIC.upRepeatCount = 0;
+    engineUpdate();
+    if ( (LMIC.opmode & OP_TXDATA) == 0 ) {
+        return (LMIC.txrxFlags & TXRX_LENERR) ? LMIC_ERROR_TX_NOT_FEASIBLE : LMIC_ERROR_TX_FAILED;
+    }
+    return 0;
+}
+
 // send a message, attempting to adjust TX data rate
 lmic_tx_error_t LMIC_setTxData2 (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed) {
     adjustDrForFrameIfNotBusy(dlen);
@@ -444,6 +444,7 @@ struct lmic_t {
     // Radio settings TX/RX (also accessed by HAL)
     ostime_t    txend;
     ostime_t    rxtime;
+    ostime_t    rxNominal;    // nominal start of the Class A downlink (txend + RX delay)
 
     // LBT info
     ostime_t    lbt_ticks;      // ticks to listen
@@ -524,6 +525,7 @@ struct lmic_t {
     u1_t        rejoinCnt;    // adjustment for rejoin datarate
 
     u1_t        upRepeatCount;  // current up-repeat
+    u1_t        txConfAttempts; // max transmissions of a confirmed frame (0 ==> TXCONF_ATTEMPTS)
     bit_t       initBandplanAfterReset; // cleared by LMIC_reset(), set by first join. See issue #244
 
     u1_t        pendTxPort;
@@ -577,6 +579,13 @@ struct lmic_t {
     u1_t        missedBcns;   // unable to track last N beacons
     u1_t        bcninfoTries; // how often to try (scan mode only)
 #endif
+#if !defined(DISABLE_PING)
+    bit_t       pingSlotInfoReq;  // non-zero ==> send PingSlotInfoReq with next uplink
+#endif
+
+    // Class C state
+    bit_t       classC;       // non-zero ==> keep RX2 open between class A transactions
+    bit_t       classCRxOn;   // non-zero ==> continuous RX2 reception is active
     // Public part of MAC state
     u1_t        txCnt;
     u1_t        txrxFlags;  // transaction flags (TX-RX combo)
@@ -628,6 +637,7 @@ lmic_tx_error_t LMIC_setTxData2_strict(u1_t port, xref2u1_t data, u1_t dlen, u1_
 lmic_tx_error_t LMIC_sendWithCallback(u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed, lmic_txmessage_cb_t *pCb, void *pUserData);
 lmic_tx_error_t LMIC_sendWithCallback_strict(u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed, lmic_txmessage_cb_t *pCb, void *pUserData);
 void  LMIC_sendAlive    (void);
+lmic_tx_error_t LMIC_retransmitTxData(u1_t txCnt);
 
 #if !defined(DISABLE_BEACONS)
 bit_t LMIC_enableTracking  (u1_t tryBcnInfo);
@@ -639,6 +649,8 @@ void  LMIC_stopPingable  (void);
 void  LMIC_setPingable   (u1_t intvExp);
 #endif
 
+void  LMIC_setClassC     (bit_t enabled);
+
 void LMIC_setSession (u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
 void LMIC_setLinkCheckMode (bit_t enabled);
 void LMIC_setClockError(u2_t error);
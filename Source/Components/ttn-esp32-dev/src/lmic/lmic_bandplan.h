@@ -170,7 +170,9 @@
 // Things common to lmic.c code
 //
 #define	LMICbandplan_MINRX_SYMS_LoRa_ClassA	6
-#define	LMICbandplan_RX_ERROR_ABS_osticks	ms2osticks(10)
+#if !defined(LMICbandplan_RX_ERROR_ABS_osticks)
+# define	LMICbandplan_RX_ERROR_ABS_osticks	ms2osticks(10)
+#endif
 
 // Semtech inherently (by calculating in ms and taking ceilings)
 // rounds up to the next higher ms. It's a lot easier for us
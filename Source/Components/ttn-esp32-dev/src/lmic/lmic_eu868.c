@@ -112,6 +112,7 @@ void LMICeu868_initDefaultChannels(bit_t join) {
                 LMIC.channelFreq[fu] = TABLE_GET_U4(iniChannelFreq, su);
                 // TODO(tmm@mcci.com): don't use EU DR directly, use something from the LMIC context or a static const
                 LMIC.channelDrMap[fu] = DR_RANGE_MAP(EU868_DR_SF12, EU868_DR_SF7);
+                radio_prepareChannel(LMIC.channelFreq[fu] & ~(u4_t)3, LMIC.channelDrMap[fu]);
         }
 
         (void) LMIC_setupBand(BAND_MILLI, 14 /* dBm */, 1000 /* 0.1% */);
@@ -179,9 +180,10 @@ bit_t LMIC_setupChannel(u1_t chidx, u4_t freq, u2_t drmap, s1_t band) {
 
         LMIC.channelFreq[chidx] = freq;
         LMIC.channelDrMap[chidx] = drmap == 0 ? DR_RANGE_MAP(EU868_DR_SF12, EU868_DR_SF7) : drmap;
-        if (fEnable)
+        if (fEnable) {
                 LMIC.channelMap |= 1 << chidx;  // enabled right away
-        else
+                radio_prepareChannel(freq & ~3, LMIC.channelDrMap[chidx]);
+        } else
                 LMIC.channelMap &= ~(1 << chidx);
         return 1;
 }
@@ -186,7 +186,7 @@ bit_t LMICuslike_mapChannels(u1_t chpage, u2_t chmap) {
                 }
         }
 
-        LMICOS_logEventUint32("LMICuslike_mapChannels", (LMIC.activeChannels125khz << 16u)|(LMIC.activeChannels500khz << 0u));
+        LMICOS_logEventUint32(LMIC_LOG_CHANNEL, "LMICuslike_mapChannels", (LMIC.activeChannels125khz << 16u)|(LMIC.activeChannels500khz << 0u));
 	return (LMIC.activeChannels125khz > 0) || (LMIC.activeChannels500khz > 0);
 }
 
@@ -200,9 +200,9 @@ ostime_t LMICuslike_nextTx(ostime_t now) {
                 } else if (LMIC.activeChannels125khz > 0) {
                         LMIC.datarate = lowerDR(LMICuslike_getFirst500kHzDR(), 1);
                         setNextChannel(0, 64, LMIC.activeChannels125khz);
-                        LMICOS_logEvent("LMICuslike_nextTx: no 500k, choose 125k");
+                        LMICOS_logEvent(LMIC_LOG_CHANNEL, "LMICuslike_nextTx: no 500k, choose 125k");
                 } else {
-                        LMICOS_logEvent("LMICuslike_nextTx: no channels at all (500)");
+                        LMICOS_logEvent(LMIC_LOG_CHANNEL, "LMICuslike_nextTx: no channels at all (500)");
                 }
         }
         else { // 125kHz
@@ -211,9 +211,9 @@ ostime_t LMICuslike_nextTx(ostime_t now) {
                 } else if (LMIC.activeChannels500khz > 0) {
                         LMIC.datarate = LMICuslike_getFirst500kHzDR();
                         setNextChannel(64, 64 + 8, LMIC.activeChannels500khz);
-                        LMICOS_logEvent("LMICuslike_nextTx: no 125k, choose 500k");
+                        LMICOS_logEvent(LMIC_LOG_CHANNEL, "LMICuslike_nextTx: no 125k, choose 500k");
                 } else {
-                        LMICOS_logEvent("LMICuslike_nextTx: no channels at all (125)");
+                        LMICOS_logEvent(LMIC_LOG_CHANNEL, "LMICuslike_nextTx: no channels at all (125)");
                 }
         }
         return now;
@@ -33,9 +33,16 @@
 extern const struct lmic_pinmap lmic_pins;
 
 // RUNTIME STATE
+typedef struct {
+    osjob_t* head;
+    osjob_t* tail;
+} osjobqueue_t;
+
 static struct {
-    osjob_t* scheduledjobs;
-    osjob_t* runnablejobs;
+    osjobqueue_t scheduledjobs;     // timed jobs, ordered by deadline
+    osjobqueue_t runnablejobs;      // immediate jobs, in order of submission
+    u4_t queued;                    // number of jobs in both queues
+    oslmic_scheduler_stats_t stats;
 } OS;
 
 int os_init_ex (const void *pintable) {
@@ -57,18 +64,42 @@ ostime_t os_getTime () {
     return hal_ticks();
 }
 
-// unlink job from queue, return if removed
-static int unlinkjob (osjob_t** pnext, osjob_t* job) {
-    for( ; *pnext; pnext = &((*pnext)->next)) {
-        if(*pnext == job) { // unlink
-            *pnext = job->next;
-            return 1;
-        }
-    }
-    return 0;
+// unlink job from queue, return if removed. Jobs which are not queued
+// have no predecessor and are not the head of the queue.
+static int unlinkjob (osjobqueue_t* queue, osjob_t* job) {
+    if (job->prev == NULL && queue->head != job)
+        return 0;
+    if (job->prev != NULL)
+        job->prev->next = job->next;
+    else
+        queue->head = job->next;
+    if (job->next != NULL)
+        job->next->prev = job->prev;
+    else
+        queue->tail = job->prev;
+    job->next = NULL;
+    job->prev = NULL;
+    OS.queued--;
+    return 1;
 }
 
-static osjob_t** getJobQueue(osjob_t* job) {
+// insert job after prev (at the head of the queue if prev is NULL)
+static void insertjob (osjobqueue_t* queue, osjob_t* prev, osjob_t* job) {
+    job->prev = prev;
+    job->next = (prev != NULL) ? prev->next : queue->head;
+    if (job->next != NULL)
+        job->next->prev = job;
+    else
+        queue->tail = job;
+    if (prev != NULL)
+        prev->next = job;
+    else
+        queue->head = job;
+    if (++OS.queued > OS.stats.maxQueued)
+        OS.stats.maxQueued = OS.queued;
+}
+
+static osjobqueue_t* getJobQueue(osjob_t* job) {
     return os_jobIsTimed(job) ? &OS.scheduledjobs : &OS.runnablejobs;
 }
 
@@ -76,33 +107,32 @@ static osjob_t** getJobQueue(osjob_t* job) {
 void os_clearCallback (osjob_t* job) {
     hal_disableIRQs();
 
-    unlinkjob(getJobQueue(job), job);
+    if (unlinkjob(getJobQueue(job), job))
+        OS.stats.cancelled++;
 
     hal_enableIRQs();
 }
 
 // schedule immediately runnable job
 void os_setCallback (osjob_t* job, osjobcb_t cb) {
-    osjob_t** pnext;
     hal_disableIRQs();
 
     // remove if job was already queued
-    unlinkjob(getJobQueue(job), job);
+    if (unlinkjob(getJobQueue(job), job))
+        OS.stats.rescheduled++;
 
-    // fill-in job. Ascending memory order is write-queue friendly
-    job->next = NULL;
+    // fill-in job
     job->deadline = 0;
     job->func = cb;
 
     // add to end of run queue
-    for(pnext=&OS.runnablejobs; *pnext; pnext=&((*pnext)->next));
-    *pnext = job;
+    insertjob(&OS.runnablejobs, OS.runnablejobs.tail, job);
     hal_enableIRQs();
 }
 
 // schedule timed job
 void os_setTimedCallback (osjob_t* job, ostime_t time, osjobcb_t cb) {
-    osjob_t** pnext;
+    osjob_t* prev;
 
     // special case time 0 -- it will be one tick late.
     if (time == 0)
@@ -111,22 +141,20 @@ void os_setTimedCallback (osjob_t* job, ostime_t time, osjobcb_t cb) {
     hal_disableIRQs();
 
     // remove if job was already queued
-    unlinkjob(getJobQueue(job), job);
+    if (unlinkjob(getJobQueue(job), job))
+        OS.stats.rescheduled++;
 
     // fill-in job
-    job->next = NULL;
     job->deadline = time;
     job->func = cb;
 
-    // insert into schedule
-    for(pnext=&OS.scheduledjobs; *pnext; pnext=&((*pnext)->next)) {
-        if((*pnext)->deadline - time > 0) { // (cmp diff, not abs!)
-            // enqueue before next element and stop
-            job->next = *pnext;
+    // insert into schedule after the last job that is not due later.
+    // Search from the end as new jobs are usually due after the queued ones.
+    for(prev = OS.scheduledjobs.tail; prev != NULL; prev = prev->prev) {
+        if(prev->deadline - time <= 0) // (cmp diff, not abs!)
             break;
-        }
     }
-    *pnext = job;
+    insertjob(&OS.scheduledjobs, prev, job);
     hal_enableIRQs();
 }
 
@@ -137,17 +165,37 @@ void os_runloop () {
     }
 }
 
+// record the lateness of a timed job when it is run
+static void recordLateness (osjob_t* job, ostime_t lateness) {
+    u1_t bucket = 0;
+
+    if (lateness > 0) {
+        // bucket n: 2^(n-1) to 2^n - 1 ticks
+        for (bucket = 1; bucket < OSLMIC_LATENESS_BUCKETS - 1 && (lateness >> bucket) != 0; ++bucket)
+            ;
+    }
+    OS.stats.lateness[bucket]++;
+
+    if (OS.stats.timedJobs == 1 || lateness > OS.stats.maxLateness) {
+        OS.stats.maxLateness = lateness;
+        OS.stats.maxLatenessFunc = job->func;
+    }
+}
+
 void os_runloop_once() {
     osjob_t* j = NULL;
     hal_disableIRQs();
     // check for runnable jobs
-    if(OS.runnablejobs) {
-        j = OS.runnablejobs;
-        OS.runnablejobs = j->next;
-    } else if(OS.scheduledjobs && hal_checkTimer(OS.scheduledjobs->deadline)) { // check for expired timed jobs
-        j = OS.scheduledjobs;
-        OS.scheduledjobs = j->next;
-    } else { // nothing pending
+    if(OS.runnablejobs.head) {
+        j = OS.runnablejobs.head;
+        unlinkjob(&OS.runnablejobs, j);
+        OS.stats.runnableJobs++;
+    } else if(OS.scheduledjobs.head && hal_checkTimer(OS.scheduledjobs.head->deadline)) { // check for expired timed jobs
+        j = OS.scheduledjobs.head;
+        unlinkjob(&OS.scheduledjobs, j);
+        OS.stats.timedJobs++;
+        recordLateness(j, os_getTime() - j->deadline);
+    } else if(!hal_processCommands()) { // nothing pending
         hal_sleep(); // wake by irq (timer already restarted)
     }
     hal_enableIRQs();
@@ -156,11 +204,38 @@ void os_runloop_once() {
     }
 }
 
+void os_getSchedulerStats (oslmic_scheduler_stats_t *pStats) {
+    *pStats = OS.stats;
+    pStats->queued = OS.queued;
+}
+
+void os_resetSchedulerStats (void) {
+    memset(&OS.stats, 0, sizeof(OS.stats));
+    OS.stats.maxQueued = OS.queued;
+}
+
+// copy up to maxJobs queued jobs in the order they will run (immediate
+// jobs first), return the number of jobs copied.
+int os_queryJobs (oslmic_job_info_t *pJobs, int maxJobs) {
+    int n = 0;
+    osjob_t* j;
+
+    for (j = OS.runnablejobs.head; j != NULL && n < maxJobs; j = j->next, ++n) {
+        pJobs[n].func = j->func;
+        pJobs[n].deadline = j->deadline;
+    }
+    for (j = OS.scheduledjobs.head; j != NULL && n < maxJobs; j = j->next, ++n) {
+        pJobs[n].func = j->func;
+        pJobs[n].deadline = j->deadline;
+    }
+    return n;
+}
+
 // return true if there are any jobs scheduled within time ticks from now.
 // return false if any jobs scheduled are at least time ticks in the future.
 bit_t os_queryTimeCriticalJobs(ostime_t time) {
-    if (OS.scheduledjobs &&
-        OS.scheduledjobs->deadline - os_getTime() < time)
+    if (OS.scheduledjobs.head &&
+        OS.scheduledjobs.head->deadline - os_getTime() < time)
         return 1;
     else
         return 0;
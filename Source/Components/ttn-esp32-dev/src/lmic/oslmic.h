@@ -99,6 +99,7 @@ u1_t radio_rand1 (void);
 #define DECLARE_LMIC extern struct lmic_t LMIC
 
 typedef struct oslmic_radio_rssi_s oslmic_radio_rssi_t;
+typedef struct oslmic_radio_spi_stats_s oslmic_radio_spi_stats_t;
 
 struct oslmic_radio_rssi_s {
         s2_t    min_rssi;
@@ -107,6 +108,13 @@ struct oslmic_radio_rssi_s {
         u2_t    n_rssi;
 };
 
+struct oslmic_radio_spi_stats_s {
+        u4_t    transactions;   // SPI transactions
+        u4_t    bytes;          // bytes transferred (incl. address)
+        u4_t    writesSkipped;  // register writes skipped (value unchanged)
+        u4_t    readsSkipped;   // register reads served from the shadow copy
+};
+
 int radio_init (void);
 void radio_irq_handler (u1_t dio);
 void radio_irq_handler_v2 (u1_t dio, ostime_t tref);
@@ -116,6 +124,8 @@ void os_runloop (void);
 void os_runloop_once (void);
 u1_t radio_rssi (void);
 void radio_monitor_rssi(ostime_t n, oslmic_radio_rssi_t *pRssi);
+void radio_getSpiStats(oslmic_radio_spi_stats_t *pStats);
+void radio_prepareChannel(u4_t freq, u2_t drmap);
 
 //================================================================================
 
@@ -165,6 +175,7 @@ typedef osjobcbfn_t *osjobcb_t;
 
 struct osjob_t {
     struct osjob_t* next;
+    struct osjob_t* prev;       // NULL if first in queue or not queued
     ostime_t deadline;
     osjobcb_t  func;
 };
@@ -176,6 +187,33 @@ static inline int os_jobIsTimed(xref2osjob_t job) {
     return (job->deadline != 0);
 }
 
+//! number of buckets of the lateness histogram of the scheduler
+enum { OSLMIC_LATENESS_BUCKETS = 16 };
+
+typedef struct oslmic_scheduler_stats_s oslmic_scheduler_stats_t;
+typedef struct oslmic_job_info_s oslmic_job_info_t;
+
+// lateness: time a timed job is run after its deadline (in ticks).
+// Bucket 0 counts jobs run on time or early (timers may expire slightly
+// early), bucket n jobs that are 2^(n-1) to 2^n - 1 ticks late and the
+// last bucket all jobs that are even later.
+struct oslmic_scheduler_stats_s {
+        u4_t      runnableJobs;   // immediate jobs run
+        u4_t      timedJobs;      // timed jobs run
+        u4_t      cancelled;      // queued jobs removed by os_clearCallback()
+        u4_t      rescheduled;    // queued jobs replaced by a new callback
+        u4_t      queued;         // jobs currently queued
+        u4_t      maxQueued;      // maximum number of queued jobs
+        ostime_t  maxLateness;    // largest lateness of a timed job
+        osjobcb_t maxLatenessFunc; // callback of that job
+        u4_t      lateness[OSLMIC_LATENESS_BUCKETS];
+};
+
+struct oslmic_job_info_s {
+        osjobcb_t func;
+        ostime_t  deadline;       // 0 for immediate jobs
+};
+
 #ifndef HAS_os_calls
 
 #ifndef os_getDevKey
@@ -212,6 +250,14 @@ u1_t os_getBattLevel (void);
 //! Return non-zero if any jobs are scheduled between now and now+time.
 bit_t os_queryTimeCriticalJobs(ostime_t time);
 #endif
+#ifndef os_getSchedulerStats
+void os_getSchedulerStats (oslmic_scheduler_stats_t *pStats);
+void os_resetSchedulerStats (void);
+#endif
+#ifndef os_queryJobs
+//! Copy up to maxJobs queued jobs in the order they will run, return their number.
+int os_queryJobs (oslmic_job_info_t *pJobs, int maxJobs);
+#endif
 
 #ifndef os_rlsbf4
 //! Read 32-bit quantity from given pointer in little endian byte order.
@@ -334,13 +380,34 @@ u4_t os_aes (u1_t mode, xref2u1_t buf, u2_t len);
 
 // ======================================================================
 // Simple logging support. Vanishes unless enabled.
+//
+// Each log event belongs to a category. Categories not included in
+// LMIC_LOG_CATEGORIES vanish at compile time. The remaining ones can
+// be switched on and off at runtime with LMICOS_logMask.
+
+#define LMIC_LOG_RADIO      0x01    // radio interrupts
+#define LMIC_LOG_RX         0x02    // decoding of received frames
+#define LMIC_LOG_TX         0x04    // transmission of frames
+#define LMIC_LOG_MAC        0x08    // MAC commands and ADR
+#define LMIC_LOG_CHANNEL    0x10    // channel selection
+#define LMIC_LOG_EVENT      0x20    // LMIC events (reported by the client)
+#define LMIC_LOG_ALL        0x3f
+
+#ifndef LMIC_LOG_CATEGORIES
+# define LMIC_LOG_CATEGORIES LMIC_LOG_ALL
+#endif
 
 #if LMIC_ENABLE_event_logging
-extern void LMICOS_logEvent(const char *pMessage);
-extern void LMICOS_logEventUint32(const char *pMessage, uint32_t datum);
+extern u1_t LMICOS_logMask;
+extern void LMICOS_logEventIn(u1_t category, const char *pMessage);
+extern void LMICOS_logEventUint32In(u1_t category, const char *pMessage, uint32_t datum);
+# define LMICOS_logEnabled(c)   (((c) & LMIC_LOG_CATEGORIES) != 0 && ((c) & LMICOS_logMask) != 0)
+# define LMICOS_logEvent(c, m)  do { if (LMICOS_logEnabled(c)) LMICOS_logEventIn((c), (m)); } while (0)
+# define LMICOS_logEventUint32(c, m, d) do { if (LMICOS_logEnabled(c)) LMICOS_logEventUint32In((c), (m), (d)); } while (0)
 #else // ! LMIC_ENABLE_event_logging
-# define LMICOS_logEvent(m)     do { ; } while (0)
-# define LMICOS_logEventUint32(m, d) do { ; } while (0)
+# define LMICOS_logEnabled(c)   0
+# define LMICOS_logEvent(c, m)  do { ; } while (0)
+# define LMICOS_logEventUint32(c, m, d) do { ; } while (0)
 #endif // ! LMIC_ENABLE_event_logging
 
 
@@ -368,22 +368,250 @@
 static u1_t randbuf[16];
 
 
+// REGISTER SHADOW
+// Copy of the configuration registers last written to or read from the radio.
+// Writes of unchanged values are skipped and reads are served from the copy.
+// Only registers that the radio never changes by itself are shadowed. The
+// copy is invalidated when the radio is reset or switched between LoRa and
+// FSK (different register sets) and on RADIO_RST (the radio might be powered
+// off afterwards).
+static u1_t regShadow[0x80];
+static u4_t regShadowValid[0x80 / 32];
+static u1_t regShadowModem = 0xFF; // OPMODE_LORA bit of last written opmode
+static oslmic_radio_spi_stats_t spiStats;
+
+static bit_t isShadowed (u1_t addr) {
+    switch (addr) {
+    case RegFrfMsb: case RegFrfMid: case RegFrfLsb:
+    case RegPaConfig: case RegPaRamp: case RegOcp: case RegLna:
+    case LORARegFifoTxBaseAddr: case LORARegFifoRxBaseAddr: case LORARegIrqFlagsMask:
+    case LORARegModemConfig1: case LORARegModemConfig2: case LORARegModemConfig3:
+    case LORARegSymbTimeoutLsb: case LORARegPayloadMaxLength:
+    case LORARegIffReq1: case LORARegIffReq2: case LORARegDetectOptimize:
+    case LORARegInvertIQ: case LORARegHighBwOptimize1: case LORARegHighBwOptimize2:
+    case LORARegSyncWord: case RegDioMapping1: case RegPaDac:
+        return regShadowModem == OPMODE_LORA;
+    default:
+        return 0;
+    }
+}
+
+static void invalidateShadow (void) {
+    os_clearMem(regShadowValid, sizeof(regShadowValid));
+}
+
+static bit_t isShadowValid (u1_t addr) {
+    return (regShadowValid[addr >> 5] & (UINT32_C(1) << (addr & 31))) != 0;
+}
+
+static bit_t shadowMatches (u1_t addr, u1_t data) {
+    return isShadowValid(addr) && regShadow[addr] == data;
+}
+
+static void updateShadow (u1_t addr, u1_t data) {
+    if (isShadowed(addr)) {
+        regShadow[addr] = data;
+        regShadowValid[addr >> 5] |= UINT32_C(1) << (addr & 31);
+    }
+}
+
+void radio_getSpiStats (oslmic_radio_spi_stats_t *pStats) {
+    *pStats = spiStats;
+}
+
+static void spiWrite (u1_t addr, xref2u1_t buf, u1_t len) {
+    spiStats.transactions++;
+    spiStats.bytes += 1 + len;
+    hal_spi_write(addr | 0x80, buf, len);
+}
+
+static void spiRead (u1_t addr, xref2u1_t buf, u1_t len) {
+    spiStats.transactions++;
+    spiStats.bytes += 1 + len;
+    hal_spi_read(addr & 0x7f, buf, len);
+}
+
+// REGISTER WRITE BATCH
+// Configuration registers written with batchReg() are collected and sent
+// as SPI bursts of consecutive registers (the radio increments the address
+// in burst mode). The batch is flushed before any other register access,
+// so the order relative to writeReg()/readReg() is preserved. Within a
+// batch, the registers are written in ascending address order; only use
+// it for registers whose write order does not matter.
+#define REG_BATCH_SIZE 24
+
+static struct {
+    u1_t addr[REG_BATCH_SIZE];
+    u1_t data[REG_BATCH_SIZE];
+    u1_t n;
+} regBatch;
+
+static void flushRegs (void) {
+    u1_t const n = regBatch.n;
+    if (n == 0)
+        return;
+    regBatch.n = 0;
+
+    // sort by address (insertion sort, the batch is small)
+    for (u1_t i = 1; i < n; i++) {
+        u1_t const a = regBatch.addr[i];
+        u1_t const d = regBatch.data[i];
+        u1_t j = i;
+        for (; j > 0 && regBatch.addr[j-1] > a; j--) {
+            regBatch.addr[j] = regBatch.addr[j-1];
+            regBatch.data[j] = regBatch.data[j-1];
+        }
+        regBatch.addr[j] = a;
+        regBatch.data[j] = d;
+    }
+
+    // write each run of consecutive registers in one burst
+    u1_t start = 0;
+    for (u1_t i = 1; i <= n; i++) {
+        if (i == n || regBatch.addr[i] != regBatch.addr[i-1] + 1) {
+            spiWrite(regBatch.addr[start], &regBatch.data[start], i - start);
+            start = i;
+        }
+    }
+}
+
+static void batchReg (u1_t addr, u1_t data) {
+    if (shadowMatches(addr, data)) {
+        spiStats.writesSkipped++;
+        return;
+    }
+    updateShadow(addr, data);
+
+    for (u1_t i = 0; i < regBatch.n; i++) {
+        if (regBatch.addr[i] == addr) {
+            regBatch.data[i] = data;
+            return;
+        }
+    }
+    if (regBatch.n == REG_BATCH_SIZE)
+        flushRegs();
+    regBatch.addr[regBatch.n] = addr;
+    regBatch.data[regBatch.n] = data;
+    regBatch.n++;
+}
+
+// RADIO PROFILES
+// Register images for the frequencies, data rates and TX power levels in use,
+// so the bandplan computations are not repeated for every frame. Channel and
+// modem profiles are precomputed when the channel plan is set up (see
+// radio_prepareChannel()); all profiles are also computed on first use. A
+// profile is applied with batchReg(), i.e. unchanged registers are skipped and
+// the others are written in bursts.
+#define PROFILE_REGS 6
+#define PROFILE_KEY  UINT32_C(0x80000000) // marks a used profile
+#define PROFILE_COUNT(table) ((u1_t)(sizeof(table) / sizeof(table[0])))
+
+typedef struct {
+    u4_t key;
+    u1_t n;
+    u1_t addr[PROFILE_REGS];
+    u1_t data[PROFILE_REGS];
+} radioProfile_t;
+
+static radioProfile_t channelProfiles[20];
+static radioProfile_t modemProfiles[16];
+static radioProfile_t powerProfiles[4];
+static u1_t nextChannelProfile, nextModemProfile, nextPowerProfile;
+
+// find the profile with the given key or reuse the next slot (round robin) for it
+static radioProfile_t *findProfile (radioProfile_t *table, u1_t size, u1_t *pNext, u4_t key, bit_t *pIsNew) {
+    for (u1_t i = 0; i < size; i++) {
+        if (table[i].key == key) {
+            *pIsNew = 0;
+            return &table[i];
+        }
+    }
+    radioProfile_t * const p = &table[*pNext];
+    *pNext = (*pNext + 1) % size;
+    p->key = key;
+    p->n = 0;
+    *pIsNew = 1;
+    return p;
+}
+
+static void addProfileReg (radioProfile_t *p, u1_t addr, u1_t data) {
+    for (u1_t i = 0; i < p->n; i++) {
+        if (p->addr[i] == addr) {
+            p->data[i] = data;
+            return;
+        }
+    }
+    ASSERT(p->n < PROFILE_REGS);
+    p->addr[p->n] = addr;
+    p->data[p->n] = data;
+    p->n++;
+}
+
+static void applyProfile (const radioProfile_t *p) {
+    for (u1_t i = 0; i < p->n; i++)
+        batchReg(p->addr[i], p->data[i]);
+}
+
+static void computeModemProfile (radioProfile_t *p, rps_t rps, u4_t freq);
+static void computeChannelProfile (radioProfile_t *p, u4_t freq);
+
+static u4_t modemProfileKey (rps_t rps, u4_t freq) {
+    return PROFILE_KEY | ((u4_t)(freq > SX127X_FREQ_LF_MAX) << 16) | rps;
+}
+
+static void prepareModemProfile (rps_t rps, u4_t freq) {
+    bit_t isNew;
+    radioProfile_t * const p = findProfile(modemProfiles, PROFILE_COUNT(modemProfiles), &nextModemProfile, modemProfileKey(rps, freq), &isNew);
+    if (isNew)
+        computeModemProfile(p, rps, freq);
+}
+
+// precompute the register images for a channel and its data rates (up- and downlink)
+void radio_prepareChannel (u4_t freq, u2_t drmap) {
+    bit_t isNew;
+    radioProfile_t * const p = findProfile(channelProfiles, PROFILE_COUNT(channelProfiles), &nextChannelProfile, PROFILE_KEY | freq, &isNew);
+    if (isNew)
+        computeChannelProfile(p, freq);
+
+    for (dr_t dr = 0; dr < 16 && validDR(dr); dr++) {
+        rps_t const rps = updr2rps(dr);
+        if ((drmap & (1 << dr)) == 0 || getSf(rps) == FSK)
+            continue;
+        prepareModemProfile(rps, freq);
+        prepareModemProfile(dndr2rps(dr), freq);
+    }
+}
+
 static void writeReg (u1_t addr, u1_t data ) {
-    hal_spi_write(addr | 0x80, &data, 1);
+    if (shadowMatches(addr, data)) {
+        spiStats.writesSkipped++;
+        return;
+    }
+    flushRegs();
+    spiWrite(addr, &data, 1);
+    updateShadow(addr, data);
 }
 
 static u1_t readReg (u1_t addr) {
     u1_t buf[1];
-    hal_spi_read(addr & 0x7f, buf, 1);
+    if (isShadowValid(addr)) {
+        spiStats.readsSkipped++;
+        return regShadow[addr];
+    }
+    flushRegs();
+    spiRead(addr, buf, 1);
+    updateShadow(addr, buf[0]);
     return buf[0];
 }
 
 static void writeBuf (u1_t addr, xref2u1_t buf, u1_t len) {
-    hal_spi_write(addr | 0x80, buf, len);
+    flushRegs();
+    spiWrite(addr, buf, len);
 }
 
 static void readBuf (u1_t addr, xref2u1_t buf, u1_t len) {
-    hal_spi_read(addr & 0x7f, buf, len);
+    flushRegs();
+    spiRead(addr, buf, len);
 }
 
 static void requestModuleActive(bit_t state) {
@@ -398,6 +626,11 @@ static void writeOpmode(u1_t mode) {
     if (maskedMode != OPMODE_SLEEP)
         requestModuleActive(1);
     writeReg(RegOpMode, mode);
+    // LoRa and FSK use different registers
+    if ((mode & OPMODE_LORA) != regShadowModem) {
+        invalidateShadow();
+        regShadowModem = mode & OPMODE_LORA;
+    }
     if (maskedMode == OPMODE_SLEEP)
         requestModuleActive(0);
 }
@@ -427,14 +660,14 @@ static void opmodeFSK() {
     writeOpmode(u);
 }
 
-// configure LoRa modem (cfg1, cfg2)
-static void configLoraModem () {
-    sf_t sf = getSf(LMIC.rps);
+// compute LoRa modem configuration (cfg1, cfg2)
+static void computeModemProfile (radioProfile_t *p, rps_t rps, u4_t freq) {
+    sf_t sf = getSf(rps);
 
 #ifdef CFG_sx1276_radio
         u1_t mc1 = 0, mc2 = 0, mc3 = 0;
 
-        bw_t const bw = getBw(LMIC.rps);
+        bw_t const bw = getBw(rps);
 
         switch (bw) {
         case BW125: mc1 |= SX1276_MC1_BW_125; break;
@@ -443,7 +676,7 @@ static void configLoraModem () {
         default:
             ASSERT(0);
         }
-        switch( getCr(LMIC.rps) ) {
+        switch( getCr(rps) ) {
         case CR_4_5: mc1 |= SX1276_MC1_CR_4_5; break;
         case CR_4_6: mc1 |= SX1276_MC1_CR_4_6; break;
         case CR_4_7: mc1 |= SX1276_MC1_CR_4_7; break;
@@ -452,18 +685,18 @@ static void configLoraModem () {
             ASSERT(0);
         }
 
-        if (getIh(LMIC.rps)) {
+        if (getIh(rps)) {
             mc1 |= SX1276_MC1_IMPLICIT_HEADER_MODE_ON;
-            writeReg(LORARegPayloadLength, getIh(LMIC.rps)); // required length
+            addProfileReg(p, LORARegPayloadLength, getIh(rps)); // required length
         }
         // set ModemConfig1
-        writeReg(LORARegModemConfig1, mc1);
+        addProfileReg(p, LORARegModemConfig1, mc1);
 
         mc2 = (SX1272_MC2_SF7 + ((sf-1)<<4));
-        if (getNocrc(LMIC.rps) == 0) {
+        if (getNocrc(rps) == 0) {
             mc2 |= SX1276_MC2_RX_PAYLOAD_CRCON;
         }
-        writeReg(LORARegModemConfig2, mc2);
+        addProfileReg(p, LORARegModemConfig2, mc2);
 
         mc3 = SX1276_MC3_AGCAUTO;
 
@@ -471,7 +704,7 @@ static void configLoraModem () {
              ((sf == SF12) && bw == BW250) ) {
             mc3 |= SX1276_MC3_LOW_DATA_RATE_OPTIMIZE;
         }
-        writeReg(LORARegModemConfig3, mc3);
+        addProfileReg(p, LORARegModemConfig3, mc3);
 
         // Errata 2.1: Sensitivity optimization with 500 kHz bandwidth
         u1_t rHighBwOptimize1;
@@ -481,7 +714,7 @@ static void configLoraModem () {
         rHighBwOptimize2 = 0;
 
         if (bw == BW500) {
-            if (LMIC.freq > SX127X_FREQ_LF_MAX) {
+            if (freq > SX127X_FREQ_LF_MAX) {
                 rHighBwOptimize1 = 0x02;
                 rHighBwOptimize2 = 0x64;
             } else {
@@ -490,42 +723,42 @@ static void configLoraModem () {
             }
         }
 
-        writeReg(LORARegHighBwOptimize1, rHighBwOptimize1);
+        addProfileReg(p, LORARegHighBwOptimize1, rHighBwOptimize1);
         if (rHighBwOptimize2 != 0)
-            writeReg(LORARegHighBwOptimize2, rHighBwOptimize2);
+            addProfileReg(p, LORARegHighBwOptimize2, rHighBwOptimize2);
 
 #elif CFG_sx1272_radio
-        u1_t mc1 = (getBw(LMIC.rps)<<6);
+        u1_t mc1 = (getBw(rps)<<6);
 
-        switch( getCr(LMIC.rps) ) {
+        switch( getCr(rps) ) {
         case CR_4_5: mc1 |= SX1272_MC1_CR_4_5; break;
         case CR_4_6: mc1 |= SX1272_MC1_CR_4_6; break;
         case CR_4_7: mc1 |= SX1272_MC1_CR_4_7; break;
         case CR_4_8: mc1 |= SX1272_MC1_CR_4_8; break;
         }
 
-        if ((sf == SF11 || sf == SF12) && getBw(LMIC.rps) == BW125) {
+        if ((sf == SF11 || sf == SF12) && getBw(rps) == BW125) {
             mc1 |= SX1272_MC1_LOW_DATA_RATE_OPTIMIZE;
         }
 
-        if (getNocrc(LMIC.rps) == 0) {
+        if (getNocrc(rps) == 0) {
             mc1 |= SX1272_MC1_RX_PAYLOAD_CRCON;
         }
 
-        if (getIh(LMIC.rps)) {
+        if (getIh(rps)) {
             mc1 |= SX1272_MC1_IMPLICIT_HEADER_MODE_ON;
-            writeReg(LORARegPayloadLength, getIh(LMIC.rps)); // required length
+            addProfileReg(p, LORARegPayloadLength, getIh(rps)); // required length
         }
         // set ModemConfig1
-        writeReg(LORARegModemConfig1, mc1);
+        addProfileReg(p, LORARegModemConfig1, mc1);
 
         // set ModemConfig2 (sf, AgcAutoOn=1 SymbTimeoutHi=00)
-        writeReg(LORARegModemConfig2, (SX1272_MC2_SF7 + ((sf-1)<<4)) | 0x04);
+        addProfileReg(p, LORARegModemConfig2, (SX1272_MC2_SF7 + ((sf-1)<<4)) | 0x04);
 
 #if CFG_TxContinuousMode
         // Only for testing
         // set ModemConfig2 (sf, TxContinuousMode=1, AgcAutoOn=1 SymbTimeoutHi=00)
-        writeReg(LORARegModemConfig2, (SX1272_MC2_SF7 + ((sf-1)<<4)) | 0x06);
+        addProfileReg(p, LORARegModemConfig2, (SX1272_MC2_SF7 + ((sf-1)<<4)) | 0x06);
 #endif
 
 #else
@@ -533,12 +766,29 @@ static void configLoraModem () {
 #endif /* CFG_sx1272_radio */
 }
 
-static void configChannel () {
+// configure LoRa modem (cfg1, cfg2)
+static void configLoraModem () {
+    bit_t isNew;
+    radioProfile_t * const p = findProfile(modemProfiles, PROFILE_COUNT(modemProfiles), &nextModemProfile, modemProfileKey(LMIC.rps, LMIC.freq), &isNew);
+    if (isNew)
+        computeModemProfile(p, LMIC.rps, LMIC.freq);
+    applyProfile(p);
+}
+
+static void computeChannelProfile (radioProfile_t *p, u4_t freq) {
     // set frequency: FQ = (FRF * 32 Mhz) / (2 ^ 19)
-    uint64_t frf = ((uint64_t)LMIC.freq << 19) / 32000000;
-    writeReg(RegFrfMsb, (u1_t)(frf>>16));
-    writeReg(RegFrfMid, (u1_t)(frf>> 8));
-    writeReg(RegFrfLsb, (u1_t)(frf>> 0));
+    uint64_t frf = ((uint64_t)freq << 19) / 32000000;
+    addProfileReg(p, RegFrfMsb, (u1_t)(frf>>16));
+    addProfileReg(p, RegFrfMid, (u1_t)(frf>> 8));
+    addProfileReg(p, RegFrfLsb, (u1_t)(frf>> 0));
+}
+
+static void configChannel () {
+    bit_t isNew;
+    radioProfile_t * const p = findProfile(channelProfiles, PROFILE_COUNT(channelProfiles), &nextChannelProfile, PROFILE_KEY | LMIC.freq, &isNew);
+    if (isNew)
+        computeChannelProfile(p, LMIC.freq);
+    applyProfile(p);
 }
 
 // On the SX1276, we have several possible configs.
@@ -567,9 +817,8 @@ static void configChannel () {
 // need to be.
 //
 
-static void configPower () {
-    // our input paramter -- might be different than LMIC.txpow!
-    s1_t const req_pw = (s1_t)LMIC.radio_txpow;
+static void computePowerProfile (radioProfile_t *p, s1_t req_pw, rps_t rps, u4_t freq) {
+    // req_pw is our input paramter -- might be different than LMIC.txpow!
     // the effective power
     s1_t eff_pw;
     // the policy; we're going to compute this.
@@ -601,7 +850,7 @@ static void configPower () {
         }
     }
 
-    policy = hal_getTxPowerPolicy(policy, eff_pw, LMIC.freq);
+    policy = hal_getTxPowerPolicy(policy, eff_pw, freq);
 
     switch (policy) {
     default:
@@ -627,7 +876,7 @@ static void configPower () {
     // (And, of course, it might also be too large.)
     case LMICHAL_radio_tx_power_policy_paboost:
         // It seems that SX127x doesn't like eff_pw 10 when in FSK mode.
-        if (getSf(LMIC.rps) == FSK && eff_pw < 11) {
+        if (getSf(rps) == FSK && eff_pw < 11) {
             eff_pw = 11;
         }
         rPaDac = SX127X_PADAC_POWER_NORMAL;
@@ -666,7 +915,7 @@ static void configPower () {
         }
     }
 
-    policy = hal_getTxPowerPolicy(policy, eff_pw, LMIC.freq);
+    policy = hal_getTxPowerPolicy(policy, eff_pw, freq);
 
     switch (policy) {
     default:
@@ -701,9 +950,21 @@ static void configPower () {
 #error Missing CFG_sx1272_radio/CFG_sx1276_radio
 #endif /* CFG_sx1272_radio */
 
-    writeReg(RegPaConfig, rPaConfig);
-    writeReg(RegPaDac, (readReg(RegPaDac) & ~SX127X_PADAC_POWER_MASK) | rPaDac);
-    writeReg(RegOcp, rOcp | SX127X_OCP_ENA);
+    addProfileReg(p, RegPaConfig, rPaConfig);
+    addProfileReg(p, RegPaDac, (readReg(RegPaDac) & ~SX127X_PADAC_POWER_MASK) | rPaDac);
+    addProfileReg(p, RegOcp, rOcp | SX127X_OCP_ENA);
+}
+
+static void configPower () {
+    // the policy depends on the power, the modem and the frequency band
+    s1_t const req_pw = (s1_t)LMIC.radio_txpow;
+    u4_t const key = PROFILE_KEY | ((u4_t)(getSf(LMIC.rps) == FSK) << 9)
+        | ((u4_t)(LMIC.freq > SX127X_FREQ_LF_MAX) << 8) | (u1_t)req_pw;
+    bit_t isNew;
+    radioProfile_t * const p = findProfile(powerProfiles, PROFILE_COUNT(powerProfiles), &nextPowerProfile, key, &isNew);
+    if (isNew)
+        computePowerProfile(p, req_pw, LMIC.rps, LMIC.freq);
+    applyProfile(p);
 }
 
 static void setupFskRxTx(bit_t fDisableAutoClear) {
@@ -781,26 +1042,26 @@ static void txlora () {
     // configure frequency
     configChannel();
     // configure output power
+    configPower();
 #ifdef CFG_sx1272_radio
     writeReg(RegPaRamp, (readReg(RegPaRamp) & 0xF0) | 0x08); // set PA ramp-up time 50 uSec
 #elif defined(CFG_sx1276_radio)
-    writeReg(RegPaRamp, 0x08);     // set PA ramp-up time 50 uSec, clear FSK bits
+    batchReg(RegPaRamp, 0x08);     // set PA ramp-up time 50 uSec, clear FSK bits
 #endif
-    configPower();
     // set sync word
-    writeReg(LORARegSyncWord, LORA_MAC_PREAMBLE);
+    batchReg(LORARegSyncWord, LORA_MAC_PREAMBLE);
 
     // set the IRQ mapping DIO0=TxDone DIO1=NOP DIO2=NOP
-    writeReg(RegDioMapping1, MAP_DIO0_LORA_TXDONE|MAP_DIO1_LORA_NOP|MAP_DIO2_LORA_NOP);
+    batchReg(RegDioMapping1, MAP_DIO0_LORA_TXDONE|MAP_DIO1_LORA_NOP|MAP_DIO2_LORA_NOP);
     // clear all radio IRQ flags
-    writeReg(LORARegIrqFlags, 0xFF);
+    batchReg(LORARegIrqFlags, 0xFF);
     // mask all IRQs but TxDone
-    writeReg(LORARegIrqFlagsMask, ~IRQ_LORA_TXDONE_MASK);
+    batchReg(LORARegIrqFlagsMask, (u1_t)~IRQ_LORA_TXDONE_MASK);
 
     // initialize the payload size and address pointers
-    writeReg(LORARegFifoTxBaseAddr, 0x00);
-    writeReg(LORARegFifoAddrPtr, 0x00);
-    writeReg(LORARegPayloadLength, LMIC.dataLen);
+    batchReg(LORARegFifoTxBaseAddr, 0x00);
+    batchReg(LORARegFifoAddrPtr, 0x00);
+    batchReg(LORARegPayloadLength, LMIC.dataLen);
 
     // download buffer to the radio FIFO
     writeBuf(RegFifo, LMIC.frame, LMIC.dataLen);
@@ -877,10 +1138,15 @@ static void rxlora (u1_t rxmode) {
     ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
     // enter standby mode (warm up))
     opmode(OPMODE_STANDBY);
+    // read the registers to modify before collecting the register writes
+#if !defined(DISABLE_INVERT_IQ_ON_RX) /* DEPRECATED(tmm@mcci.com); #250. remove test, always include code in V3 */
+    u1_t const rInvertIQ = readReg(LORARegInvertIQ);
+#endif
+    u1_t const rDetectOptimize = (readReg(LORARegDetectOptimize) & 0x78) | 0x03;
     // don't use MAC settings at startup
     if(rxmode == RXMODE_RSSI) { // use fixed settings for rssi scan
-        writeReg(LORARegModemConfig1, RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG1);
-        writeReg(LORARegModemConfig2, RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG2);
+        batchReg(LORARegModemConfig1, RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG1);
+        batchReg(LORARegModemConfig2, RXLORA_RXMODE_RSSI_REG_MODEM_CONFIG2);
     } else { // single or continuous rx mode
         // configure LoRa modem (cfg1, cfg2)
         configLoraModem();
@@ -888,53 +1154,56 @@ static void rxlora (u1_t rxmode) {
         configChannel();
     }
     // set LNA gain
-    writeReg(RegLna, LNA_RX_GAIN);
+    batchReg(RegLna, LNA_RX_GAIN);
     // set max payload size
-    writeReg(LORARegPayloadMaxLength, MAX_LEN_FRAME);
+    batchReg(LORARegPayloadMaxLength, MAX_LEN_FRAME);
 #if !defined(DISABLE_INVERT_IQ_ON_RX) /* DEPRECATED(tmm@mcci.com); #250. remove test, always include code in V3 */
     // use inverted I/Q signal (prevent mote-to-mote communication)
 
     // XXX: use flag to switch on/off inversion
     if (LMIC.noRXIQinversion) {
-        writeReg(LORARegInvertIQ, readReg(LORARegInvertIQ) & ~(1<<6));
+        batchReg(LORARegInvertIQ, rInvertIQ & ~(1<<6));
     } else {
-        writeReg(LORARegInvertIQ, readReg(LORARegInvertIQ)|(1<<6));
+        batchReg(LORARegInvertIQ, rInvertIQ|(1<<6));
     }
 #endif
 
     // Errata 2.3 - receiver spurious reception of a LoRa signal
     bw_t const bw = getBw(LMIC.rps);
-    u1_t const rDetectOptimize = (readReg(LORARegDetectOptimize) & 0x78) | 0x03;
     if (bw < BW500) {
-        writeReg(LORARegDetectOptimize, rDetectOptimize);
-        writeReg(LORARegIffReq1, 0x40);
-        writeReg(LORARegIffReq2, 0x40);
+        batchReg(LORARegDetectOptimize, rDetectOptimize);
+        batchReg(LORARegIffReq1, 0x40);
+        batchReg(LORARegIffReq2, 0x40);
     } else {
-        writeReg(LORARegDetectOptimize, rDetectOptimize | 0x80);
+        batchReg(LORARegDetectOptimize, rDetectOptimize | 0x80);
     }
 
     // set symbol timeout (for single rx)
-    writeReg(LORARegSymbTimeoutLsb, LMIC.rxsyms);
+    batchReg(LORARegSymbTimeoutLsb, LMIC.rxsyms);
     // set sync word
-    writeReg(LORARegSyncWord, LORA_MAC_PREAMBLE);
+    batchReg(LORARegSyncWord, LORA_MAC_PREAMBLE);
 
     // configure DIO mapping DIO0=RxDone DIO1=RxTout DIO2=NOP
-    writeReg(RegDioMapping1, MAP_DIO0_LORA_RXDONE|MAP_DIO1_LORA_RXTOUT|MAP_DIO2_LORA_NOP);
+    batchReg(RegDioMapping1, MAP_DIO0_LORA_RXDONE|MAP_DIO1_LORA_RXTOUT|MAP_DIO2_LORA_NOP);
     // clear all radio IRQ flags
-    writeReg(LORARegIrqFlags, 0xFF);
+    batchReg(LORARegIrqFlags, 0xFF);
     // enable required radio IRQs
-    writeReg(LORARegIrqFlagsMask, ~TABLE_GET_U1(rxlorairqmask, rxmode));
+    batchReg(LORARegIrqFlagsMask, (u1_t)~TABLE_GET_U1(rxlorairqmask, rxmode));
+
+    batchReg(LORARegFifoAddrPtr, 0);
+    batchReg(LORARegFifoRxBaseAddr, 0);
+    flushRegs();
 
     // enable antenna switch for RX
     hal_pin_rxtx(0);
 
-    writeReg(LORARegFifoAddrPtr, 0);
-    writeReg(LORARegFifoRxBaseAddr, 0);
-
     // now instruct the radio to receive
     if (rxmode == RXMODE_SINGLE) { // single rx
         hal_waitUntil(LMIC.rxtime); // busy wait until exact rx time
         opmode(OPMODE_RX_SINGLE);
+#if LMIC_ENABLE_radio_timing
+        hal_rxWindowOpened(LMIC.rxtime, os_getTime());
+#endif
 #if LMIC_DEBUG_LEVEL > 0
         ostime_t now = os_getTime();
         LMIC_DEBUG_PRINTF("start single rx: now-rxtime: %"LMIC_PRId_ostime_t"\n", now - LMIC.rxtime);
@@ -997,6 +1266,9 @@ static void rxfsk (u1_t rxmode) {
     // now instruct the radio to receive
     hal_waitUntil(LMIC.rxtime); // busy wait until exact rx time
     opmode(OPMODE_RX); // no single rx mode available in FSK
+#if LMIC_ENABLE_radio_timing
+    hal_rxWindowOpened(LMIC.rxtime, os_getTime());
+#endif
 }
 
 static void startrx (u1_t rxmode) {
@@ -1025,6 +1297,7 @@ int radio_init () {
     hal_waitUntil(os_getTime()+ms2osticks(1)); // wait >100us
     hal_pin_rst(2); // configure RST pin floating!
     hal_waitUntil(os_getTime()+ms2osticks(5)); // wait 5ms
+    invalidateShadow();
 
     opmode(OPMODE_SLEEP);
 
@@ -1219,8 +1492,12 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
 #endif
     if( (readReg(RegOpMode) & OPMODE_LORA) != 0) { // LORA modem
         u1_t flags = readReg(LORARegIrqFlags);
+        if( (flags & (IRQ_LORA_TXDONE_MASK|IRQ_LORA_RXDONE_MASK|IRQ_LORA_RXTOUT_MASK)) == 0 ) {
+            // stale interrupt of an aborted operation (e.g. continuous Class C reception)
+            return;
+        }
         LMIC.saveIrqFlags = flags;
-        LMICOS_logEventUint32("radio_irq_handler_v2: LoRa", flags);
+        LMICOS_logEventUint32(LMIC_LOG_RADIO, "radio_irq_handler_v2: LoRa", flags);
         LMIC_X_DEBUG_PRINTF("IRQ=%02x\n", flags);
         if( flags & IRQ_LORA_TXDONE_MASK ) {
             // save exact tx time
@@ -1243,6 +1520,9 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
             LMIC.rssi = readReg(LORARegPktRssiValue);
             LMIC_X_DEBUG_PRINTF("RX snr=%u rssi=%d\n", LMIC.snr/4, SX127X_RSSI_ADJUST_HF + LMIC.rssi);
             LMIC.rssi = LMIC.rssi - 125 + 64; // RSSI [dBm] (-196...+63)
+#if LMIC_ENABLE_radio_timing
+            hal_rxFrameReceived(LMIC.rxtime);
+#endif
         } else if( flags & IRQ_LORA_RXTOUT_MASK ) {
             // indicate timeout
             LMIC.dataLen = 0;
@@ -1260,7 +1540,7 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
         u1_t flags1 = readReg(FSKRegIrqFlags1);
         u1_t flags2 = readReg(FSKRegIrqFlags2);
 
-        LMICOS_logEventUint32("radio_irq_handler_v2: FSK", (flags2 << UINT32_C(8)) | flags1);
+        LMICOS_logEventUint32(LMIC_LOG_RADIO, "radio_irq_handler_v2: FSK", (flags2 << UINT32_C(8)) | flags1);
 
         if( flags2 & IRQ_FSK2_PACKETSENT_MASK ) {
             // save exact tx time
@@ -1275,6 +1555,9 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
             // read rx quality parameters
             LMIC.snr  = 0; // determine snr
             LMIC.rssi = 0; // determine rssi
+#if LMIC_ENABLE_radio_timing
+            hal_rxFrameReceived(LMIC.rxtime);
+#endif
         } else if( flags1 & IRQ_FSK1_TIMEOUT_MASK ) {
             // indicate timeout
             LMIC.dataLen = 0;
@@ -1300,6 +1583,7 @@ void os_radio (u1_t mode) {
       case RADIO_RST:
         // put radio to sleep
         opmode(OPMODE_SLEEP);
+        invalidateShadow();
         break;
 
       case RADIO_TX:
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+# *****************************************************************************
+#
+# ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+#
+# Copyright (c) 2019 ContextQuickie
+#
+# Licensed under MIT License
+# https://opensource.org/licenses/MIT
+#
+# Decoder for the binary LMIC event trace.
+#
+# The trace is output on the console by 'TheThingsNetwork::dumpEventTrace()'.
+# Save the console output (e.g. from 'make monitor') in a file and run:
+#
+#     python3 decode_trace.py console.log
+#
+# Without a file name, the console output is read from stdin.
+# *****************************************************************************
+
+import fileinput
+import struct
+import sys
+
+TRACE_VERSION = 1
+RECORD_FORMAT = '<BBHHBBBBHI'
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+TYPE_EVENT = 0x00
+TYPE_MESSAGE = 0x40
+TYPE_DATUM = 0x80
+TYPE_FATAL = 0xc0
+
+EVENT_NAMES = [
+    'START', 'EV_SCAN_TIMEOUT', 'EV_BEACON_FOUND',
+    'EV_BEACON_MISSED', 'EV_BEACON_TRACKED', 'EV_JOINING',
+    'EV_JOINED', 'EV_RFU1', 'EV_JOIN_FAILED', 'EV_REJOIN_FAILED',
+    'EV_TXCOMPLETE', 'EV_LOST_TSYNC', 'EV_RESET',
+    'EV_RXCOMPLETE', 'EV_LINK_DEAD', 'EV_LINK_ALIVE', 'EV_SCAN_FOUND',
+    'EV_TXSTART', 'EV_TXCANCELED', 'EV_RXSTART', 'EV_JOIN_TXCOMPLETE'
+]
+EV_TXCOMPLETE = 10
+EV_TXSTART = 17
+EV_RXSTART = 19
+
+SF_NAMES = ['FSK', 'SF7', 'SF8', 'SF9', 'SF10', 'SF11', 'SF12', 'SFrfu']
+BW_NAMES = ['BW125', 'BW250', 'BW500', 'BWrfu']
+CR_NAMES = ['CR 4/5', 'CR 4/6', 'CR 4/7', 'CR 4/8']
+CRC_NAMES = ['Crc', 'NoCrc']
+
+
+class Record:
+    def __init__(self, data):
+        (self.type, self.rps, self.delta, self.opmode, self.txrx_flags,
+            self.irq_flags, self.channel, self.rxsyms, self.freq,
+            self.datum) = struct.unpack(RECORD_FORMAT, data)
+
+    def kind(self):
+        return self.type & 0xc0
+
+    def id(self):
+        return self.type & 0x3f
+
+    def delta_ticks(self):
+        if self.delta & 0x8000:
+            return (self.delta & 0x7fff) << 10
+        return self.delta
+
+
+class Trace:
+    def __init__(self, header):
+        fields = header.split()
+        self.version = int(fields[0])
+        self.record_size = int(fields[1])
+        self.ticks_per_sec = int(fields[2])
+        self.num_records = int(fields[3])
+        self.total_records = int(fields[4])
+        self.messages = {}
+        self.records = []
+
+    def add_message(self, line):
+        id, _, text = line.partition(' ')
+        self.messages[int(id)] = text
+
+    def add_record(self, line):
+        self.records.append(Record(bytes.fromhex(line.strip())))
+
+    def ms(self, ticks):
+        return ticks * 1000.0 / self.ticks_per_sec
+
+    def message(self, record):
+        return self.messages.get(record.id(), '<unknown message>')
+
+    def decode(self):
+        if self.version != TRACE_VERSION or self.record_size != RECORD_SIZE:
+            print('Unsupported trace format (version %d, record size %d)' % (self.version, self.record_size))
+            return
+
+        print('%d records (%d recorded, %d overwritten)' % (
+            len(self.records), self.total_records, self.total_records - len(self.records)))
+
+        # Times are absolute (LMIC ticks) after a start record, otherwise relative to the first record
+        time = 0
+        absolute = False
+        for record in self.records:
+            if record.kind() == TYPE_EVENT and record.id() == 0:
+                time = record.datum
+                absolute = True
+            else:
+                time = (time + record.delta_ticks()) & 0xffffffff
+            prefix = '%10.3f ms' % self.ms(time) if absolute else '+%9.3f ms' % self.ms(time)
+            lines = self.describe(record, time)
+            print('%s - %s' % (prefix, lines[0]))
+            for line in lines[1:]:
+                print('%s   %s' % (' ' * len(prefix), line))
+
+    def describe(self, record, time):
+        kind = record.kind()
+        if kind == TYPE_MESSAGE:
+            return ['%s: opmode=%x' % (self.message(record), record.opmode)]
+
+        if kind == TYPE_DATUM:
+            return ['%s: datum=0x%x, opmode=%x' % (self.message(record), record.datum, record.opmode)]
+
+        if kind == TYPE_FATAL:
+            return [
+                'FATAL %s, %d' % (self.message(record), record.datum),
+                '- freq=%s, ch=%u, rps=0x%02x (%s)' % (self.freq(record), record.channel, record.rps, self.rps(record)),
+                '- opmode=%x, txrxFlags=0x%02x, saveIrqFlags=0x%02x' % (record.opmode, record.txrx_flags, record.irq_flags)
+            ]
+
+        event = record.id()
+        name = EVENT_NAMES[event] if event < len(EVENT_NAMES) else 'EV_%d' % event
+        if event == 0:
+            return ['%s (reset or wake-up)' % name]
+
+        lines = [name]
+        if event == EV_TXSTART:
+            lines.append('- freq=%s, ch=%u, rps=0x%02x (%s), opmode=%x' % (
+                self.freq(record), record.channel, record.rps, self.rps(record), record.opmode))
+        elif event == EV_TXCOMPLETE:
+            lines.append('- ch=%u, rps=0x%02x (%s), txrxFlags=0x%02x%s, txend=%u' % (
+                record.channel, record.rps, self.rps(record), record.txrx_flags,
+                '; received ack' if record.txrx_flags & 0x80 else '', record.datum))
+        elif event == EV_RXSTART:
+            delta = (time - record.datum) & 0xffffffff
+            if delta >= 0x80000000:
+                delta -= 0x100000000
+            lines.append('- freq=%s, rps=0x%02x (%s)' % (self.freq(record), record.rps, self.rps(record)))
+            lines.append('- delta=%.3fms, rxsyms=%u, saveIrqFlags=0x%02x' % (
+                self.ms(delta), record.rxsyms, record.irq_flags))
+        else:
+            lines.append('- opmode=%x, txrxFlags=0x%02x, saveIrqFlags=0x%02x' % (
+                record.opmode, record.txrx_flags, record.irq_flags))
+        return lines
+
+    @staticmethod
+    def freq(record):
+        return '%.3f' % (record.freq * 0.025)
+
+    @staticmethod
+    def rps(record):
+        rps = record.rps
+        return '%s, %s, %s, %s' % (SF_NAMES[rps & 7], BW_NAMES[(rps >> 3) & 3],
+            CR_NAMES[(rps >> 5) & 3], CRC_NAMES[(rps >> 7) & 1])
+
+
+def main():
+    trace = None
+    found = False
+    for line in fileinput.input():
+        # Ignore everything before the marker (e.g. log prefixes or colors)
+        pos = line.find('TTN-TRACE ')
+        if pos < 0:
+            continue
+        command, _, args = line[pos + 10:].rstrip().partition(' ')
+
+        if command == 'BEGIN':
+            trace = Trace(args)
+        elif trace is None:
+            continue
+        elif command == 'MSG':
+            trace.add_message(args)
+        elif command == 'REC':
+            trace.add_record(args)
+        elif command == 'END':
+            trace.decode()
+            trace = None
+            found = True
+
+    if not found:
+        print('No complete trace found', file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
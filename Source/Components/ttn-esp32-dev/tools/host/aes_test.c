@@ -0,0 +1,228 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Test vectors and benchmark for the AES implementation of LMIC ('os_aes').
+ *
+ * The encryption and CMAC are checked against the vectors of FIPS-197 and
+ * RFC 4493. The MIC with the B0 block and the counter mode (as used for
+ * LoRaWAN frames) are checked against the independent implementation of the
+ * network server ('ns_crypto.c'), with keys changing between the calls so
+ * that the key schedule cache is replaced and reused.
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "lmic/lmic.h"
+#include "aes_test.h"
+#include "ns_crypto.h"
+
+
+// FIPS-197, appendix C.1
+static const uint8_t fipsKey[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+static const uint8_t fipsPlaintext[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+static const uint8_t fipsCiphertext[16] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+};
+
+// RFC 4493, section 4 (LMIC does not compute the MAC of empty messages)
+static const uint8_t cmacKey[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const uint8_t cmacMessage[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+static const struct
+{
+    uint8_t length;
+    uint8_t mac[16];
+} cmacVectors[] = {
+    { 16, { 0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c } },
+    { 40, { 0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27 } },
+    { 64, { 0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe } },
+};
+
+// More keys than the cache holds
+#define NUM_KEYS 5
+static uint8_t testKeys[NUM_KEYS][16];
+
+static int failures;
+
+
+static void initKeys(void)
+{
+    for (int k = 0; k < NUM_KEYS; k++)
+    {
+        for (int i = 0; i < 16; i++)
+            testKeys[k][i] = (uint8_t)(k * 37 + i * 11 + 1);
+    }
+}
+
+static void check(bool ok, const char* test)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", test);
+        failures++;
+    }
+}
+
+static uint32_t readMsbf4(const uint8_t* buf)
+{
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+// Block B0 (MIC) or A1 (encryption) of a LoRaWAN frame
+static void frameBlock(uint8_t block[16], uint8_t first, uint8_t len)
+{
+    memset(block, 0, 16);
+    block[0] = first;
+    block[6] = 0x78;    // device address
+    block[7] = 0x56;
+    block[8] = 0x34;
+    block[9] = 0x12;
+    block[10] = 0x2a;   // frame counter
+    block[15] = len;
+}
+
+static void testVectors(void)
+{
+    uint8_t buf[64];
+
+    memcpy(AESkey, fipsKey, 16);
+    memcpy(buf, fipsPlaintext, 16);
+    os_aes(AES_ENC, buf, 16);
+    check(memcmp(buf, fipsCiphertext, 16) == 0, "FIPS-197 encryption");
+
+    for (size_t i = 0; i < sizeof(cmacVectors) / sizeof(cmacVectors[0]); i++)
+    {
+        memcpy(AESkey, cmacKey, 16);
+        memcpy(buf, cmacMessage, sizeof(cmacMessage));
+        uint32_t mic = os_aes(AES_MIC | AES_MICNOAUX, buf, cmacVectors[i].length);
+        check(mic == readMsbf4(cmacVectors[i].mac), "RFC 4493 CMAC");
+    }
+}
+
+// Secure frames with changing keys and compare with the network server implementation
+static void testFrames(void)
+{
+    initKeys();
+
+    // repeat the pattern so the keys are both found in and evicted from the cache
+    static const uint8_t keyOrder[] = { 0, 1, 0, 1, 2, 0, 3, 4, 1, 1, 4, 2, 0 };
+    for (size_t n = 0; n < sizeof(keyOrder) / sizeof(keyOrder[0]); n++)
+    {
+        const uint8_t* key = testKeys[keyOrder[n]];
+        uint8_t len = (uint8_t)(1 + n * 7 % 50);
+        uint8_t msg[64], expected[64], block[16], mac[16];
+        for (int i = 0; i < len; i++)
+            msg[i] = (uint8_t)(n + i * 3);
+
+        // MIC with block B0 prepended
+        uint8_t b0msg[16 + 64];
+        frameBlock(b0msg, 0x49, len);
+        memcpy(b0msg + 16, msg, len);
+        ns_crypto_cmac(key, b0msg, 16 + len, mac);
+        memcpy(AESkey, key, 16);
+        frameBlock(AESaux, 0x49, len);
+        check(os_aes(AES_MIC, msg, len) == readMsbf4(mac), "MIC with B0 block");
+
+        // counter mode with blocks A1, A2, ...
+        memcpy(expected, msg, len);
+        for (int i = 0; i < len; i += 16)
+        {
+            frameBlock(block, 0x01, (uint8_t)(1 + i / 16));
+            ns_crypto_encrypt(key, block);
+            for (int j = i; j < len && j < i + 16; j++)
+                expected[j] ^= block[j - i];
+        }
+        memcpy(AESkey, key, 16);
+        frameBlock(AESaux, 0x01, 1);
+        os_aes(AES_CTR, msg, len);
+        check(memcmp(msg, expected, len) == 0, "counter mode encryption");
+
+        // single block encryption
+        memcpy(expected, msg, 16);
+        ns_crypto_encrypt(key, expected);
+        memcpy(AESkey, key, 16);
+        os_aes(AES_ENC, msg, 16);
+        check(memcmp(msg, expected, 16) == 0, "block encryption");
+    }
+
+    // a key differing in the last byte only must not use the cached schedule
+    uint8_t buf[16] = { 0 }, expected[16] = { 0 };
+    memcpy(AESkey, testKeys[0], 16);
+    os_aes(AES_ENC, buf, 16);
+    memset(buf, 0, 16);
+    testKeys[0][15] ^= 0x01;
+    ns_crypto_encrypt(testKeys[0], expected);
+    memcpy(AESkey, testKeys[0], 16);
+    os_aes(AES_ENC, buf, 16);
+    check(memcmp(buf, expected, 16) == 0, "changed key");
+}
+
+int aes_test_run(void)
+{
+    failures = 0;
+    testVectors();
+    testFrames();
+    printf("AES tests: %s (%d failures)\n", failures == 0 ? "passed" : "FAILED", failures);
+    return failures;
+}
+
+
+// -----------------------------------------------------------------------------
+// Benchmark
+
+// MIC of an uplink with a 12 byte payload and encryption of the payload,
+// as done by LMIC for every uplink
+static void secureFrame(const uint8_t* nwkKey, const uint8_t* appKey, uint8_t* frame)
+{
+    memcpy(AESkey, appKey, 16);
+    frameBlock(AESaux, 0x01, 1);
+    os_aes(AES_CTR, frame + 9, 12);
+    memcpy(AESkey, nwkKey, 16);
+    frameBlock(AESaux, 0x49, 21);
+    os_aes(AES_MIC, frame, 21);
+}
+
+static double benchmark(int numKeys)
+{
+    const int iterations = 200000;
+    uint8_t frame[25] = { 0x40 };
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < iterations; i++)
+    {
+        // with more keys than the cache holds, every call expands the key
+        int k = (2 * i) % numKeys;
+        secureFrame(testKeys[k], testKeys[(k + 1) % numKeys], frame);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / iterations;
+}
+
+void aes_test_benchmark(void)
+{
+    initKeys();
+    double cached = benchmark(2);
+    double uncached = benchmark(4);
+    printf("AES benchmark (MIC and encryption of an uplink with 12 bytes payload):\n");
+    printf("  cached keys:    %.0f ns per frame\n", cached);
+    printf("  uncached keys:  %.0f ns per frame\n", uncached);
+}
@@ -0,0 +1,32 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Test vectors and benchmark for the AES implementation of LMIC ('os_aes').
+ *******************************************************************************/
+
+#ifndef _aes_test_h_
+#define _aes_test_h_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Check 'os_aes' against the test vectors, return the number of failures
+int aes_test_run(void);
+
+// Measure the time for securing a frame with cached and uncached keys
+void aes_test_benchmark(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
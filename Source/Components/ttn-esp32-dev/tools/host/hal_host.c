@@ -0,0 +1,240 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Hardware abstraction layer to run LMIC on a host with a virtual clock.
+ *
+ * The virtual clock only advances when LMIC waits or sleeps, while it
+ * communicates with the radio (SPI transfer time) and by a fixed amount for
+ * each iteration of the run loop. Sleeping jumps directly
+ * to the next event: the LMIC alarm, a radio interrupt or the next request
+ * of the application. So the simulation runs much faster than real time and
+ * the results only depend on the inputs.
+ *
+ * As on the ESP32, radio interrupts are processed while LMIC waits for a
+ * precise time or sleeps, with the exact time of the interrupt.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "lmic/lmic.h"
+#include "hal_host.h"
+#include "sx1276_sim.h"
+
+
+// Time for setting up an SPI transaction (in µs)
+#define SPI_OVERHEAD 8
+// Time for one iteration of the run loop (in µs), counted when it checks the
+// timer. LMIC relies on the clock advancing between iterations, e.g. when a
+// job reschedules itself for a time that is due within TX_RAMPUP.
+#define RUN_LOOP_OVERHEAD 16
+
+
+// Starts at 1 s as 0 means 'no alarm'
+static int64_t currentTime = 1000000;
+static int64_t nextAlarm;
+static int64_t appAlarm;
+static uint32_t spiBits;
+static bool idle;
+static hal_host_command_hook_t* commandHook;
+static void* commandHookUserData;
+static const hal_failure_handler_t* failureHandler;
+
+
+// -----------------------------------------------------------------------------
+// Virtual clock
+
+int64_t hal_host_time(void)
+{
+    return currentTime;
+}
+
+static void advanceTo(int64_t time)
+{
+    if (time > currentTime)
+        currentTime = time;
+}
+
+// Convert LMIC tick time (ostime_t) to virtual time (see 'HAL_ESP32::osTimeToEspTime()')
+static int64_t osTimeToHostTime(uint32_t osTime)
+{
+    uint32_t osNow = (uint32_t)(currentTime >> 4);
+    uint32_t osDiff = osTime - osNow;
+    if (osDiff < 0xf0000000)
+        return currentTime + (((int64_t)osDiff) << 4);
+    return currentTime - (((int64_t)(~osDiff)) << 4);
+}
+
+void hal_host_setCommandHook(hal_host_command_hook_t* hook, void* userData)
+{
+    commandHook = hook;
+    commandHookUserData = userData;
+}
+
+void hal_host_setAppAlarm(int64_t time)
+{
+    appAlarm = time;
+}
+
+bool hal_host_isIdle(void)
+{
+    return idle;
+}
+
+u4_t hal_ticks(void)
+{
+    // LMIC tick unit: 16µs
+    return (u4_t)(currentTime >> 4);
+}
+
+// Process the radio interrupt due at the current time
+static void processRadioEvent(int64_t time)
+{
+    advanceTo(time);
+    int dio = sim_radio_processEvent();
+    if (dio >= 0)
+        radio_irq_handler_v2((u1_t)dio, (u4_t)(time >> 4));
+}
+
+void hal_waitUntil(u4_t time)
+{
+    int64_t target = osTimeToHostTime(time);
+    int64_t eventTime;
+    while (sim_radio_nextEvent(&eventTime) && eventTime <= target)
+        processRadioEvent(eventTime);
+    advanceTo(target);
+}
+
+u1_t hal_checkTimer(u4_t time)
+{
+    currentTime += RUN_LOOP_OVERHEAD;
+    int64_t target = osTimeToHostTime(time);
+    if (target - currentTime < 100)
+        return 1; // timer has expired or will expire very soon
+
+    nextAlarm = target;
+    return 0;
+}
+
+// Jump to the next event
+void hal_sleep(void)
+{
+    int64_t eventTime;
+    bool radioEvent = sim_radio_nextEvent(&eventTime);
+
+    if (radioEvent && (nextAlarm == 0 || eventTime <= nextAlarm) && (appAlarm == 0 || eventTime <= appAlarm))
+    {
+        processRadioEvent(eventTime);
+    }
+    else if (nextAlarm != 0 && (appAlarm == 0 || nextAlarm <= appAlarm))
+    {
+        advanceTo(nextAlarm);
+        nextAlarm = 0;
+    }
+    else if (appAlarm != 0)
+    {
+        advanceTo(appAlarm);
+        appAlarm = 0;
+    }
+    else
+    {
+        idle = true;
+    }
+}
+
+u1_t hal_processCommands(void)
+{
+    if (commandHook == NULL || !commandHook(commandHookUserData))
+        return 0;
+    idle = false;
+    return 1;
+}
+
+
+// -----------------------------------------------------------------------------
+// SPI
+
+// Each transaction advances the clock by its duration
+static void spiTransfer(size_t len)
+{
+    const uint32_t bitsPerUs = CONFIG_TTN_SPI_FREQ / 1000000;
+    spiBits += (1 + len) * 8;
+    currentTime += SPI_OVERHEAD + spiBits / bitsPerUs;
+    spiBits %= bitsPerUs;
+}
+
+void hal_spi_write(u1_t cmd, const u1_t* buf, size_t len)
+{
+    spiTransfer(len);
+    sim_radio_spiWrite(cmd & 0x7f, buf, len);
+}
+
+void hal_spi_read(u1_t cmd, u1_t* buf, size_t len)
+{
+    spiTransfer(len);
+    sim_radio_spiRead(cmd & 0x7f, buf, len);
+}
+
+
+// -----------------------------------------------------------------------------
+// Remaining HAL functions
+
+void hal_init_ex(const void* pContext)
+{
+}
+
+void hal_pin_rxtx(u1_t val)
+{
+}
+
+void hal_pin_rst(u1_t val)
+{
+}
+
+void hal_disableIRQs(void)
+{
+    // interrupts are only processed while waiting or sleeping
+}
+
+void hal_enableIRQs(void)
+{
+}
+
+s1_t hal_getRssiCal(void)
+{
+    return 10;
+}
+
+ostime_t hal_setModuleActive(bit_t val)
+{
+    return 0;
+}
+
+bit_t hal_queryUsingTcxo(void)
+{
+    return false;
+}
+
+uint8_t hal_getTxPowerPolicy(u1_t inputPolicy, s1_t requestedPower, u4_t frequency)
+{
+    return LMICHAL_radio_tx_power_policy_paboost;
+}
+
+void hal_set_failure_handler(const hal_failure_handler_t* const handler)
+{
+    failureHandler = handler;
+}
+
+void hal_failed(const char* file, u2_t line)
+{
+    if (failureHandler != NULL)
+        (*failureHandler)(file, line);
+
+    fprintf(stderr, "LMIC failed and stopped: %s:%d (at %.6f s)\n", file, line, currentTime / 1e6);
+    exit(2);
+}
@@ -0,0 +1,45 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Hardware abstraction layer to run LMIC on a host with a virtual clock.
+ *******************************************************************************/
+
+#ifndef _hal_host_h_
+#define _hal_host_h_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Called by the run loop when no job is due (see 'hal_processCommands()').
+// Returns true if it has issued requests.
+typedef bool hal_host_command_hook_t(void* userData);
+
+// Current virtual time (in µs)
+int64_t hal_host_time(void);
+
+// Set the function issuing the application requests (join, transmit etc.)
+void hal_host_setCommandHook(hal_host_command_hook_t* hook, void* userData);
+
+// Wake up the run loop at the given virtual time (in µs) to run the command hook
+void hal_host_setAppAlarm(int64_t time);
+
+// Check if LMIC has gone to sleep with nothing scheduled (the simulation has ended)
+bool hal_host_isIdle(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
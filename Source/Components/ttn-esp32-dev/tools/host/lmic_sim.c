@@ -0,0 +1,368 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Runs LMIC on the host with a simulated SX1276 radio and a virtual clock.
+ *
+ * The LMIC core (lmic.c, radio.c, oslmic.c, bandplan) is compiled unchanged
+ * with the configuration in 'sdkconfig.h' (EU868, SX1276). Joins, uplinks
+ * and RX windows take their real time on the virtual clock, but the
+ * simulation jumps over idle periods. Runs are deterministic for a given
+ * seed, which makes them suitable for comparing MAC layer changes.
+ *
+ * With '-N', a simulated network server ('ns_sim.c') receives the uplinks
+ * and answers with join accepts, acknowledgements, MAC commands (ADR etc.)
+ * and application downlinks. Without it, all RX windows time out.
+ *
+ * Build (in this directory):
+ *
+ *     gcc -std=gnu99 -O2 -fwrapv -I. -I../../src -DUSE_ORIGINAL_AES \
+ *         -ffunction-sections -Wl,--gc-sections -o lmic_sim \
+ *         *.c ../../src/lmic/lmic*.c ../../src/lmic/oslmic.c \
+ *         ../../src/lmic/radio.c ../../src/aes/lmic_aes.c
+ *
+ * LMIC relies on the wrap-around of 'ostime_t' (signed 32 bit) in its time
+ * calculations, hence '-fwrapv'.
+ *
+ * Run:
+ *
+ *     ./lmic_sim [-n uplinks] [-i interval] [-l length] [-c] [-o] [-t limit] [-s seed] [-q]
+ *                [-N] [-S snr] [-D dr] [-d interval] [-A]
+ *
+ *     -n  number of uplink messages (default: 10)
+ *     -i  interval between uplink messages (in s, default: 60)
+ *     -l  payload length (in bytes, default: 12)
+ *     -c  send confirmed messages
+ *     -o  join with OTAA first (default: ABP session)
+ *     -t  limit of the simulated time (in s, default: 86400)
+ *     -s  seed for the radio noise (default: 1)
+ *     -q  only output the summary
+ *     -N  run the network server
+ *     -S  SNR of the radio link at 16 dBm (in dB, default: 10)
+ *     -D  initial data rate of the ABP session (0 = SF12 ... 5 = SF7, default: 5)
+ *     -d  uplinks between application downlinks (default: 0 = none)
+ *     -A  check the AES implementation against test vectors, run the AES
+ *         benchmark and exit
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lmic/lmic.h"
+#include "hal_host.h"
+#include "sx1276_sim.h"
+#include "ns_sim.h"
+#include "aes_test.h"
+
+
+// Test device (keys in LMIC byte order)
+static const u1_t DEV_EUI[8] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x1e, 0x00 };
+static const u1_t APP_EUI[8] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x1e, 0x70 };
+static const u1_t APP_KEY[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const devaddr_t DEV_ADDR = 0x26011234;
+static const u1_t NWK_SKEY[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+static const u1_t APP_SKEY[16] = {
+    0xff, 0xee, 0xdd, 0xcc, 0xbb, 0xaa, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00
+};
+
+struct SimOptions
+{
+    uint32_t uplinks;
+    int64_t interval;
+    uint8_t length;
+    bool confirmed;
+    bool otaa;
+    int64_t limit;
+    uint32_t seed;
+    bool quiet;
+    bool network;
+    int snr;
+    uint8_t dataRate;
+    uint32_t downlinkInterval;
+};
+
+struct SimState
+{
+    bool sessionReady;
+    int64_t joinStart;
+    int64_t joinDuration;
+    uint32_t joinAttempts;
+    uint32_t uplinksStarted;
+    uint32_t uplinksCompleted;
+    bool uplinkPending;
+    uint32_t acknowledged;
+    uint32_t downlinks;
+    int64_t nextUplink;
+};
+
+static struct SimOptions options = { 10, 60000000, 12, false, false, 86400000000LL, 1, false, false, 10, DR_SF7, 0 };
+static struct SimState state;
+
+static const char* const eventNames[] = { LMIC_EVENT_NAME_TABLE__INIT };
+
+
+// LMIC callbacks for OTAA
+void os_getDevEui(u1_t* buf)
+{
+    memcpy(buf, DEV_EUI, sizeof(DEV_EUI));
+}
+
+void os_getArtEui(u1_t* buf)
+{
+    memcpy(buf, APP_EUI, sizeof(APP_EUI));
+}
+
+void os_getDevKey(u1_t* buf)
+{
+    memcpy(buf, APP_KEY, sizeof(APP_KEY));
+}
+
+
+static void onEvent(void* userData, ev_t event)
+{
+    int64_t now = hal_host_time();
+    if (!options.quiet && event != EV_RXSTART)
+        printf("%12.6f  %s\n", now / 1e6, eventNames[event]);
+
+    switch (event)
+    {
+        case EV_JOINING:
+            state.joinStart = now;
+            break;
+        case EV_TXSTART:
+            if ((LMIC.opmode & OP_JOINING) != 0)
+                state.joinAttempts++;
+            break;
+        case EV_JOINED:
+            state.sessionReady = true;
+            state.joinDuration = now - state.joinStart;
+            state.nextUplink = now;
+            break;
+        case EV_TXCOMPLETE:
+            // LMIC also sends uplinks on its own to answer MAC commands
+            if (!state.uplinkPending)
+                break;
+            state.uplinkPending = false;
+            state.uplinksCompleted++;
+            if ((LMIC.txrxFlags & TXRX_ACK) != 0)
+                state.acknowledged++;
+            if (LMIC.dataLen != 0)
+            {
+                state.downlinks++;
+                if (!options.quiet)
+                    printf("%12.6f  downlink: %d bytes on port %d\n", now / 1e6, LMIC.dataLen, LMIC.frame[LMIC.dataBeg - 1]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Issues the application requests (called by the run loop when no job is due)
+static bool appStep(void* userData)
+{
+    if (!state.sessionReady || state.uplinksStarted >= options.uplinks)
+        return false;
+    if ((LMIC.opmode & (OP_JOINING | OP_TXDATA | OP_POLL | OP_TXRXPEND)) != 0)
+        return false;
+
+    int64_t now = hal_host_time();
+    if (now < state.nextUplink)
+    {
+        hal_host_setAppAlarm(state.nextUplink);
+        return false;
+    }
+
+    u1_t payload[MAX_LEN_PAYLOAD];
+    for (int i = 0; i < options.length; i++)
+        payload[i] = (u1_t)(state.uplinksStarted + i);
+    LMIC_setTxData2(1, payload, options.length, options.confirmed);
+    state.uplinksStarted++;
+    state.uplinkPending = true;
+
+    if (options.network && options.downlinkInterval != 0 && state.uplinksStarted % options.downlinkInterval == 0)
+    {
+        u1_t message[4] = { 0xde, 0xad, 0xbe, (u1_t)state.uplinksStarted };
+        ns_sim_queueDownlink(2, message, sizeof(message));
+    }
+    state.nextUplink = now + options.interval;
+    return true;
+}
+
+static void startSession(void)
+{
+    if (options.otaa)
+    {
+        LMIC_startJoining();
+        return;
+    }
+
+    // Same setup as 'TTNSession::personalize()'
+    LMIC_setSession(0x13, DEV_ADDR, (xref2u1_t)NWK_SKEY, (xref2u1_t)APP_SKEY);
+    LMIC_setupChannel(3, 867100000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC_setupChannel(4, 867300000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC_setupChannel(5, 867500000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC_setupChannel(6, 867700000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC_setupChannel(7, 867900000, DR_RANGE_MAP(DR_SF12, DR_SF7), -1);
+    LMIC.dn2Dr = DR_SF9;
+    LMIC_setDrTxpow(options.dataRate, 14);
+    state.sessionReady = true;
+    state.nextUplink = hal_host_time();
+}
+
+static void startNetwork(void)
+{
+    ns_device_t device;
+    memset(&device, 0, sizeof(device));
+    device.otaa = options.otaa;
+    memcpy(device.devEui, DEV_EUI, sizeof(DEV_EUI));
+    memcpy(device.appEui, APP_EUI, sizeof(APP_EUI));
+    memcpy(device.appKey, APP_KEY, sizeof(APP_KEY));
+    device.devAddr = DEV_ADDR;
+    memcpy(device.nwkSKey, NWK_SKEY, sizeof(NWK_SKEY));
+    memcpy(device.appSKey, APP_SKEY, sizeof(APP_SKEY));
+
+    ns_config_t config;
+    config.linkSnr = options.snr;
+    config.seed = options.seed;
+    config.devStatusInterval = 100;
+    ns_sim_init(&device, &config);
+}
+
+// Timed jobs run 1 ms (64 ticks) or more after their deadline
+static uint32_t lateJobs(const oslmic_scheduler_stats_t* scheduler)
+{
+    uint32_t count = 0;
+    for (int i = 7; i < OSLMIC_LATENESS_BUCKETS; i++)
+        count += scheduler->lateness[i];
+    return count;
+}
+
+static void printSummary(double wallTime)
+{
+    double simTime = hal_host_time() / 1e6;
+    sim_radio_stats_t radio = sim_radio_getStats();
+
+    printf("Simulated time:  %.3f s (%.3f s wall clock, %.0fx real time)\n",
+        simTime, wallTime, wallTime > 0 ? simTime / wallTime : 0.0);
+    if (options.otaa)
+    {
+        if (state.sessionReady)
+            printf("Join:            %.3f s, %u join requests\n", state.joinDuration / 1e6, state.joinAttempts);
+        else
+            printf("Join:            failed after %u join requests\n", state.joinAttempts);
+    }
+    printf("Uplinks:         %u of %u completed", state.uplinksCompleted, options.uplinks);
+    if (options.confirmed)
+        printf(", %u acknowledged", state.acknowledged);
+    printf("\n");
+    printf("Downlinks:       %u received\n", state.downlinks);
+    printf("Radio:           %u frames sent, %.3f s airtime\n", radio.txFrames, radio.txAirtime / 1e6);
+    printf("RX windows:      %u opened, %u timed out, %u frames received, %u downlinks missed\n",
+        radio.rxWindows, radio.rxTimeouts, radio.rxFrames, radio.downlinksMissed);
+    oslmic_scheduler_stats_t scheduler;
+    os_getSchedulerStats(&scheduler);
+    printf("Scheduler:       %u immediate jobs, %u timed jobs, max lateness %d us, %u jobs late by 1 ms or more\n",
+        scheduler.runnableJobs, scheduler.timedJobs, (int)osticks2us(scheduler.maxLateness), lateJobs(&scheduler));
+
+    if (!options.network)
+        return;
+
+    ns_stats_t ns = ns_sim_getStats();
+    printf("Network server:\n");
+    if (options.otaa)
+        printf("  Joins:         %u join requests, %u join accepts\n", ns.joinRequests, ns.joinAccepts);
+    printf("  Uplinks:       %u received, %u retransmissions, %u lost, %u MIC failures, %u counter rejected\n",
+        ns.uplinks, ns.retransmissions, ns.uplinksLost, ns.micFailures, ns.counterRejected);
+    printf("  Throughput:    %.1f uplinks/h, %.1f payload bytes/h\n",
+        ns.uplinks * 3600 / simTime, ns.payloadBytes * 3600 / simTime);
+    printf("  Downlinks:     %u sent (%u RX1, %u RX2), %u lost, %u dropped (duty cycle)\n",
+        ns.downlinks, ns.downlinksRx1, ns.downlinksRx2, ns.downlinksLost, ns.downlinksDropped);
+    printf("  LinkADRReq:    %u sent, %u accepted", ns.linkAdrReqs, ns.linkAdrAccepted);
+    if (ns.linkAdrAccepted != 0)
+        printf(", settled after %u uplinks (%.3f s)", ns.adrSettledUplinks, ns.adrSettledAt / 1e6);
+    printf("\n");
+    printf("  ADR state:     DR%u, %d dBm\n", ns.dataRate, ns.txPower);
+    printf("  RXParamSetup:  %u sent, %u accepted\n", ns.rxParamSetupReqs, ns.rxParamSetupAccepted);
+    printf("  DevStatusReq:  %u sent, %u answered", ns.devStatusReqs, ns.devStatusAnswers);
+    if (ns.devStatusAnswers != 0)
+        printf(" (battery %u, margin %d dB)", ns.battery, ns.margin);
+    printf("\n");
+}
+
+static void parseOptions(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:l:cot:s:qNS:D:d:A")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': options.uplinks = (uint32_t)atol(optarg); break;
+            case 'i': options.interval = (int64_t)(atof(optarg) * 1e6); break;
+            case 'l': options.length = (uint8_t)atoi(optarg); break;
+            case 'c': options.confirmed = true; break;
+            case 'o': options.otaa = true; break;
+            case 't': options.limit = (int64_t)(atof(optarg) * 1e6); break;
+            case 's': options.seed = (uint32_t)atol(optarg); break;
+            case 'q': options.quiet = true; break;
+            case 'N': options.network = true; break;
+            case 'S': options.snr = atoi(optarg); break;
+            case 'D': options.dataRate = (uint8_t)atoi(optarg); break;
+            case 'd': options.downlinkInterval = (uint32_t)atol(optarg); break;
+            case 'A':
+                if (aes_test_run() != 0)
+                    exit(1);
+                aes_test_benchmark();
+                exit(0);
+            default:
+                fprintf(stderr, "Usage: %s [-n uplinks] [-i interval] [-l length] [-c] [-o] [-t limit] [-s seed] [-q]"
+                    " [-N] [-S snr] [-D dr] [-d interval] [-A]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (options.length > MAX_LEN_PAYLOAD - 13)
+        options.length = MAX_LEN_PAYLOAD - 13;
+    if (options.dataRate > DR_SF7)
+        options.dataRate = DR_SF7;
+}
+
+int main(int argc, char* argv[])
+{
+    parseOptions(argc, argv);
+
+    struct timespec wallStart, wallEnd;
+    clock_gettime(CLOCK_MONOTONIC, &wallStart);
+
+    sim_radio_init(options.seed);
+    hal_host_setCommandHook(appStep, NULL);
+    if (options.network)
+        startNetwork();
+
+    os_init_ex(NULL);
+    LMIC_registerEventCb(onEvent, NULL);
+    LMIC_reset();
+    startSession();
+
+    while (state.uplinksCompleted < options.uplinks && hal_host_time() < options.limit)
+    {
+        os_runloop_once();
+        if (hal_host_isIdle())
+            break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+    double wallTime = (wallEnd.tv_sec - wallStart.tv_sec) + (wallEnd.tv_nsec - wallStart.tv_nsec) / 1e9;
+    printSummary(wallTime);
+    return state.uplinksCompleted == options.uplinks ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * AES-128 and AES-CMAC (RFC 4493) for the simulated network server.
+ *
+ * The implementation is deliberately independent of the AES code of LMIC so
+ * that the network server can detect errors in the encryption and MIC
+ * calculation of the device. It is written for clarity, not for speed.
+ *******************************************************************************/
+
+#include <stdbool.h>
+#include <string.h>
+#include "ns_crypto.h"
+
+
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static uint8_t invSbox[256];
+static bool invSboxReady;
+
+
+// Multiplication by x in GF(2^8)
+static uint8_t xtime(uint8_t a)
+{
+    return (uint8_t)((a << 1) ^ ((a & 0x80) != 0 ? 0x1b : 0x00));
+}
+
+static uint8_t gmul(uint8_t a, uint8_t b)
+{
+    uint8_t result = 0;
+    while (b != 0)
+    {
+        if ((b & 1) != 0)
+            result ^= a;
+        a = xtime(a);
+        b >>= 1;
+    }
+    return result;
+}
+
+// Round keys for the 10 rounds plus the initial one
+static void expandKey(const uint8_t key[16], uint8_t roundKeys[176])
+{
+    uint8_t rcon = 0x01;
+    memcpy(roundKeys, key, 16);
+    for (int i = 16; i < 176; i += 4)
+    {
+        uint8_t t[4];
+        memcpy(t, &roundKeys[i - 4], 4);
+        if (i % 16 == 0)
+        {
+            uint8_t first = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[first];
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; j++)
+            roundKeys[i + j] = roundKeys[i - 16 + j] ^ t[j];
+    }
+}
+
+static void addRoundKey(uint8_t state[16], const uint8_t* roundKey)
+{
+    for (int i = 0; i < 16; i++)
+        state[i] ^= roundKey[i];
+}
+
+// The state is stored column by column: state[4 * column + row]
+static void shiftRows(uint8_t state[16], bool inverse)
+{
+    uint8_t tmp[16];
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            int src = inverse ? (col + 4 - row) % 4 : (col + row) % 4;
+            tmp[4 * col + row] = state[4 * src + row];
+        }
+    }
+    memcpy(state, tmp, 16);
+}
+
+static void mixColumns(uint8_t state[16], bool inverse)
+{
+    const uint8_t* m = inverse ? (const uint8_t[]){ 14, 11, 13, 9 } : (const uint8_t[]){ 2, 3, 1, 1 };
+    for (int col = 0; col < 4; col++)
+    {
+        uint8_t* c = &state[4 * col];
+        uint8_t a[4] = { c[0], c[1], c[2], c[3] };
+        for (int row = 0; row < 4; row++)
+        {
+            c[row] = gmul(a[row], m[0]) ^ gmul(a[(row + 1) % 4], m[1])
+                ^ gmul(a[(row + 2) % 4], m[2]) ^ gmul(a[(row + 3) % 4], m[3]);
+        }
+    }
+}
+
+void ns_crypto_encrypt(const uint8_t key[16], uint8_t block[16])
+{
+    uint8_t roundKeys[176];
+    expandKey(key, roundKeys);
+
+    addRoundKey(block, roundKeys);
+    for (int round = 1; round <= 10; round++)
+    {
+        for (int i = 0; i < 16; i++)
+            block[i] = sbox[block[i]];
+        shiftRows(block, false);
+        if (round != 10)
+            mixColumns(block, false);
+        addRoundKey(block, &roundKeys[16 * round]);
+    }
+}
+
+void ns_crypto_decrypt(const uint8_t key[16], uint8_t block[16])
+{
+    if (!invSboxReady)
+    {
+        for (int i = 0; i < 256; i++)
+            invSbox[sbox[i]] = (uint8_t)i;
+        invSboxReady = true;
+    }
+
+    uint8_t roundKeys[176];
+    expandKey(key, roundKeys);
+
+    addRoundKey(block, &roundKeys[160]);
+    for (int round = 9; round >= 0; round--)
+    {
+        shiftRows(block, true);
+        for (int i = 0; i < 16; i++)
+            block[i] = invSbox[block[i]];
+        addRoundKey(block, &roundKeys[16 * round]);
+        if (round != 0)
+            mixColumns(block, true);
+    }
+}
+
+
+// --- AES-CMAC
+
+// Subkey generation: shift left by one bit, conditionally XOR with Rb
+static void deriveSubkey(const uint8_t in[16], uint8_t out[16])
+{
+    for (int i = 0; i < 16; i++)
+        out[i] = (uint8_t)((in[i] << 1) | (i < 15 ? in[i + 1] >> 7 : 0));
+    if ((in[0] & 0x80) != 0)
+        out[15] ^= 0x87;
+}
+
+void ns_crypto_cmac(const uint8_t key[16], const uint8_t* msg, size_t len, uint8_t mac[16])
+{
+    uint8_t l[16] = { 0 };
+    uint8_t k1[16], k2[16];
+    ns_crypto_encrypt(key, l);
+    deriveSubkey(l, k1);
+    deriveSubkey(k1, k2);
+
+    size_t blocks = (len + 15) / 16;
+    bool complete = len != 0 && len % 16 == 0;
+    if (blocks == 0)
+        blocks = 1;
+
+    uint8_t x[16] = { 0 };
+    for (size_t b = 0; b < blocks; b++)
+    {
+        const uint8_t* m = &msg[16 * b];
+        if (b < blocks - 1)
+        {
+            for (int i = 0; i < 16; i++)
+                x[i] ^= m[i];
+        }
+        else
+        {
+            // last block: XOR with K1 if complete, pad and XOR with K2 otherwise
+            size_t rest = len - 16 * b;
+            for (size_t i = 0; i < 16; i++)
+            {
+                uint8_t byte = i < rest ? m[i] : (i == rest ? 0x80 : 0x00);
+                x[i] ^= byte ^ (complete ? k1[i] : k2[i]);
+            }
+        }
+        ns_crypto_encrypt(key, x);
+    }
+    memcpy(mac, x, 16);
+}
@@ -0,0 +1,36 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * AES-128 and AES-CMAC (RFC 4493) for the simulated network server.
+ *******************************************************************************/
+
+#ifndef _ns_crypto_h_
+#define _ns_crypto_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Encrypt a single 16 byte block in place
+void ns_crypto_encrypt(const uint8_t key[16], uint8_t block[16]);
+// Decrypt a single 16 byte block in place
+void ns_crypto_decrypt(const uint8_t key[16], uint8_t block[16]);
+// Compute the 16 byte AES-CMAC of the message
+void ns_crypto_cmac(const uint8_t key[16], const uint8_t* msg, size_t len, uint8_t mac[16]);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
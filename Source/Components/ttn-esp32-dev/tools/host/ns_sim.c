@@ -0,0 +1,723 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Minimal LoRaWAN 1.0 network server (EU868) for the host build.
+ *
+ * The server receives the frames transmitted by the simulated radio through
+ * a simulated gateway. It answers join requests, checks the MIC and the
+ * frame counter of uplinks and sends downlinks in RX1 or RX2 (subject to the
+ * duty cycle of the gateway). Downlinks carry acknowledgements, application
+ * messages and the MAC commands LinkADRReq (ADR with the usual SNR margin
+ * algorithm), DevStatusReq and RXParamSetupReq.
+ *
+ * The radio link is modelled by a fixed SNR at 16 dBm, adjusted for the
+ * transmit power and varied by +/- 2 dB per frame. Frames below the
+ * demodulation floor of their spreading factor are lost.
+ *
+ * All encryption and MIC calculations use 'ns_crypto.c', not the AES code
+ * of LMIC.
+ *******************************************************************************/
+
+#include <string.h>
+#include "lmic/lmic.h"
+#include "ns_sim.h"
+#include "ns_crypto.h"
+#include "sx1276_sim.h"
+#include "hal_host.h"
+
+
+// Network ID and address range of The Things Network
+#define NET_ID                  0x000013
+#define OTAA_DEV_ADDR           0x260B0000
+
+// RX window settings sent to the device (as used by The Things Network)
+#define RX1_DR_OFFSET           0
+#define RX2_DR                  DR_SF9
+#define RX2_FREQ                869525000
+#define RX_DELAY                DELAY_DNW1
+
+// Frequencies of channels 3 to 7 (CFList of the join accept)
+static const uint32_t CFLIST_FREQS[] = { 867100000, 867300000, 867500000, 867700000, 867900000 };
+
+// Number of uplinks the ADR algorithm evaluates
+#define ADR_HISTORY             20
+// Installation margin of the ADR algorithm (in dB)
+#define ADR_MARGIN              10
+// Lowest transmit power set by ADR (index 5: 6 dBm)
+#define ADR_MAX_POWER_INDEX     5
+
+// Maximum EIRP of the device and transmit power of the gateway (in dBm)
+#define MAX_EIRP                16
+#define GATEWAY_POWER           14
+#define GATEWAY_POWER_RX2       27
+// Noise floor for 125 kHz bandwidth (in dBm)
+#define NOISE_FLOOR             -117
+// Variation of the link SNR per frame (+/- in dB)
+#define SNR_VARIATION           2
+
+#define DEV_NONCE_HISTORY       16
+#define MAX_FOPTS_LEN           15
+#define MAX_FRAME_LEN           255
+
+
+static ns_device_t device;
+static ns_config_t config;
+static ns_stats_t stats;
+static uint32_t randomState;
+
+// Session
+static bool sessionActive;
+static uint32_t devAddr;
+static uint8_t nwkSKey[16];
+static uint8_t appSKey[16];
+static bool uplinkReceived;
+static uint32_t fcntUp;
+static uint32_t fcntDown;
+static uint16_t devNonces[DEV_NONCE_HISTORY];
+static int devNonceCount;
+
+// RX settings of the device as known by the network server
+static uint8_t rx1DrOffset;
+static uint8_t rx2Dr;
+static uint32_t rx2Freq;
+static uint8_t rxDelay;
+
+// ADR
+static int8_t snrHistory[ADR_HISTORY];
+static int snrCount;
+static uint8_t adrDr;
+static uint8_t adrPowerIndex;
+static bool adrRequest;
+static uint8_t adrRequestDr;
+static uint8_t adrRequestPowerIndex;
+
+static uint32_t uplinksSinceDevStatus;
+
+// Application downlink
+static bool appPending;
+static uint8_t appPort;
+static uint8_t appLength;
+static uint8_t appPayload[MAX_FRAME_LEN];
+
+// Gateway duty cycle: 869.4 - 869.65 MHz (10%) and the other sub-bands (1%)
+static int64_t bandAvailable[2];
+
+static void processUplink(const sim_frame_t* frame, void* userData);
+
+
+// -----------------------------------------------------------------------------
+// Helpers
+
+static uint8_t nextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return (uint8_t)randomState;
+}
+
+static uint16_t readU2(const uint8_t* buf)
+{
+    return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+static uint32_t readU4(const uint8_t* buf)
+{
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static void writeU3(uint8_t* buf, uint32_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+    buf[2] = (uint8_t)(value >> 16);
+}
+
+static void writeU4(uint8_t* buf, uint32_t value)
+{
+    writeU3(buf, value);
+    buf[3] = (uint8_t)(value >> 24);
+}
+
+// EU868: DR0 = SF12 ... DR5 = SF7 (125 kHz)
+static uint8_t frameDr(rps_t rps)
+{
+    return (uint8_t)(SF12 - getSf(rps));
+}
+
+static rps_t downlinkRps(uint8_t dr)
+{
+    return makeRps((sf_t)(SF12 - dr), BW125, CR_4_5, 0, 1);
+}
+
+// Demodulation floor (in 0.1 dB): -20 dB for SF12 to -7.5 dB for SF7
+static int requiredSnr10(uint8_t dr)
+{
+    return -200 + 25 * dr;
+}
+
+static int linkSnr(int8_t power)
+{
+    int variation = (int)(nextRandom() % (2 * SNR_VARIATION + 1)) - SNR_VARIATION;
+    return config.linkSnr + power - MAX_EIRP + variation;
+}
+
+static int bandOf(uint32_t freq)
+{
+    return freq >= 869400000 && freq <= 869650000 ? 1 : 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// Crypto (LoRaWAN 1.0, section 4.3.3 and 4.4)
+
+// B0 block (MIC) or A block (encryption) of data frames
+static void dataBlock(uint8_t block[16], uint8_t type, bool downlink, uint32_t addr, uint32_t fcnt, uint8_t last)
+{
+    memset(block, 0, 16);
+    block[0] = type;
+    block[5] = downlink ? 1 : 0;
+    writeU4(&block[6], addr);
+    writeU4(&block[10], fcnt);
+    block[15] = last;
+}
+
+static void computeMic(const uint8_t key[16], const uint8_t* b0, const uint8_t* msg, size_t len, uint8_t mic[4])
+{
+    uint8_t buf[16 + MAX_FRAME_LEN];
+    size_t offset = 0;
+    if (b0 != NULL)
+    {
+        memcpy(buf, b0, 16);
+        offset = 16;
+    }
+    memcpy(&buf[offset], msg, len);
+
+    uint8_t mac[16];
+    ns_crypto_cmac(key, buf, offset + len, mac);
+    memcpy(mic, mac, 4);
+}
+
+static bool dataMicMatches(const uint8_t* msg, uint8_t len, uint32_t fcnt)
+{
+    uint8_t b0[16];
+    uint8_t mic[4];
+    dataBlock(b0, 0x49, false, devAddr, fcnt, (uint8_t)(len - 4));
+    computeMic(nwkSKey, b0, msg, len - 4, mic);
+    return memcmp(mic, &msg[len - 4], 4) == 0;
+}
+
+// Encryption and decryption of FRMPayload
+static void cipherPayload(const uint8_t key[16], bool downlink, uint32_t fcnt, uint8_t* data, uint8_t len)
+{
+    for (int i = 0; i * 16 < len; i++)
+    {
+        uint8_t a[16];
+        dataBlock(a, 0x01, downlink, devAddr, fcnt, (uint8_t)(i + 1));
+        ns_crypto_encrypt(key, a);
+        for (int j = 0; j < 16 && i * 16 + j < len; j++)
+            data[i * 16 + j] ^= a[j];
+    }
+}
+
+static void deriveSessionKey(uint8_t type, const uint8_t* appNonce, uint16_t devNonce, uint8_t key[16])
+{
+    memset(key, 0, 16);
+    key[0] = type;
+    memcpy(&key[1], appNonce, 3);
+    writeU3(&key[4], NET_ID);
+    key[7] = (uint8_t)devNonce;
+    key[8] = (uint8_t)(devNonce >> 8);
+    ns_crypto_encrypt(device.appKey, key);
+}
+
+
+// -----------------------------------------------------------------------------
+// Session
+
+void ns_sim_init(const ns_device_t* dev, const ns_config_t* cfg)
+{
+    device = *dev;
+    config = *cfg;
+    memset(&stats, 0, sizeof(stats));
+    randomState = config.seed != 0 ? config.seed : 1;
+    devNonceCount = 0;
+    bandAvailable[0] = bandAvailable[1] = 0;
+    appPending = false;
+    sessionActive = false;
+
+    if (!device.otaa)
+    {
+        // ABP: the network server assumes the regional defaults for RX2
+        sessionActive = true;
+        devAddr = device.devAddr;
+        memcpy(nwkSKey, device.nwkSKey, 16);
+        memcpy(appSKey, device.appSKey, 16);
+        rx1DrOffset = 0;
+        rx2Dr = DR_SF12;
+        rx2Freq = RX2_FREQ;
+        rxDelay = DELAY_DNW1;
+    }
+    uplinkReceived = false;
+    fcntUp = 0;
+    fcntDown = 0;
+    snrCount = 0;
+    adrDr = DR_SF7;
+    adrPowerIndex = 0;
+    adrRequest = false;
+    uplinksSinceDevStatus = 0;
+    stats.dataRate = adrDr;
+    stats.txPower = MAX_EIRP;
+    stats.battery = MCMD_DEVS_BATT_NOINFO;
+
+    sim_radio_setTxHandler(processUplink, NULL);
+}
+
+bool ns_sim_queueDownlink(uint8_t port, const uint8_t* payload, uint8_t length)
+{
+    if (appPending || port == 0 || length > MAX_FRAME_LEN - OFF_DAT_OPTS - MAX_FOPTS_LEN - 5)
+        return false;
+
+    appPending = true;
+    appPort = port;
+    appLength = length;
+    memcpy(appPayload, payload, length);
+    return true;
+}
+
+ns_stats_t ns_sim_getStats(void)
+{
+    return stats;
+}
+
+static void resetAdrHistory(void)
+{
+    snrCount = 0;
+    adrRequest = false;
+}
+
+
+// -----------------------------------------------------------------------------
+// Downlinks
+
+// Select RX1 or RX2 depending on the gateway duty cycle. Returns 0 if no window can be used.
+static int selectWindow(const sim_frame_t* up, int delay, uint8_t dnRx1DrOffset, uint8_t dnRx2Dr, uint32_t dnRx2Freq, sim_frame_t* down)
+{
+    memset(down, 0, sizeof(*down));
+    down->invertIq = true;
+
+    int64_t rx1Start = up->end + (int64_t)delay * 1000000;
+    if (bandAvailable[bandOf(up->freq)] <= rx1Start)
+    {
+        uint8_t upDr = frameDr(up->rps);
+        down->start = rx1Start;
+        down->freq = up->freq;
+        down->rps = downlinkRps(upDr > dnRx1DrOffset ? upDr - dnRx1DrOffset : 0);
+        down->power = GATEWAY_POWER;
+        return 1;
+    }
+
+    int64_t rx2Start = rx1Start + 1000000;
+    if (bandAvailable[bandOf(dnRx2Freq)] <= rx2Start)
+    {
+        down->start = rx2Start;
+        down->freq = dnRx2Freq;
+        down->rps = downlinkRps(dnRx2Dr);
+        down->power = bandOf(dnRx2Freq) == 1 ? GATEWAY_POWER_RX2 : GATEWAY_POWER;
+        return 2;
+    }
+
+    stats.downlinksDropped++;
+    return 0;
+}
+
+// Transmit the downlink (payload set) over the simulated link
+static void transmit(sim_frame_t* down, int window)
+{
+    int64_t airtime = sim_radio_airtime(down->rps, down->length);
+    int band = bandOf(down->freq);
+    bandAvailable[band] = down->start + airtime * (band == 1 ? 10 : 100);
+
+    stats.downlinks++;
+    if (window == 1)
+        stats.downlinksRx1++;
+    else
+        stats.downlinksRx2++;
+
+    int snr = linkSnr(down->power);
+    if (snr * 10 < requiredSnr10(frameDr(down->rps)))
+    {
+        stats.downlinksLost++;
+        return;
+    }
+
+    down->snr = (int8_t)snr;
+    down->rssi = (int16_t)(snr > 0 ? NOISE_FLOOR + snr : NOISE_FLOOR);
+    sim_radio_sendDownlink(down);
+}
+
+static void sendDataDownlink(const sim_frame_t* up, bool ack, bool adrAckReq)
+{
+    bool rxParamSetup = rx2Dr != RX2_DR || rx1DrOffset != RX1_DR_OFFSET;
+    bool devStatus = config.devStatusInterval != 0 && uplinksSinceDevStatus >= config.devStatusInterval;
+    if (!ack && !adrAckReq && !adrRequest && !rxParamSetup && !devStatus && !appPending)
+        return;
+
+    sim_frame_t down;
+    int window = selectWindow(up, rxDelay, rx1DrOffset, rx2Dr, rx2Freq, &down);
+    if (window == 0)
+        return;
+
+    uint8_t* frame = down.payload;
+    uint8_t optsLen = 0;
+    uint8_t* opts = &frame[OFF_DAT_OPTS];
+
+    if (adrRequest)
+    {
+        // data rate and power, channels 0 to 7, ChMaskCntl 0, NbTrans 1
+        opts[optsLen++] = MCMD_LinkADRReq;
+        opts[optsLen++] = (uint8_t)((adrRequestDr << MCMD_LinkADRReq_DR_SHIFT) | adrRequestPowerIndex);
+        opts[optsLen++] = 0xFF;
+        opts[optsLen++] = 0x00;
+        opts[optsLen++] = MCMD_LinkADRReq_ChMaskCntl_EULIKE_DIRECT | 1;
+        stats.linkAdrReqs++;
+    }
+    if (rxParamSetup)
+    {
+        opts[optsLen++] = MCMD_RXParamSetupReq;
+        opts[optsLen++] = (uint8_t)((RX1_DR_OFFSET << 4) | RX2_DR);
+        writeU3(&opts[optsLen], RX2_FREQ / 100);
+        optsLen += 3;
+        stats.rxParamSetupReqs++;
+    }
+    if (devStatus)
+    {
+        opts[optsLen++] = MCMD_DevStatusReq;
+        stats.devStatusReqs++;
+    }
+
+    frame[OFF_DAT_HDR] = HDR_FTYPE_DADN | HDR_MAJOR_V1;
+    writeU4(&frame[OFF_DAT_ADDR], devAddr);
+    frame[OFF_DAT_FCT] = FCT_ADREN | (ack ? FCT_ACK : 0) | optsLen;
+    frame[OFF_DAT_SEQNO] = (uint8_t)fcntDown;
+    frame[OFF_DAT_SEQNO + 1] = (uint8_t)(fcntDown >> 8);
+    uint8_t len = OFF_DAT_OPTS + optsLen;
+
+    if (appPending)
+    {
+        frame[len++] = appPort;
+        memcpy(&frame[len], appPayload, appLength);
+        cipherPayload(appSKey, true, fcntDown, &frame[len], appLength);
+        len += appLength;
+        appPending = false;
+    }
+
+    uint8_t b0[16];
+    dataBlock(b0, 0x49, true, devAddr, fcntDown, len);
+    computeMic(nwkSKey, b0, frame, len, &frame[len]);
+    down.length = len + 4;
+    fcntDown++;
+
+    transmit(&down, window);
+}
+
+
+// -----------------------------------------------------------------------------
+// Uplinks
+
+static void evaluateAdr(void)
+{
+    adrRequest = false;
+    if (snrCount < ADR_HISTORY)
+        return;
+
+    int maxSnr = snrHistory[0];
+    for (int i = 1; i < ADR_HISTORY; i++)
+    {
+        if (snrHistory[i] > maxSnr)
+            maxSnr = snrHistory[i];
+    }
+
+    // Each step of 3 dB margin increases the data rate or reduces the power by 2 dB
+    int margin10 = maxSnr * 10 - requiredSnr10(adrDr) - ADR_MARGIN * 10;
+    int steps = margin10 >= 0 ? margin10 / 30 : -((29 - margin10) / 30);
+    uint8_t dr = adrDr;
+    uint8_t powerIndex = adrPowerIndex;
+    while (steps > 0 && dr < DR_SF7)
+    {
+        dr++;
+        steps--;
+    }
+    while (steps > 0 && powerIndex < ADR_MAX_POWER_INDEX)
+    {
+        powerIndex++;
+        steps--;
+    }
+    while (steps < 0 && powerIndex > 0)
+    {
+        powerIndex--;
+        steps++;
+    }
+
+    if (dr != adrDr || powerIndex != adrPowerIndex)
+    {
+        adrRequest = true;
+        adrRequestDr = dr;
+        adrRequestPowerIndex = powerIndex;
+    }
+}
+
+// MAC command answers of the device
+static void processMacCommands(const uint8_t* cmds, uint8_t len)
+{
+    uint8_t i = 0;
+    while (i < len)
+    {
+        switch (cmds[i])
+        {
+            case MCMD_LinkADRAns:
+                if (i + 1 >= len)
+                    return;
+                if (adrRequest && (cmds[i + 1] & 0x07) == 0x07)
+                {
+                    adrDr = adrRequestDr;
+                    adrPowerIndex = adrRequestPowerIndex;
+                    stats.linkAdrAccepted++;
+                    stats.adrSettledAt = hal_host_time();
+                    stats.adrSettledUplinks = stats.uplinks;
+                    stats.dataRate = adrDr;
+                    stats.txPower = (int8_t)(MAX_EIRP - 2 * adrPowerIndex);
+                    resetAdrHistory();
+                }
+                i += 2;
+                break;
+
+            case MCMD_RXParamSetupAns:
+                if (i + 1 >= len)
+                    return;
+                // the device repeats the answer until it receives a downlink
+                if ((cmds[i + 1] & 0x07) == 0x07 && (rx2Dr != RX2_DR || rx1DrOffset != RX1_DR_OFFSET))
+                {
+                    rx1DrOffset = RX1_DR_OFFSET;
+                    rx2Dr = RX2_DR;
+                    rx2Freq = RX2_FREQ;
+                    stats.rxParamSetupAccepted++;
+                }
+                i += 2;
+                break;
+
+            case MCMD_DevStatusAns:
+                if (i + 2 >= len)
+                    return;
+                stats.battery = cmds[i + 1];
+                stats.margin = (int8_t)(cmds[i + 2] << 2) >> 2;
+                stats.devStatusAnswers++;
+                uplinksSinceDevStatus = 0;
+                i += 3;
+                break;
+
+            case MCMD_LinkCheckReq:
+            case MCMD_DutyCycleAns:
+            case MCMD_RXTimingSetupAns:
+            case MCMD_TxParamSetupAns:
+            case MCMD_DeviceTimeReq:
+                i += 1;
+                break;
+
+            case MCMD_NewChannelAns:
+            case MCMD_DlChannelAns:
+                i += 2;
+                break;
+
+            default:
+                // unknown command: the rest cannot be parsed
+                return;
+        }
+    }
+}
+
+static void processJoinRequest(const sim_frame_t* up)
+{
+    const uint8_t* msg = up->payload;
+    if (!device.otaa || up->length != LEN_JR)
+        return;
+    if (memcmp(&msg[OFF_JR_ARTEUI], device.appEui, 8) != 0 || memcmp(&msg[OFF_JR_DEVEUI], device.devEui, 8) != 0)
+        return;
+
+    stats.joinRequests++;
+    uint8_t mic[4];
+    computeMic(device.appKey, NULL, msg, LEN_JR - 4, mic);
+    if (memcmp(mic, &msg[OFF_JR_MIC], 4) != 0)
+    {
+        stats.micFailures++;
+        return;
+    }
+
+    uint16_t devNonce = readU2(&msg[OFF_JR_DEVNONCE]);
+    int known = devNonceCount < DEV_NONCE_HISTORY ? devNonceCount : DEV_NONCE_HISTORY;
+    for (int i = 0; i < known; i++)
+    {
+        if (devNonces[i] == devNonce)
+        {
+            stats.counterRejected++;
+            return;
+        }
+    }
+    devNonces[devNonceCount++ % DEV_NONCE_HISTORY] = devNonce;
+
+    sim_frame_t down;
+    int window = selectWindow(up, DELAY_JACC1, 0, DR_SF12, RX2_FREQ, &down);
+    if (window == 0)
+        return;
+
+    // Join accept with CFList
+    uint8_t* ja = down.payload;
+    uint8_t appNonce[3] = { nextRandom(), nextRandom(), nextRandom() };
+    uint32_t addr = OTAA_DEV_ADDR | ((stats.joinAccepts + 1) & 0xFFFF);
+    ja[OFF_JA_HDR] = HDR_FTYPE_JACC | HDR_MAJOR_V1;
+    memcpy(&ja[OFF_JA_ARTNONCE], appNonce, 3);
+    writeU3(&ja[OFF_JA_NETID], NET_ID);
+    writeU4(&ja[OFF_JA_DEVADDR], addr);
+    ja[OFF_JA_DLSET] = (RX1_DR_OFFSET << 4) | RX2_DR;
+    ja[OFF_JA_RXDLY] = RX_DELAY;
+    for (int i = 0; i < 5; i++)
+        writeU3(&ja[OFF_CFLIST + 3 * i], CFLIST_FREQS[i] / 100);
+    ja[OFF_CFLIST + 15] = 0; // CFList type: frequencies
+    computeMic(device.appKey, NULL, ja, LEN_JAEXT - 4, &ja[LEN_JAEXT - 4]);
+    down.length = LEN_JAEXT;
+
+    // The join accept is encrypted with the AES decrypt operation
+    ns_crypto_decrypt(device.appKey, &ja[1]);
+    ns_crypto_decrypt(device.appKey, &ja[17]);
+
+    // New session
+    sessionActive = true;
+    devAddr = addr;
+    deriveSessionKey(0x01, appNonce, devNonce, nwkSKey);
+    deriveSessionKey(0x02, appNonce, devNonce, appSKey);
+    uplinkReceived = false;
+    fcntUp = 0;
+    fcntDown = 0;
+    rx1DrOffset = RX1_DR_OFFSET;
+    rx2Dr = RX2_DR;
+    rx2Freq = RX2_FREQ;
+    rxDelay = RX_DELAY;
+    adrDr = frameDr(up->rps);
+    adrPowerIndex = 0;
+    resetAdrHistory();
+    uplinksSinceDevStatus = 0;
+    stats.joinAccepts++;
+    stats.dataRate = adrDr;
+    stats.txPower = MAX_EIRP;
+
+    transmit(&down, window);
+}
+
+static void processDataUplink(const sim_frame_t* up, int snr)
+{
+    const uint8_t* msg = up->payload;
+    uint8_t len = up->length;
+    if (!sessionActive || len < OFF_DAT_OPTS + 4 || readU4(&msg[OFF_DAT_ADDR]) != devAddr)
+        return;
+
+    uint8_t fctrl = msg[OFF_DAT_FCT];
+    uint8_t optsLen = fctrl & FCT_OPTLEN;
+    if (OFF_DAT_OPTS + optsLen + 4 > len)
+        return;
+
+    // Reconstruct the 32 bit frame counter, a smaller value is a roll-over or a replay
+    uint16_t fcnt16 = readU2(&msg[OFF_DAT_SEQNO]);
+    uint32_t fcnt = (fcntUp & 0xFFFF0000) | fcnt16;
+    if (uplinkReceived && fcnt < fcntUp)
+    {
+        if (!dataMicMatches(msg, len, fcnt + 0x10000))
+        {
+            if (dataMicMatches(msg, len, fcnt))
+                stats.counterRejected++;
+            else
+                stats.micFailures++;
+            return;
+        }
+        fcnt += 0x10000;
+    }
+    else if (!dataMicMatches(msg, len, fcnt))
+    {
+        stats.micFailures++;
+        return;
+    }
+
+    bool confirmed = (msg[OFF_DAT_HDR] & HDR_FTYPE) == HDR_FTYPE_DCUP;
+    if (uplinkReceived && fcnt == fcntUp)
+    {
+        // retransmission: acknowledge again, but do not process it twice
+        stats.retransmissions++;
+        sendDataDownlink(up, confirmed, false);
+        return;
+    }
+
+    stats.uplinks++;
+    uplinkReceived = true;
+    fcntUp = fcnt;
+    uplinksSinceDevStatus++;
+
+    processMacCommands(&msg[OFF_DAT_OPTS], optsLen);
+    uint8_t portOffset = OFF_DAT_OPTS + optsLen;
+    if (portOffset + 4 < len && msg[portOffset] != 0)
+        stats.payloadBytes += len - 4 - portOffset - 1;
+    else if (portOffset + 4 < len)
+    {
+        // MAC commands in the payload are encrypted with the network session key
+        uint8_t cmds[MAX_FRAME_LEN];
+        uint8_t cmdsLen = (uint8_t)(len - 4 - portOffset - 1);
+        memcpy(cmds, &msg[portOffset + 1], cmdsLen);
+        cipherPayload(nwkSKey, false, fcnt, cmds, cmdsLen);
+        processMacCommands(cmds, cmdsLen);
+    }
+
+    // The device lowers the data rate on its own if it receives no downlinks (ADR back-off)
+    uint8_t dr = frameDr(up->rps);
+    if (dr != adrDr)
+    {
+        adrDr = dr;
+        stats.dataRate = dr;
+        resetAdrHistory();
+    }
+    snrHistory[snrCount++ % ADR_HISTORY] = (int8_t)snr;
+    if ((fctrl & FCT_ADREN) != 0)
+        evaluateAdr();
+
+    sendDataDownlink(up, confirmed, (fctrl & FCT_ADRACKReq) != 0);
+}
+
+// Radio TX handler: the gateway receives the frame at the end of the transmission
+static void processUplink(const sim_frame_t* frame, void* userData)
+{
+    if (frame->invertIq)
+        return;
+
+    int snr = linkSnr(frame->power);
+    if (snr * 10 < requiredSnr10(frameDr(frame->rps)))
+    {
+        stats.uplinksLost++;
+        return;
+    }
+
+    switch (frame->payload[OFF_DAT_HDR] & HDR_FTYPE)
+    {
+        case HDR_FTYPE_JREQ:
+            processJoinRequest(frame);
+            break;
+        case HDR_FTYPE_DAUP:
+        case HDR_FTYPE_DCUP:
+            processDataUplink(frame, snr);
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,98 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Minimal LoRaWAN 1.0 network server (EU868) for the host build, connected
+ * to the simulated radio through a simulated gateway and radio link.
+ *******************************************************************************/
+
+#ifndef _ns_sim_h_
+#define _ns_sim_h_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @brief Device known to the network server
+ *
+ * EUIs are in LMIC byte order (least significant byte first), keys in the
+ * byte order of the AES algorithm.
+ */
+typedef struct
+{
+    bool otaa;                  // activated by joining (or ABP)
+    uint8_t devEui[8];
+    uint8_t appEui[8];
+    uint8_t appKey[16];
+    uint32_t devAddr;           // ABP only
+    uint8_t nwkSKey[16];        // ABP only
+    uint8_t appSKey[16];        // ABP only
+} ns_device_t;
+
+/**
+ * @brief Network server configuration
+ */
+typedef struct
+{
+    int linkSnr;                // SNR of the radio link at 16 dBm (in dB)
+    uint32_t seed;              // seed for the variation of the SNR
+    uint32_t devStatusInterval; // uplinks between DevStatusReq (0 = never)
+} ns_config_t;
+
+/**
+ * @brief Network server statistics
+ */
+typedef struct
+{
+    uint32_t joinRequests;      // join requests received
+    uint32_t joinAccepts;       // join accepts sent
+    uint32_t uplinks;           // new data uplinks received
+    uint32_t retransmissions;   // uplinks received again (same frame counter)
+    uint32_t payloadBytes;      // application payload of the new uplinks
+    uint32_t uplinksLost;       // uplinks below the sensitivity of the gateway
+    uint32_t micFailures;       // frames with an invalid MIC
+    uint32_t counterRejected;   // frames with an old frame counter or DevNonce
+    uint32_t downlinks;         // downlinks sent
+    uint32_t downlinksRx1;      // downlinks sent in RX1
+    uint32_t downlinksRx2;      // downlinks sent in RX2
+    uint32_t downlinksLost;     // downlinks below the sensitivity of the device
+    uint32_t downlinksDropped;  // downlinks not sent due to the gateway duty cycle
+    uint32_t linkAdrReqs;       // LinkADRReq sent
+    uint32_t linkAdrAccepted;   // LinkADRAns accepting all settings
+    uint32_t devStatusReqs;     // DevStatusReq sent
+    uint32_t devStatusAnswers;  // DevStatusAns received
+    uint32_t rxParamSetupReqs;  // RXParamSetupReq sent
+    uint32_t rxParamSetupAccepted; // RXParamSetupAns accepting all settings
+    int64_t adrSettledAt;       // time the last LinkADRReq has been accepted (in µs)
+    uint32_t adrSettledUplinks; // uplinks received until then
+    uint8_t dataRate;           // data rate of the device set by ADR
+    int8_t txPower;             // transmit power of the device set by ADR (in dBm)
+    uint8_t battery;            // last battery level reported by DevStatusAns
+    int8_t margin;              // last margin reported by DevStatusAns (in dB)
+} ns_stats_t;
+
+
+// Start the network server for the given device (registers the radio TX handler)
+void ns_sim_init(const ns_device_t* device, const ns_config_t* config);
+
+// Queue a downlink message for the next downlink opportunity
+bool ns_sim_queueDownlink(uint8_t port, const uint8_t* payload, uint8_t length);
+
+ns_stats_t ns_sim_getStats(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * SDK configuration for the host build of LMIC (replaces the configuration
+ * generated by 'make menuconfig'). The values match the defaults of Kconfig.
+ *******************************************************************************/
+
+#ifndef _sdkconfig_host_h_
+#define _sdkconfig_host_h_
+
+#define CONFIG_TTN_LORA_FREQ_EU_868 1
+#define CONFIG_TTN_RADIO_SX1276_77_78_79 1
+#define CONFIG_TTN_SPI_FREQ 10000000
+#define CONFIG_TTN_RX_RAMPUP 2000
+#define CONFIG_TTN_RX_ERROR 10000
+#define CONFIG_TTN_PROVISION_UART_NONE 1
+#define CONFIG_TTN_FCNT_NVS_STRIDE 100
+
+#endif
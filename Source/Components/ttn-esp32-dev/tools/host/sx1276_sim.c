@@ -0,0 +1,534 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Register-level model of the SX1276 LoRa modem for the host build.
+ *
+ * The model implements the registers and operating modes used by LMIC in
+ * LoRa mode: FIFO, frequency, modem configuration, IRQ flags and mask, DIO
+ * mapping, symbol timeout and I/Q inversion. Transmissions and receptions
+ * take the airtime calculated by LMIC ('calcAirTime()'). Completion is
+ * reported as TX done, RX done or RX timeout on DIO0 and DIO1.
+ *
+ * A frame is received if the receiver is on the same frequency, spreading
+ * factor, bandwidth and I/Q polarity, and if it is opened early enough to
+ * detect the preamble. Collisions, interference and FSK are not modelled.
+ *******************************************************************************/
+
+#include <string.h>
+#include "sx1276_sim.h"
+#include "hal_host.h"
+
+
+// Registers (LoRa mode)
+#define REG_FIFO                0x00
+#define REG_OPMODE              0x01
+#define REG_FRF_MSB             0x06
+#define REG_FRF_MID             0x07
+#define REG_FRF_LSB             0x08
+#define REG_PA_CONFIG           0x09
+#define REG_FIFO_ADDR_PTR       0x0D
+#define REG_FIFO_TX_BASE        0x0E
+#define REG_FIFO_RX_BASE        0x0F
+#define REG_FIFO_RX_CURRENT     0x10
+#define REG_IRQ_FLAGS_MASK      0x11
+#define REG_IRQ_FLAGS           0x12
+#define REG_RX_NB_BYTES         0x13
+#define REG_PKT_SNR             0x19
+#define REG_PKT_RSSI            0x1A
+#define REG_RSSI                0x1B
+#define REG_MODEM_CONFIG1       0x1D
+#define REG_MODEM_CONFIG2       0x1E
+#define REG_SYMB_TIMEOUT_LSB    0x1F
+#define REG_PAYLOAD_LENGTH      0x22
+#define REG_RSSI_WIDEBAND       0x2C
+#define REG_INVERT_IQ           0x33
+#define REG_DIO_MAPPING1        0x40
+#define REG_VERSION             0x42
+#define REG_PA_DAC              0x4D
+
+#define OPMODE_LORA             0x80
+#define OPMODE_MASK             0x07
+#define OPMODE_TX               0x03
+#define OPMODE_RX               0x05
+#define OPMODE_RX_SINGLE        0x06
+#define OPMODE_STANDBY          0x01
+
+#define IRQ_RXTIMEOUT           0x80
+#define IRQ_RXDONE              0x40
+#define IRQ_TXDONE              0x08
+
+#define PA_CONFIG_PA_BOOST      0x80
+#define PA_DAC_20DBM            0x07
+
+// RSSI register offset in the high frequency band
+#define RSSI_OFFSET_HF          157
+// Noise floor reported by the RSSI register (in dBm)
+#define NOISE_FLOOR             -120
+
+// LoRaWAN preamble length and number of symbols needed to detect it
+#define PREAMBLE_SYMBOLS        8
+#define DETECT_SYMBOLS          4
+
+#define MAX_FRAMES_ON_AIR       8
+
+
+enum SimOperation
+{
+    eOpNone,
+    eOpTx,
+    eOpRxSingle,
+    eOpRxContinuous
+};
+
+static uint8_t regs[0x80];
+static uint8_t fifo[256];
+static uint32_t randomState;
+
+static enum SimOperation operation;
+static int64_t rxOpened;
+static bool eventPending;
+static int64_t eventTime;
+static uint8_t eventFlags;
+static sim_frame_t txFrame;
+static int rxFrameIndex;
+
+static sim_frame_t air[MAX_FRAMES_ON_AIR];
+static bool airUsed[MAX_FRAMES_ON_AIR];
+static bool airReceived[MAX_FRAMES_ON_AIR];
+
+static sim_tx_handler_t* txHandler;
+static void* txHandlerUserData;
+static sim_radio_stats_t stats;
+
+static void writeReg(uint8_t addr, uint8_t data);
+static uint8_t readReg(uint8_t addr);
+static void setOpmode(uint8_t mode);
+static void startTx(void);
+static void evaluateRx(void);
+static void purgeAir(void);
+static uint8_t nextRandom(void);
+
+
+void sim_radio_init(uint32_t seed)
+{
+    memset(regs, 0, sizeof(regs));
+    memset(fifo, 0, sizeof(fifo));
+    memset(airUsed, 0, sizeof(airUsed));
+    memset(&stats, 0, sizeof(stats));
+
+    // Reset values (datasheet), the radio starts in FSK standby mode
+    regs[REG_OPMODE] = 0x09;
+    regs[REG_FRF_MSB] = 0x6C;
+    regs[REG_FRF_MID] = 0x80;
+    regs[REG_PA_CONFIG] = 0x4F;
+    regs[REG_FIFO_TX_BASE] = 0x80;
+    regs[REG_MODEM_CONFIG1] = 0x72;
+    regs[REG_MODEM_CONFIG2] = 0x70;
+    regs[REG_SYMB_TIMEOUT_LSB] = 0x64;
+    regs[REG_PAYLOAD_LENGTH] = 0x01;
+    regs[REG_INVERT_IQ] = 0x27;
+    regs[REG_VERSION] = 0x12;
+    regs[REG_PA_DAC] = 0x84;
+
+    randomState = seed != 0 ? seed : 1;
+    operation = eOpNone;
+    eventPending = false;
+}
+
+void sim_radio_setTxHandler(sim_tx_handler_t* handler, void* userData)
+{
+    txHandler = handler;
+    txHandlerUserData = userData;
+}
+
+sim_radio_stats_t sim_radio_getStats(void)
+{
+    purgeAir();
+    return stats;
+}
+
+int64_t sim_radio_airtime(rps_t rps, uint8_t length)
+{
+    return osticks2us(calcAirTime(rps, length));
+}
+
+
+// --- SPI
+
+// Burst access increments the address, except for the FIFO
+void sim_radio_spiWrite(uint8_t addr, const uint8_t* buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        writeReg(addr, buf[i]);
+        if (addr != REG_FIFO)
+            addr = (addr + 1) & 0x7f;
+    }
+}
+
+void sim_radio_spiRead(uint8_t addr, uint8_t* buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        buf[i] = readReg(addr);
+        if (addr != REG_FIFO)
+            addr = (addr + 1) & 0x7f;
+    }
+}
+
+void writeReg(uint8_t addr, uint8_t data)
+{
+    switch (addr)
+    {
+        case REG_FIFO:
+            fifo[regs[REG_FIFO_ADDR_PTR]++] = data;
+            break;
+        case REG_OPMODE:
+            setOpmode(data);
+            break;
+        case REG_IRQ_FLAGS:
+            // flags are cleared by writing 1
+            regs[REG_IRQ_FLAGS] &= ~data;
+            break;
+        case REG_VERSION:
+        case REG_RX_NB_BYTES:
+        case REG_FIFO_RX_CURRENT:
+        case REG_PKT_SNR:
+        case REG_PKT_RSSI:
+        case REG_RSSI:
+        case REG_RSSI_WIDEBAND:
+            // read-only
+            break;
+        default:
+            regs[addr] = data;
+            break;
+    }
+}
+
+uint8_t readReg(uint8_t addr)
+{
+    switch (addr)
+    {
+        case REG_FIFO:
+            return fifo[regs[REG_FIFO_ADDR_PTR]++];
+        case REG_RSSI:
+            return (uint8_t)(NOISE_FLOOR + RSSI_OFFSET_HF + (nextRandom() & 0x03));
+        case REG_RSSI_WIDEBAND:
+            return nextRandom();
+        default:
+            return regs[addr];
+    }
+}
+
+// xorshift32: deterministic noise for the random number generation of LMIC
+uint8_t nextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return (uint8_t)randomState;
+}
+
+
+// --- Modem configuration
+
+static uint32_t currentFrf(void)
+{
+    return ((uint32_t)regs[REG_FRF_MSB] << 16) | ((uint32_t)regs[REG_FRF_MID] << 8) | regs[REG_FRF_LSB];
+}
+
+static uint32_t frequencyToFrf(uint32_t freq)
+{
+    return (uint32_t)(((uint64_t)freq << 19) / 32000000);
+}
+
+// Lowest frequency with the given register value, rounded to 100 Hz if possible
+static uint32_t frfToFrequency(uint32_t frf)
+{
+    uint32_t freq = (uint32_t)((((uint64_t)frf * 32000000) + (1 << 19) - 1) >> 19);
+    uint32_t rounded = (freq + 99) / 100 * 100;
+    return frequencyToFrf(rounded) == frf ? rounded : freq;
+}
+
+static rps_t currentRps(uint8_t length)
+{
+    uint8_t mc1 = regs[REG_MODEM_CONFIG1];
+    uint8_t mc2 = regs[REG_MODEM_CONFIG2];
+    sf_t sf = (sf_t)((mc2 >> 4) - 6);
+    bw_t bw = (bw_t)((mc1 >> 4) - 7);
+    cr_t cr = (cr_t)(((mc1 >> 1) & 0x07) - 1);
+    int ih = (mc1 & 0x01) != 0 ? length : 0;
+    int nocrc = (mc2 & 0x04) == 0;
+    return makeRps(sf, bw, cr, ih, nocrc);
+}
+
+// Output power configured by PaConfig and PaDac (datasheet, section 5.4.3)
+static int8_t currentPower(void)
+{
+    uint8_t paConfig = regs[REG_PA_CONFIG];
+    int outputPower = paConfig & 0x0F;
+    if ((paConfig & PA_CONFIG_PA_BOOST) != 0)
+        return (regs[REG_PA_DAC] & 0x07) == PA_DAC_20DBM ? 20 : 2 + outputPower;
+
+    // RFO pin: Pmax = 10.8 + 0.6 * MaxPower
+    int maxPower = (paConfig >> 4) & 0x07;
+    return (int8_t)((108 + 6 * maxPower) / 10 - 15 + outputPower);
+}
+
+static int64_t symbolTime(rps_t rps)
+{
+    return ((int64_t)1000000 << (getSf(rps) + 6)) / (125000 << getBw(rps));
+}
+
+// An operation in progress is aborted by any mode change
+void setOpmode(uint8_t mode)
+{
+    uint8_t previous = regs[REG_OPMODE];
+    regs[REG_OPMODE] = mode;
+    if (mode == previous)
+        return;
+
+    operation = eOpNone;
+    eventPending = false;
+
+    // FSK mode is not modelled: nothing happens
+    if ((mode & OPMODE_LORA) == 0)
+        return;
+
+    switch (mode & OPMODE_MASK)
+    {
+        case OPMODE_TX:
+            startTx();
+            break;
+        case OPMODE_RX_SINGLE:
+            operation = eOpRxSingle;
+            rxOpened = hal_host_time();
+            stats.rxWindows++;
+            evaluateRx();
+            break;
+        case OPMODE_RX:
+            operation = eOpRxContinuous;
+            rxOpened = hal_host_time();
+            evaluateRx();
+            break;
+        default:
+            break;
+    }
+}
+
+void startTx(void)
+{
+    uint8_t length = regs[REG_PAYLOAD_LENGTH];
+    memset(&txFrame, 0, sizeof(txFrame));
+    txFrame.start = hal_host_time();
+    txFrame.freq = frfToFrequency(currentFrf());
+    txFrame.rps = currentRps(length);
+    // InvertIQ TX bit: 1 = normal, 0 = inverted
+    txFrame.invertIq = (regs[REG_INVERT_IQ] & 0x01) == 0;
+    txFrame.power = currentPower();
+    txFrame.length = length;
+    for (uint8_t i = 0; i < length; i++)
+        txFrame.payload[i] = fifo[(uint8_t)(regs[REG_FIFO_TX_BASE] + i)];
+    txFrame.end = txFrame.start + sim_radio_airtime(txFrame.rps, length);
+
+    operation = eOpTx;
+    eventPending = true;
+    eventTime = txFrame.end;
+    eventFlags = IRQ_TXDONE;
+}
+
+
+// --- Reception
+
+bool sim_radio_sendDownlink(const sim_frame_t* frame)
+{
+    purgeAir();
+    for (int i = 0; i < MAX_FRAMES_ON_AIR; i++)
+    {
+        if (airUsed[i])
+            continue;
+
+        air[i] = *frame;
+        air[i].end = frame->start + sim_radio_airtime(frame->rps, frame->length);
+        airUsed[i] = true;
+        airReceived[i] = false;
+
+        // The frame might be received by the running reception
+        if (operation == eOpRxContinuous || (operation == eOpRxSingle && eventFlags == IRQ_RXTIMEOUT))
+            evaluateRx();
+        return true;
+    }
+    return false;
+}
+
+// Checks if the receiver can detect the preamble of the frame.
+// Returns the time of the detection or -1.
+static int64_t detectFrame(const sim_frame_t* frame, rps_t rxRps, int64_t timeout)
+{
+    if (frequencyToFrf(frame->freq) != currentFrf())
+        return -1;
+    if (getSf(frame->rps) != getSf(rxRps) || getBw(frame->rps) != getBw(rxRps))
+        return -1;
+    // InvertIQ RX bit: 1 = inverted
+    if (frame->invertIq != ((regs[REG_INVERT_IQ] & 0x40) != 0))
+        return -1;
+
+    // Enough of the preamble must be left when the receiver is opened
+    int64_t tsym = symbolTime(rxRps);
+    if (rxOpened > frame->start + (PREAMBLE_SYMBOLS - DETECT_SYMBOLS) * tsym)
+        return -1;
+
+    int64_t detected = (frame->start > rxOpened ? frame->start : rxOpened) + DETECT_SYMBOLS * tsym;
+    if (timeout >= 0 && detected > timeout)
+        return -1;
+    return detected;
+}
+
+// Determine the outcome of the reception started at 'rxOpened'
+void evaluateRx(void)
+{
+    rps_t rxRps = currentRps(0);
+    int64_t timeout = -1;
+    if (operation == eOpRxSingle)
+    {
+        int symbols = ((regs[REG_MODEM_CONFIG2] & 0x03) << 8) | regs[REG_SYMB_TIMEOUT_LSB];
+        timeout = rxOpened + symbols * symbolTime(rxRps);
+    }
+
+    // Earliest frame that can be received
+    rxFrameIndex = -1;
+    int64_t firstDetection = 0;
+    for (int i = 0; i < MAX_FRAMES_ON_AIR; i++)
+    {
+        if (!airUsed[i] || airReceived[i])
+            continue;
+        int64_t detected = detectFrame(&air[i], rxRps, timeout);
+        if (detected >= 0 && (rxFrameIndex < 0 || detected < firstDetection))
+        {
+            rxFrameIndex = i;
+            firstDetection = detected;
+        }
+    }
+
+    if (rxFrameIndex >= 0)
+    {
+        eventPending = true;
+        eventTime = air[rxFrameIndex].end;
+        eventFlags = IRQ_RXDONE;
+    }
+    else if (operation == eOpRxSingle)
+    {
+        eventPending = true;
+        eventTime = timeout;
+        eventFlags = IRQ_RXTIMEOUT;
+    }
+    else
+    {
+        eventPending = false;
+    }
+}
+
+// Remove the frames that are completely in the past
+void purgeAir(void)
+{
+    int64_t now = hal_host_time();
+    for (int i = 0; i < MAX_FRAMES_ON_AIR; i++)
+    {
+        if (!airUsed[i] || air[i].end >= now || (eventPending && i == rxFrameIndex && eventFlags == IRQ_RXDONE))
+            continue;
+        if (!airReceived[i])
+            stats.downlinksMissed++;
+        airUsed[i] = false;
+    }
+}
+
+static void deliverFrame(const sim_frame_t* frame)
+{
+    uint8_t base = regs[REG_FIFO_RX_BASE];
+    for (uint8_t i = 0; i < frame->length; i++)
+        fifo[(uint8_t)(base + i)] = frame->payload[i];
+    regs[REG_FIFO_RX_CURRENT] = base;
+    regs[REG_RX_NB_BYTES] = frame->length;
+    regs[REG_PKT_SNR] = (uint8_t)(frame->snr * 4);
+    int rssi = frame->rssi + RSSI_OFFSET_HF;
+    regs[REG_PKT_RSSI] = (uint8_t)(rssi < 0 ? 0 : rssi > 255 ? 255 : rssi);
+    stats.rxFrames++;
+}
+
+
+// --- Events
+
+bool sim_radio_nextEvent(int64_t* time)
+{
+    if (!eventPending)
+        return false;
+    *time = eventTime;
+    return true;
+}
+
+// DIO0: 00 = RX done, 01 = TX done; DIO1: 00 = RX timeout
+static int interruptPin(uint8_t flags)
+{
+    uint8_t mapping = regs[REG_DIO_MAPPING1];
+    if ((flags & regs[REG_IRQ_FLAGS_MASK]) != 0)
+        return -1;
+    if (flags == IRQ_TXDONE && (mapping >> 6) == 1)
+        return 0;
+    if (flags == IRQ_RXDONE && (mapping >> 6) == 0)
+        return 0;
+    if (flags == IRQ_RXTIMEOUT && ((mapping >> 4) & 0x03) == 0)
+        return 1;
+    return -1;
+}
+
+int sim_radio_processEvent(void)
+{
+    if (!eventPending)
+        return -1;
+
+    eventPending = false;
+    uint8_t flags = eventFlags;
+    regs[REG_IRQ_FLAGS] |= flags;
+
+    switch (flags)
+    {
+        case IRQ_TXDONE:
+            operation = eOpNone;
+            regs[REG_OPMODE] = (regs[REG_OPMODE] & ~OPMODE_MASK) | OPMODE_STANDBY;
+            stats.txFrames++;
+            stats.txAirtime += txFrame.end - txFrame.start;
+            if (txHandler != NULL)
+                txHandler(&txFrame, txHandlerUserData);
+            break;
+
+        case IRQ_RXDONE:
+            airReceived[rxFrameIndex] = true;
+            deliverFrame(&air[rxFrameIndex]);
+            if (operation == eOpRxSingle)
+            {
+                operation = eOpNone;
+                regs[REG_OPMODE] = (regs[REG_OPMODE] & ~OPMODE_MASK) | OPMODE_STANDBY;
+            }
+            else
+            {
+                // continuous reception goes on
+                rxOpened = hal_host_time();
+                evaluateRx();
+            }
+            break;
+
+        case IRQ_RXTIMEOUT:
+            operation = eOpNone;
+            regs[REG_OPMODE] = (regs[REG_OPMODE] & ~OPMODE_MASK) | OPMODE_STANDBY;
+            stats.rxTimeouts++;
+            break;
+    }
+
+    return interruptPin(flags);
+}
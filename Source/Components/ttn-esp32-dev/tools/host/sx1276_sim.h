@@ -0,0 +1,82 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Register-level model of the SX1276 LoRa modem for the host build.
+ *******************************************************************************/
+
+#ifndef _sx1276_sim_h_
+#define _sx1276_sim_h_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "lmic/lmic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @brief LoRa frame on air
+ */
+typedef struct
+{
+    int64_t start;          // start of the transmission (virtual time in µs)
+    int64_t end;            // end of the transmission (virtual time in µs)
+    uint32_t freq;          // frequency (in Hz)
+    rps_t rps;              // spreading factor, bandwidth, coding rate, CRC
+    bool invertIq;          // I/Q inverted (downlinks)
+    int8_t power;           // transmit power (in dBm)
+    int16_t rssi;           // signal strength at the receiver (in dBm)
+    int8_t snr;             // signal-to-noise ratio at the receiver (in dB)
+    uint8_t length;
+    uint8_t payload[255];
+} sim_frame_t;
+
+/**
+ * @brief Radio statistics
+ */
+typedef struct
+{
+    uint32_t txFrames;          // frames transmitted
+    int64_t txAirtime;          // total transmission time (in µs)
+    uint32_t rxWindows;         // single receptions started (RX windows)
+    uint32_t rxTimeouts;        // single receptions ended without a frame
+    uint32_t rxFrames;          // frames received
+    uint32_t downlinksMissed;   // downlinks on air that were not received
+} sim_radio_stats_t;
+
+// Called when the radio has completed the transmission of a frame
+typedef void sim_tx_handler_t(const sim_frame_t* frame, void* userData);
+
+
+void sim_radio_init(uint32_t seed);
+void sim_radio_setTxHandler(sim_tx_handler_t* handler, void* userData);
+
+// Put a frame on air for reception by the radio. 'start' must be set, 'end' is computed.
+bool sim_radio_sendDownlink(const sim_frame_t* frame);
+
+void sim_radio_spiWrite(uint8_t addr, const uint8_t* buf, size_t len);
+void sim_radio_spiRead(uint8_t addr, uint8_t* buf, size_t len);
+
+// Time of the next radio event (TX done, RX done, RX timeout)
+bool sim_radio_nextEvent(int64_t* time);
+// Process the next radio event. Returns the DIO pin raising an interrupt or -1.
+int sim_radio_processEvent(void);
+
+int64_t sim_radio_airtime(rps_t rps, uint8_t length);
+sim_radio_stats_t sim_radio_getStats(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
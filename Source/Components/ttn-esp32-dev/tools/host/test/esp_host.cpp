@@ -0,0 +1,41 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host implementation of the ESP-IDF functions used by the code under test.
+ *******************************************************************************/
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "mbedtls/sha256.h"
+
+
+int host_log_verbose = 0;
+
+
+esp_err_t esp_efuse_mac_get_default(uint8_t* mac)
+{
+    static const uint8_t hostMac[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+    memcpy(mac, hostMac, sizeof(hostMac));
+    return ESP_OK;
+}
+
+
+// The hash of the provisioned keys is not used by the host tests
+static void noSha256()
+{
+    fprintf(stderr, "SHA-256 is not available in the host tests\n");
+    abort();
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx) { noSha256(); }
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx) { noSha256(); }
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context* ctx, int is224) { noSha256(); return -1; }
+int mbedtls_sha256_update_ret(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen) { noSha256(); return -1; }
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context* ctx, unsigned char output[32]) { noSha256(); return -1; }
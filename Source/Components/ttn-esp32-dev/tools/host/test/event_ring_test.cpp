@@ -0,0 +1,162 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host stress test of the event ring ('TTNEventRing.h').
+ *
+ * A producer thread posts numbered events while the main thread receives
+ * them, with phases where the producer is faster than the consumer (the
+ * ring overflows) and phases where the consumer waits for notifications.
+ * The test checks that:
+ *
+ * - the events are delivered in FIFO order and unchanged,
+ * - exactly the events accepted by 'post()' are delivered,
+ * - overflows() plus the delivered events equals the posted events,
+ * - maxUsage() reaches the capacity if the ring has overflowed,
+ * - 'receive()' returns after the timeout if no event arrives.
+ *
+ * Build and run (in this directory):
+ *
+ *     g++ -std=gnu++11 -O2 -Wall -pthread -Iinclude -I.. -I../../../src \
+ *         -o event_ring_test event_ring_test.cpp freertos_host.cpp
+ *     ./event_ring_test
+ *
+ * Adding '-fsanitize=thread' checks the memory ordering as well.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "TTNEventRing.h"
+
+
+static const uint32_t RING_SIZE = 16;
+static const uint32_t NUM_EVENTS = 500000;
+
+struct TestEvent
+{
+    uint32_t seq;
+    uint32_t check;
+    uint8_t payload[24];
+};
+
+static TTNEventRing<TestEvent, RING_SIZE> ring;
+static std::vector<uint32_t> accepted;
+static std::atomic<bool> producerDone(false);
+
+static int failures;
+
+
+static void check(bool ok, const char* test)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", test);
+        failures++;
+    }
+}
+
+static bool isValid(const TestEvent& event)
+{
+    if (event.check != ~event.seq)
+        return false;
+    for (size_t i = 0; i < sizeof(event.payload); i++)
+    {
+        if (event.payload[i] != (uint8_t)(event.seq + i))
+            return false;
+    }
+    return true;
+}
+
+static void producer()
+{
+    for (uint32_t seq = 0; seq < NUM_EVENTS; seq++)
+    {
+        TestEvent event;
+        event.seq = seq;
+        event.check = ~seq;
+        for (size_t i = 0; i < sizeof(event.payload); i++)
+            event.payload[i] = (uint8_t)(seq + i);
+
+        if (ring.post(event))
+            accepted.push_back(seq);
+
+        // Let the consumer catch up and wait for notifications now and then
+        if (seq % 5000 == 0)
+            vTaskDelay(1);
+        else if (seq % 64 == 0)
+            std::this_thread::yield();
+    }
+    producerDone = true;
+}
+
+static void testStress()
+{
+    std::vector<uint32_t> delivered;
+    delivered.reserve(NUM_EVENTS);
+    bool valid = true;
+
+    std::thread producerThread(producer);
+
+    TestEvent event;
+    while (true)
+    {
+        if (ring.receive(&event, pdMS_TO_TICKS(10)))
+        {
+            valid = valid && isValid(event);
+            delivered.push_back(event.seq);
+
+            // Slow consumer phases let the ring overflow
+            if (event.seq % 50000 < 200)
+                std::this_thread::yield();
+        }
+        else if (producerDone)
+        {
+            // All posts have completed, collect the remaining events
+            while (ring.tryReceive(&event))
+            {
+                valid = valid && isValid(event);
+                delivered.push_back(event.seq);
+            }
+            break;
+        }
+    }
+
+    producerThread.join();
+
+    check(valid, "events delivered unchanged");
+    check(delivered == accepted, "accepted events delivered in FIFO order");
+    check(ring.overflows() + delivered.size() == NUM_EVENTS, "overflows + delivered == posted");
+    check(ring.maxUsage() <= RING_SIZE, "maxUsage within capacity");
+    check(ring.overflows() == 0 || ring.maxUsage() == RING_SIZE, "maxUsage reaches capacity on overflow");
+
+    printf("%u events posted: %u delivered, %u overflows, max. usage %u\n",
+        NUM_EVENTS, (unsigned)delivered.size(), ring.overflows(), ring.maxUsage());
+}
+
+static void testTimeout()
+{
+    TestEvent event;
+    TickType_t start = xTaskGetTickCount();
+    bool received = ring.receive(&event, pdMS_TO_TICKS(50));
+    TickType_t elapsed = xTaskGetTickCount() - start;
+
+    check(!received, "nothing received from empty ring");
+    check(elapsed >= pdMS_TO_TICKS(50), "receive waits for the timeout");
+    check(elapsed < pdMS_TO_TICKS(1000), "receive returns after the timeout");
+}
+
+int main(int argc, char* argv[])
+{
+    testStress();
+    testTimeout();
+
+    printf("Event ring tests: %s (%d failures)\n", failures == 0 ? "passed" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host implementation of the FreeRTOS functions declared in 'FreeRTOS.h'.
+ * Each host thread is a task with its own notification value.
+ *******************************************************************************/
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+struct HostTask
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    uint32_t notifyValue = 0;
+};
+
+// The task object lives as long as its thread. A task must therefore not
+// end while other tasks can still notify it.
+static thread_local HostTask currentTask;
+
+static const auto startTime = std::chrono::steady_clock::now();
+
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return &currentTask;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    HostTask* t = (HostTask*)task;
+    {
+        std::lock_guard<std::mutex> lock(t->mutex);
+        t->notifyValue++;
+    }
+    t->cond.notify_one();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    HostTask* t = &currentTask;
+    std::unique_lock<std::mutex> lock(t->mutex);
+    auto notified = [t] { return t->notifyValue != 0; };
+    if (ticksToWait == portMAX_DELAY)
+        t->cond.wait(lock, notified);
+    else
+        t->cond.wait_for(lock, std::chrono::milliseconds(ticksToWait), notified);
+
+    uint32_t value = t->notifyValue;
+    if (value != 0)
+        t->notifyValue = clearCountOnExit ? 0 : value - 1;
+    return value;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    auto elapsed = std::chrono::steady_clock::now() - startTime;
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+void vTaskSetTimeOutState(TimeOut_t* timeOut)
+{
+    timeOut->start = xTaskGetTickCount();
+}
+
+BaseType_t xTaskCheckForTimeOut(TimeOut_t* timeOut, TickType_t* ticksToWait)
+{
+    if (*ticksToWait == portMAX_DELAY)
+        return pdFALSE;
+
+    TickType_t now = xTaskGetTickCount();
+    TickType_t elapsed = now - timeOut->start;
+    if (elapsed >= *ticksToWait)
+    {
+        *ticksToWait = 0;
+        return pdTRUE;
+    }
+
+    *ticksToWait -= elapsed;
+    timeOut->start = now;
+    return pdFALSE;
+}
+
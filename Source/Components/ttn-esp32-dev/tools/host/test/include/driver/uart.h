@@ -0,0 +1,21 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host replacement for the ESP-IDF header of the same name (host tests only).
+ *
+ * The host tests are built without the UART provisioning, so no declarations
+ * are needed.
+ *******************************************************************************/
+
+#ifndef _host_driver_uart_h_
+#define _host_driver_uart_h_
+
+#include "freertos/FreeRTOS.h"
+
+#endif
@@ -0,0 +1,18 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host replacement for the ESP-IDF header of the same name (host tests only).
+ *******************************************************************************/
+
+#ifndef _host_esp_event_h_
+#define _host_esp_event_h_
+
+#include "esp_err.h"
+
+#endif
@@ -0,0 +1,27 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host replacement for the ESP-IDF header of the same name (host tests only).
+ *******************************************************************************/
+
+#ifndef _host_esp_log_h_
+#define _host_esp_log_h_
+
+#include <stdio.h>
+
+// Warnings and errors are output, informational messages only if requested
+extern int host_log_verbose;
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) do { if (host_log_verbose) printf("I (%s) " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, format, ...) do { if (host_log_verbose) printf("D (%s) " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGV(tag, format, ...) do { } while (0)
+
+#endif
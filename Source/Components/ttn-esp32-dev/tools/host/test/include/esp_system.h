@@ -0,0 +1,29 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host replacement for the ESP-IDF header of the same name (host tests only).
+ *******************************************************************************/
+
+#ifndef _host_esp_system_h_
+#define _host_esp_system_h_
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_efuse_mac_get_default(uint8_t* mac);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
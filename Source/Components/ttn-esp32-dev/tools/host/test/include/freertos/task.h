@@ -0,0 +1,18 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host replacement for FreeRTOS (see 'FreeRTOS.h').
+ *******************************************************************************/
+
+#ifndef _host_freertos_task_h_
+#define _host_freertos_task_h_
+
+#include "freertos/FreeRTOS.h"
+
+#endif
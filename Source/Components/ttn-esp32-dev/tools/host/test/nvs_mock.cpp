@@ -0,0 +1,127 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * In-memory replacement of the ESP-IDF NVS for the host tests.
+ *
+ * As on the ESP32, a value written with 'nvs_set_blob()' is immediately
+ * stored in flash. So it survives a (simulated) power loss, while RTC
+ * memory and RAM do not.
+ *******************************************************************************/
+
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "nvs_flash.h"
+#include "nvs_mock.h"
+
+
+struct OpenHandle
+{
+    std::string name;
+    nvs_open_mode mode;
+};
+
+// Namespace -> key -> value
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> flash;
+static std::map<nvs_handle, OpenHandle> handles;
+static nvs_handle nextHandle = 1;
+static uint32_t writeCount;
+
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode open_mode, nvs_handle* out_handle)
+{
+    // A namespace only exists after it has been opened for writing
+    if (flash.find(name) == flash.end())
+    {
+        if (open_mode == NVS_READONLY)
+            return ESP_ERR_NVS_NOT_FOUND;
+        flash[name];
+    }
+
+    *out_handle = nextHandle++;
+    handles[*out_handle] = OpenHandle{ name, open_mode };
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle)
+{
+    handles.erase(handle);
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    return handles.count(handle) != 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out_value, size_t* length)
+{
+    auto h = handles.find(handle);
+    if (h == handles.end())
+        return ESP_FAIL;
+
+    auto& values = flash[h->second.name];
+    auto value = values.find(key);
+    if (value == values.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    // As ESP-IDF: query the length if no buffer is given
+    if (out_value == nullptr)
+    {
+        *length = value->second.size();
+        return ESP_OK;
+    }
+    if (*length < value->second.size())
+        return ESP_ERR_NVS_INVALID_LENGTH;
+
+    memcpy(out_value, value->second.data(), value->second.size());
+    *length = value->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void* value, size_t length)
+{
+    auto h = handles.find(handle);
+    if (h == handles.end() || h->second.mode != NVS_READWRITE)
+        return ESP_FAIL;
+
+    const uint8_t* bytes = (const uint8_t*)value;
+    flash[h->second.name][key] = std::vector<uint8_t>(bytes, bytes + length);
+    writeCount++;
+    return ESP_OK;
+}
+
+
+void nvs_mock_erase(void)
+{
+    flash.clear();
+    handles.clear();
+}
+
+uint32_t nvs_mock_writes(void)
+{
+    return writeCount;
+}
+
+bool nvs_mock_get(const char* name, const char* key, void* value, size_t length)
+{
+    auto values = flash.find(name);
+    if (values == flash.end())
+        return false;
+    auto v = values->second.find(key);
+    if (v == values->second.end() || v->second.size() != length)
+        return false;
+    memcpy(value, v->second.data(), length);
+    return true;
+}
@@ -0,0 +1,38 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * In-memory replacement of the ESP-IDF NVS for the host tests.
+ *******************************************************************************/
+
+#ifndef _nvs_mock_h_
+#define _nvs_mock_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Erase all namespaces (as 'nvs_flash_erase()')
+void nvs_mock_erase(void);
+
+// Number of values written since the start ('nvs_set_blob()' calls)
+uint32_t nvs_mock_writes(void);
+
+// Read a value directly, bypassing the handles; returns false if not found
+bool nvs_mock_get(const char* name, const char* key, void* value, size_t length);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+/*******************************************************************************
+ *
+ * ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+ *
+ * Copyright (c) 2019 ContextQuickie
+ *
+ * Licensed under MIT License
+ * https://opensource.org/licenses/MIT
+ *
+ * Host test of the session persistence in NVS ('TTNSession.cpp').
+ *
+ * The LMIC core runs with the host HAL of 'lmic_sim' and 'TTNProvisioning'
+ * stores its data in the in-memory NVS of 'nvs_mock.cpp'. A power loss is
+ * simulated by clearing the RTC memory and resetting LMIC, while the NVS
+ * content is kept. The test checks that:
+ *
+ * - the uplink frame counter never goes backwards and no counter value is
+ *   used twice, across any number of power losses,
+ * - after a power loss, the counter jumps ahead to the limit saved in NVS
+ *   and the next range of CONFIG_TTN_FCNT_NVS_STRIDE values is reserved,
+ * - the limit is only written every CONFIG_TTN_FCNT_NVS_STRIDE / 2 uplinks,
+ *   and TTNProvisioning::nvsWriteCount() counts every write,
+ * - resuming after deep sleep (RTC memory) does not write NVS.
+ *
+ * Build and run (in this directory):
+ *
+ *     gcc -std=gnu99 -O2 -fwrapv -ffunction-sections -I.. -I../../../src \
+ *         -DUSE_ORIGINAL_AES -c ../hal_host.c ../sx1276_sim.c \
+ *         ../../../src/lmic/lmic*.c ../../../src/lmic/oslmic.c \
+ *         ../../../src/lmic/radio.c ../../../src/aes/lmic_aes.c
+ *     g++ -std=gnu++11 -O2 -fwrapv -ffunction-sections -Wl,--gc-sections \
+ *         -Iinclude -I.. -I../../../src -DUSE_ORIGINAL_AES -o session_test \
+ *         session_test.cpp esp_host.cpp nvs_mock.cpp \
+ *         ../../../src/TTNSession.cpp ../../../src/TTNProvisioning.cpp *.o
+ *     rm *.o
+ *     ./session_test
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "lmic/lmic.h"
+#include "TTNSession.h"
+#include "TTNProvisioning.h"
+#include "nvs_mock.h"
+#include "sx1276_sim.h"
+
+
+static const uint32_t STRIDE = CONFIG_TTN_FCNT_NVS_STRIDE;
+
+static const devaddr_t DEV_ADDR = 0x260b1234;
+static const u1_t NWK_SKEY[16] = {
+    0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00
+};
+static const u1_t APP_SKEY[16] = {
+    0x0f, 0x1e, 0x2d, 0x3c, 0x4b, 0x5a, 0x69, 0x78, 0x87, 0x96, 0xa5, 0xb4, 0xc3, 0xd2, 0xe1, 0xf0
+};
+
+static TTNProvisioning provisioning;
+static TTNSession session;
+
+static int failures;
+// Highest uplink frame counter used so far (-1 if none)
+static int64_t maxUsedCounter;
+static uint32_t randomState = 1;
+
+
+static void check(bool ok, const char* test)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", test);
+        failures++;
+    }
+}
+
+static uint32_t randomNumber(uint32_t range)
+{
+    randomState = randomState * 1103515245 + 12345;
+    return (randomState >> 8) % range;
+}
+
+static uint32_t savedLimit()
+{
+    uint32_t limit = 0;
+    nvs_mock_get("ttn", "fcntLimit", &limit, sizeof(limit));
+    return limit;
+}
+
+// Start after a power loss: RAM and RTC memory are lost, NVS is kept
+static void powerOn()
+{
+    session.invalidate();
+    LMIC_reset();
+}
+
+// Send an uplink as LMIC and the TheThingsNetwork class do it
+static void sendUplink()
+{
+    maxUsedCounter = LMIC.seqnoUp;
+    LMIC.seqnoUp++;
+    session.save();
+    TTNSessionData data;
+    check(session.snapshot(&data), "session snapshot");
+    session.persistFrameCounter(provisioning, data);
+
+    check(savedLimit() > (uint32_t)maxUsedCounter, "limit in NVS ahead of the used counters");
+}
+
+static void startAbpSession()
+{
+    nvs_mock_erase();
+    maxUsedCounter = -1;
+    powerOn();
+
+    uint32_t writes = TTNProvisioning::nvsWriteCount();
+    uint32_t mockWrites = nvs_mock_writes();
+    check(session.personalize(provisioning, DEV_ADDR, NWK_SKEY, APP_SKEY), "new ABP session");
+    check(LMIC.seqnoUp == 0, "new ABP session starts at 0");
+    check(savedLimit() == STRIDE, "first range reserved");
+    check(TTNProvisioning::nvsWriteCount() - writes == 2, "limit and session written");
+    check(nvs_mock_writes() - mockWrites == 2, "NVS writes counted");
+}
+
+// The limit is only advanced every STRIDE / 2 uplinks
+static void testWriteRate()
+{
+    startAbpSession();
+
+    const uint32_t uplinks = 20 * STRIDE;
+    uint32_t writes = TTNProvisioning::nvsWriteCount();
+    uint32_t mockWrites = nvs_mock_writes();
+    for (uint32_t i = 0; i < uplinks; i++)
+        sendUplink();
+
+    uint32_t written = TTNProvisioning::nvsWriteCount() - writes;
+    check(written == uplinks / (STRIDE / 2), "one NVS write per STRIDE / 2 uplinks");
+    check(nvs_mock_writes() - mockWrites == written, "nvsWriteCount() matches the NVS writes");
+    printf("%u uplinks: %u NVS writes\n", uplinks, written);
+}
+
+// Power losses after a random number of uplinks
+static void testPowerLoss()
+{
+    startAbpSession();
+
+    uint32_t lastCounter = 0;
+    for (int i = 0; i < 200; i++)
+    {
+        uint32_t uplinks = randomNumber(3 * STRIDE);
+        for (uint32_t n = 0; n < uplinks; n++)
+            sendUplink();
+
+        uint32_t limit = savedLimit();
+        powerOn();
+
+        // Both ways of resuming: from NVS only, and ABP with the same keys
+        uint32_t writes = TTNProvisioning::nvsWriteCount();
+        bool restored = (i & 1) != 0
+            ? session.restoreFromNvs(provisioning)
+            : session.personalize(provisioning, DEV_ADDR, NWK_SKEY, APP_SKEY);
+        check(restored, "session restored after power loss");
+        check(LMIC.devaddr == DEV_ADDR, "device address restored");
+        check(LMIC.seqnoUp == limit, "counter jumps ahead to the saved limit");
+        check((int64_t)LMIC.seqnoUp > maxUsedCounter, "no counter used twice");
+        check(LMIC.seqnoUp >= lastCounter, "counter never goes backwards");
+        check(savedLimit() == limit + STRIDE, "next range reserved");
+        check(TTNProvisioning::nvsWriteCount() - writes == 1, "one NVS write when resuming");
+        lastCounter = LMIC.seqnoUp;
+    }
+}
+
+// Resuming from RTC memory continues with the same counter and does not write NVS
+static void testDeepSleep()
+{
+    startAbpSession();
+
+    for (uint32_t n = 0; n < STRIDE / 3; n++)
+        sendUplink();
+
+    uint32_t counter = LMIC.seqnoUp;
+    uint32_t writes = TTNProvisioning::nvsWriteCount();
+    // LMIC is reset when waking up from deep sleep, the RTC memory is kept
+    LMIC_reset();
+    check(session.restore(), "session restored after deep sleep");
+    check(LMIC.seqnoUp == counter, "counter continues after deep sleep");
+    check(TTNProvisioning::nvsWriteCount() == writes, "no NVS write after deep sleep");
+
+    // A power loss later on still continues at the limit
+    uint32_t limit = savedLimit();
+    powerOn();
+    check(session.restoreFromNvs(provisioning), "session restored after power loss");
+    check(LMIC.seqnoUp == limit && (int64_t)LMIC.seqnoUp > maxUsedCounter, "counter after deep sleep and power loss");
+}
+
+int main(int argc, char* argv[])
+{
+    sim_radio_init(1);
+    os_init_ex(NULL);
+
+    testWriteRate();
+    testPowerLoss();
+    testDeepSleep();
+
+    printf("Session tests: %s (%d failures)\n", failures == 0 ? "passed" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+#!/usr/bin/env python3
+# *****************************************************************************
+#
+# ttn-esp32 - The Things Network device library for ESP-IDF / SX127x
+#
+# Copyright (c) 2019 ContextQuickie
+#
+# Licensed under MIT License
+# https://opensource.org/licenses/MIT
+#
+# Provisioning client for the binary provisioning protocol.
+#
+# Provision a device (the device EUI is derived from the MAC address if omitted):
+#
+#     python3 provision.py /dev/ttyUSB0 --app-eui 70B3D57ED0000000 \
+#         --app-key 00112233445566778899AABBCCDDEEFF --config interval=2c01
+#
+# Compare the throughput of the AT commands and the binary protocol:
+#
+#     python3 provision.py /dev/ttyUSB0 --app-eui ... --app-key ... --benchmark 50
+#
+# Requires pyserial.
+# *****************************************************************************
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+
+import serial
+
+FRAME_SYNC = 0xa5
+MAX_FRAME_PAYLOAD = 512
+
+CMD_PING = 0x01
+CMD_INFO = 0x02
+CMD_PROVISION = 0x10
+CMD_HASH = 0x11
+CMD_EXIT = 0x7f
+RESPONSE = 0x80
+
+STATUS_OK = 0
+STATUS_CRC_ERROR = 1
+STATUS_NAMES = ['OK', 'CRC error', 'unknown command', 'invalid data', 'storage error']
+
+FLAG_DEV_EUI_FROM_MAC = 0x01
+
+
+class ProvisioningError(Exception):
+    pass
+
+
+def crc16(data, crc=0xffff):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xffff
+    return crc
+
+
+def encode_frame(cmd, seq, payload=b''):
+    body = struct.pack('<BBH', cmd, seq, len(payload)) + payload
+    return bytes([FRAME_SYNC]) + body + struct.pack('<H', crc16(body))
+
+
+def dev_eui_from_mac(mac):
+    return mac[0:3] + b'\xff\xfe' + mac[3:6]
+
+
+def provisioning_hash(dev_eui, app_eui, app_key, config):
+    h = hashlib.sha256(dev_eui + app_eui + app_key)
+    for key, value in config:
+        h.update(bytes([len(key)]) + key.encode() + struct.pack('<H', len(value)) + value)
+    return h.digest()
+
+
+class BinaryClient:
+    """Client for the binary provisioning protocol (pipelined requests)"""
+
+    def __init__(self, port, timeout=2.0):
+        self.port = port
+        self.timeout = timeout
+        self.seq = 0
+        self.buffer = b''
+
+    def enter(self):
+        self.port.reset_input_buffer()
+        self.port.write(b'AT+BIN\r\n')
+        line = b''
+        deadline = time.monotonic() + self.timeout
+        while not line.endswith(b'OK\r\n'):
+            if line.endswith(b'ERROR\r\n') or time.monotonic() > deadline:
+                raise ProvisioningError('Device does not support binary provisioning')
+            line += self.port.read(1)
+        self.buffer = b''
+
+    def exit(self):
+        self.transact([(CMD_EXIT, b'')])
+
+    def transact(self, requests, retries=3):
+        """Sends all requests without waiting and returns the response payloads in order"""
+        pending = {}
+        for cmd, payload in requests:
+            seq = self.next_seq()
+            pending[seq] = (cmd, payload, retries)
+            self.port.write(encode_frame(cmd, seq, payload))
+
+        order = list(pending.keys())
+        results = {}
+        while pending:
+            response = self.read_frame()
+            if response is None:
+                # A request or its response got lost (e.g. a corrupted length field,
+                # or a CRC error response with a corrupted sequence number)
+                for seq in list(pending.keys()):
+                    if pending[seq][2] == 0:
+                        raise ProvisioningError('Timeout waiting for response')
+                    self.resend(pending, order, seq)
+                continue
+            cmd, seq, status, payload = response
+            if seq not in pending or cmd != pending[seq][0] | RESPONSE:
+                continue  # stale or spurious response
+            req_cmd, req_payload, left = pending[seq]
+            if status == STATUS_CRC_ERROR and left > 0:
+                self.resend(pending, order, seq)
+                continue
+            del pending[seq]
+            if status != STATUS_OK:
+                name = STATUS_NAMES[status] if status < len(STATUS_NAMES) else str(status)
+                raise ProvisioningError('Command 0x%02x failed: %s' % (req_cmd, name))
+            results[seq] = payload
+        return [results[seq] for seq in order]
+
+    def resend(self, pending, order, seq):
+        """Repeats a pending request with a new sequence number"""
+        cmd, payload, left = pending.pop(seq)
+        new_seq = self.next_seq()
+        pending[new_seq] = (cmd, payload, left - 1)
+        order[order.index(seq)] = new_seq
+        self.port.write(encode_frame(cmd, new_seq, payload))
+
+    def next_seq(self):
+        self.seq = (self.seq + 1) & 0xff
+        return self.seq
+
+    def read_frame(self):
+        """Returns the next valid response frame, or None after the timeout"""
+        deadline = time.monotonic() + self.timeout
+        while True:
+            start = self.buffer.find(bytes([FRAME_SYNC]))
+            if start < 0:
+                self.buffer = b''
+            else:
+                self.buffer = self.buffer[start:]
+                if len(self.buffer) >= 5:
+                    cmd, seq, length = struct.unpack('<BBH', self.buffer[1:5])
+                    if length > MAX_FRAME_PAYLOAD + 1:
+                        self.buffer = self.buffer[1:]
+                        continue
+                    total = 5 + length + 2
+                    if len(self.buffer) >= total:
+                        frame = self.buffer[:total]
+                        (crc,) = struct.unpack('<H', frame[-2:])
+                        if crc16(frame[1:-2]) != crc:
+                            self.buffer = self.buffer[1:]
+                            continue
+                        self.buffer = self.buffer[total:]
+                        return cmd, seq, frame[5], frame[6:-2]
+            if time.monotonic() > deadline:
+                return None
+            self.buffer += self.port.read(max(1, self.port.in_waiting))
+
+    def provision(self, dev_eui, app_eui, app_key, config):
+        """Provisions the device and verifies the hash of the stored values"""
+        flags = FLAG_DEV_EUI_FROM_MAC if dev_eui is None else 0
+        payload = bytes([flags]) + (dev_eui or bytes(8)) + app_eui + app_key
+        for key, value in config:
+            payload += bytes([len(key)]) + key.encode() + struct.pack('<H', len(value)) + value
+        if len(payload) > MAX_FRAME_PAYLOAD:
+            raise ProvisioningError('Too much configuration data')
+
+        # INFO and PROVISION are pipelined; the MAC is needed for the expected hash
+        info, prov_hash = self.transact([(CMD_INFO, b''), (CMD_PROVISION, payload)])
+        mac = info[1:7]
+        expected = provisioning_hash(dev_eui or dev_eui_from_mac(mac), app_eui, app_key, config)
+        if prov_hash != expected:
+            raise ProvisioningError('Hash of stored values does not match')
+        return mac
+
+
+def provision_at(port, dev_eui, app_eui, app_key, timeout=2.0):
+    """Provisions the device with the AT commands (for comparison)"""
+    if dev_eui is None:
+        cmd = 'AT+PROVM=%s-%s\r\n' % (app_eui.hex().upper(), app_key.hex().upper())
+    else:
+        cmd = 'AT+PROV=%s-%s-%s\r\n' % (dev_eui.hex().upper(), app_eui.hex().upper(), app_key.hex().upper())
+    port.reset_input_buffer()
+    port.write(cmd.encode())
+    response = b''
+    deadline = time.monotonic() + timeout
+    while not response.endswith(b'OK\r\n'):
+        if response.endswith(b'ERROR\r\n') or time.monotonic() > deadline:
+            raise ProvisioningError('AT provisioning failed')
+        response += port.read(max(1, port.in_waiting))
+
+
+def benchmark(port, client, dev_eui, app_eui, app_key, config, count):
+    start = time.monotonic()
+    for _ in range(count):
+        provision_at(port, dev_eui, app_eui, app_key)
+    at_time = time.monotonic() - start
+
+    start = time.monotonic()
+    client.enter()
+    for _ in range(count):
+        client.provision(dev_eui, app_eui, app_key, config)
+    client.exit()
+    bin_time = time.monotonic() - start
+
+    print('AT commands:     %d provisionings in %.2f s (%.1f ms each)' % (count, at_time, at_time * 1000 / count))
+    print('Binary protocol: %d provisionings in %.2f s (%.1f ms each, incl. verification and %d config values)' % (
+        count, bin_time, bin_time * 1000 / count, len(config)))
+
+
+def hex_bytes(length):
+    def parse(text):
+        value = bytes.fromhex(text)
+        if len(value) != length:
+            raise argparse.ArgumentTypeError('expected %d hex digits' % (2 * length))
+        return value
+    return parse
+
+
+def config_entry(text):
+    key, sep, value = text.partition('=')
+    if not sep or not 0 < len(key) < 16:
+        raise argparse.ArgumentTypeError('expected key=hexvalue (key with 1 to 15 characters)')
+    return key, bytes.fromhex(value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Provision ttn-esp32 devices using the binary protocol')
+    parser.add_argument('port', help='serial port')
+    parser.add_argument('--baudrate', type=int, default=115200)
+    parser.add_argument('--dev-eui', type=hex_bytes(8), help='device EUI (default: derived from MAC address)')
+    parser.add_argument('--app-eui', type=hex_bytes(8), required=True, help='application EUI')
+    parser.add_argument('--app-key', type=hex_bytes(16), required=True, help='application key')
+    parser.add_argument('--config', type=config_entry, action='append', default=[],
+                        help='application config value saved in NVS (key=hexvalue)')
+    parser.add_argument('--benchmark', type=int, metavar='N', help='compare N provisionings with AT commands and binary protocol')
+    args = parser.parse_args()
+
+    with serial.Serial(args.port, args.baudrate, timeout=0.05) as port:
+        client = BinaryClient(port)
+        try:
+            if args.benchmark:
+                benchmark(port, client, args.dev_eui, args.app_eui, args.app_key, args.config, args.benchmark)
+            else:
+                client.enter()
+                mac = client.provision(args.dev_eui, args.app_eui, args.app_key, args.config)
+                client.exit()
+                print('Device %s provisioned and verified' % mac.hex(':'))
+        except ProvisioningError as e:
+            print('Error: %s' % e, file=sys.stderr)
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
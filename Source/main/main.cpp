@@ -86,6 +86,9 @@ extern "C" void app_main()
   /* Reuired for Axp192_GetBatteryCharge */
   Axp192_SetCoulombSwitchControlState(Axp192_On);
 
+  /* Required for Axp192_GetInternalTemperature */
+  Axp192_SetAdcState(Axp192_InternalTemperatureMonitoringAdc, Axp192_On);
+
   if (xTaskCreatePinnedToCore(Task1000ms, "Task1000ms", 4096, NULL, 10, NULL, 0) == pdPASS)
   {
     /* The task was created.  Use the task's handle to delete the task. */
@@ -150,7 +153,24 @@ static void InitializeComponents()
   // The below line can be commented after the first run as the data is saved in NVS
   ttn.provision(TTN_DEVICE_EUI, TTN_APPLICATION_EUI, TTN_APPLICATION_SESSION_KEY);
 
-  ttn.join();
+  /* Limit the time spent joining, GPS and display are powered meanwhile */
+  TTNJoinPolicy joinPolicy = { 60000, TTN_JOIN_DR_LAST, 60, 3600 };
+  ttn.setJoinPolicy(joinPolicy);
+
+  /* The session is kept in RTC memory during deep sleep, a join is only required after power loss */
+  if (!ttn.resumeAfterDeepSleep())
+  {
+    if (!ttn.join())
+    {
+      uint32_t retryDelay = ttn.getJoinRetryDelay();
+      ESP_LOGW(__FUNCTION__, "Join failed, retrying in %u s", retryDelay);
+      Display_DeInit();
+      Axp192_SetLdo2State(Axp192_Off);
+      Axp192_SetLdo3State(Axp192_Off);
+      Axp192_DeInit();
+      esp_deep_sleep(SLEEP_TIME_FROM_SECONDS((uint64_t)retryDelay));
+    }
+  }
 }
 
 static void Task1000ms(void *pvParameters)
@@ -196,17 +216,34 @@ static void Task1000ms(void *pvParameters)
     lastDischargeCurrent = currentDisChargeCurrent;
     lastBatteryCharge = currentBatteryCharge;
 
+    /* With external power, the receiver is kept open for downlinks (Class C) */
+    bool externalPower = (Axp192_GetVbusState() == Axp192_On);
+    if (externalPower != ttn.isClassC())
+    {
+      ESP_LOGI(__FUNCTION__, "Switching to Class %c", externalPower ? 'C' : 'A');
+      ttn.setClassC(externalPower);
+    }
+
     if ((Task1000ms_SecondCounter % 100) == 0)
     {
       Neo6_GeodeticPositionSolutionType geodeticPositionSolution;
       if (Neo6_GetGeodeticPositionSolution(&geodeticPositionSolution) == Neo6_Success)
       {
         ESP_LOGI(__FUNCTION__, "Sending TTN data");
+
+        /* The system clock is kept during deep sleep, the time is only requested after power loss */
+        if (!ttn.isTimeSynchronized())
+        {
+          ttn.requestNetworkTime();
+        }
+        /* The clock error of the RX windows is calibrated per temperature */
+        ttn.setTemperature((int8_t)(Axp192_GetInternalTemperature() / 10));
         ttn.transmitMessage((uint8_t*)&geodeticPositionSolution, sizeof(Neo6_GeodeticPositionSolutionType), 1, false);
       }
     }
 
-    if ((Task1000ms_SecondCounter % 150) == 0)
+    /* Deep sleep is only used on battery power */
+    if (((Task1000ms_SecondCounter % 150) == 0) && (externalPower == false))
     {
       ESP_LOGI(__FUNCTION__, "Shutdown");
 